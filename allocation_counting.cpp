@@ -0,0 +1,85 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "allocation_stats.h"
+#include <cstdlib>      // std::malloc, std::free, std::aligned_alloc
+#include <new>          // std::bad_alloc, std::align_val_t, std::get_new_handler, std::new_handler
+
+
+// The replacement of the global operator new counting the allocations (see allocation_stats.h).
+// It's program-wide, so it's up to the program to link it in; the X11KeyboardWindowLib library doesn't.
+
+namespace
+{
+    // Constant initialization of the flag precedes this one, so it can't be overwritten
+    [[maybe_unused]] const bool isCountingMarked = (x11kw::memory::detail::isAllocationCountingLinkedIn = true);
+
+    // [new.delete.single]: while the allocation fails, the new handler (if any) is called and it's retried
+    template<typename Allocate>
+    void* allocateOrThrow(const Allocate& allocate)
+    {
+        for (;;)
+        {
+            if (void* const ptr = allocate(); ptr != nullptr)
+                return ptr;
+
+            const std::new_handler handler = std::get_new_handler();
+            if (handler == nullptr)
+                throw std::bad_alloc{};
+            handler();
+        }
+    }
+}
+
+
+// The replacements of the global allocation functions. The array and the nothrow versions
+//   call these ones by default.
+
+void* operator new(const std::size_t size)
+{
+    x11kw::memory::detail::countAllocation(size);
+    return allocateOrThrow([size] { return std::malloc((size == 0) ? 1 : size); });
+}
+
+void* operator new(const std::size_t size, const std::align_val_t alignment)
+{
+    x11kw::memory::detail::countAllocation(size);
+
+    // std::aligned_alloc wants the size to be a multiple of the alignment
+    const auto align = static_cast<std::size_t>(alignment);
+    const std::size_t alignedSize = (size + align - 1) / align * align;
+    return allocateOrThrow([align, alignedSize] {
+        return std::aligned_alloc(align, (alignedSize == 0) ? align : alignedSize);
+    });
+}
+
+void operator delete(void* const ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* const ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* const ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* const ptr, std::size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
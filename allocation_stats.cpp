@@ -0,0 +1,97 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "allocation_stats.h"
+#include "logging.h"
+#include "x11_flags_strings.h"
+#include <string_view>  // std::string_view
+
+
+namespace x11kw::memory
+{
+    namespace
+    {
+        // Plain (not atomic) thread-local counters: the operator new must stay cheap
+        thread_local std::uint64_t threadAllocationCount = 0;
+        thread_local std::uint64_t threadAllocatedBytes = 0;
+    }
+
+
+    namespace detail
+    {
+        bool isAllocationCountingLinkedIn = false;
+
+        void countAllocation(const std::size_t size)
+        {
+            ++threadAllocationCount;
+            threadAllocatedBytes += size;
+        }
+    }
+
+
+    AllocationCounters getThreadAllocations()
+    {
+        return { threadAllocationCount, threadAllocatedBytes };
+    }
+
+    bool isAllocationCountingEnabled()
+    {
+        return detail::isAllocationCountingLinkedIn;
+    }
+
+
+    void AllocationStats::record(const int eventType, const AllocationCounters& allocations)
+    {
+        const std::size_t typeIndex = ( (eventType >= 0) && (eventType < LASTEvent) ) ? eventType : noEventType;
+        PerEventType& counters = perEventType_[typeIndex];
+
+        counters.eventCount.fetch_add(1, std::memory_order_relaxed);
+        if (allocations.count == 0)
+            return;
+
+        counters.allocatingEventCount.fetch_add(1, std::memory_order_relaxed);
+        counters.allocationCount.fetch_add(allocations.count, std::memory_order_relaxed);
+        counters.allocatedBytes.fetch_add(allocations.bytes, std::memory_order_relaxed);
+    }
+
+    void AllocationStats::report() const
+    {
+        if (!logging::isEnabled(logging::Level::info))
+            return;
+
+        if (!isAllocationCountingEnabled())
+        {
+            logging::myLogImpl("Allocation statistics are not collected: allocation_counting.cpp is not linked in", '\n');
+            return;
+        }
+
+        logging::myLogImpl("Allocation statistics (event type: events, events allocating, allocations, bytes):", '\n');
+
+        for (int eventType = 0; eventType < LASTEvent; ++eventType)
+        {
+            const PerEventType& counters = perEventType_[eventType];
+            const std::uint64_t eventCount = counters.eventCount.load(std::memory_order_relaxed);
+            if (eventCount == 0)
+                continue;
+
+            logging::myLogImpl(
+                "    ", (eventType == noEventType) ? std::string_view{ "(batch)" } : XEventTypeToString(eventType), ": ",
+                eventCount, ", ", counters.allocatingEventCount.load(std::memory_order_relaxed), ", ",
+                counters.allocationCount.load(std::memory_order_relaxed), ", ",
+                counters.allocatedBytes.load(std::memory_order_relaxed),
+                '\n'
+            );
+        }
+    }
+}
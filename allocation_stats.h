@@ -0,0 +1,109 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>       // LASTEvent
+#include <atomic>           // std::atomic
+#include <cstdint>          // std::uint64_t
+#include <cstddef>          // std::size_t, std::byte
+#include <memory_resource>  // std::pmr::monotonic_buffer_resource
+
+
+// Accounting of the heap allocations made by the event processing.
+// The allocations of every thread are counted by the replacement of the global operator new in
+//   allocation_counting.cpp, which only the programs wanting it link in (X11KeyboardWindow does, the library
+//   X11KeyboardWindowLib doesn't); without it the counters stay zero. The C allocations (e.g. the Xlib's own mallocs)
+//   are not counted.
+namespace x11kw::memory
+{
+    struct AllocationCounters
+    {
+        std::uint64_t count;
+        std::uint64_t bytes;
+
+        AllocationCounters operator-(const AllocationCounters& other) const
+        {
+            return { count - other.count, bytes - other.bytes };
+        }
+    };
+
+    // The allocations made by the current thread since its start
+    AllocationCounters getThreadAllocations();
+
+    // Whether the program counts the allocations at all (links allocation_counting.cpp in)
+    bool isAllocationCountingEnabled();
+
+    namespace detail
+    {
+        // Set by allocation_counting.cpp during the static initialization
+        extern bool isAllocationCountingLinkedIn;
+
+        // Called by the replaced operator new
+        void countAllocation(std::size_t size);
+    }
+
+
+    // The allocations made while handling the events, per event type.
+    // Recording is a few relaxed atomic increments, it may be done from any number of threads.
+    class AllocationStats
+    {
+    public:
+        // The allocations outside of any event handling (e.g. per batch) are recorded with this event type
+        static constexpr int noEventType = 0;
+
+    public:
+        void record(int eventType, const AllocationCounters& allocations);
+
+        // Prints the counters of all the recorded event types to the log (at the info level)
+        void report() const;
+
+    private:
+        struct PerEventType
+        {
+            std::atomic<std::uint64_t> eventCount{ 0 };
+            // The events which allocated anything at all
+            std::atomic<std::uint64_t> allocatingEventCount{ 0 };
+            std::atomic<std::uint64_t> allocationCount{ 0 };
+            std::atomic<std::uint64_t> allocatedBytes{ 0 };
+        };
+
+    private:
+        PerEventType perEventType_[LASTEvent];
+    };
+
+
+    // Storage for the temporaries of handling one event (or one batch of them): the allocations
+    //   are carved out of a fixed buffer and freed all at once by reset(), so in the steady state
+    //   they don't reach the heap. Only the overflow of the buffer goes to operator new.
+    template<std::size_t BufferSize>
+    class EventArena
+    {
+    public:
+        EventArena() = default;
+
+        EventArena(const EventArena&) = delete;
+        EventArena& operator=(const EventArena&) = delete;
+
+    public:
+        [[nodiscard]] std::pmr::memory_resource* getResource() { return &resource_; }
+
+        // Invalidates everything allocated from the arena
+        void reset() { resource_.release(); }
+
+    private:
+        alignas(std::max_align_t) std::byte buffer_[BufferSize];
+        std::pmr::monotonic_buffer_resource resource_{ buffer_, sizeof(buffer_) };
+    };
+}
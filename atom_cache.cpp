@@ -0,0 +1,203 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "atom_cache.h"
+#include "logging.h"
+#include <X11/Xatom.h>  // XA_LAST_PREDEFINED
+#include <iterator>     // std::size
+#include <utility>      // std::move
+#include <vector>       // std::vector
+
+
+namespace
+{
+    // The atoms which are likely to appear in the events of a keyboard window
+    const char* const wellKnownAtomNames[] = {
+        "WM_PROTOCOLS",
+        "WM_DELETE_WINDOW",
+        "WM_TAKE_FOCUS",
+        "WM_STATE",
+        "UTF8_STRING",
+        "_NET_WM_PING",
+        "_NET_WM_SYNC_REQUEST",
+        "_NET_WM_NAME",
+        "_NET_WM_PID",
+        "_NET_WM_STATE",
+        "_NET_WM_USER_TIME",
+        "_NET_WM_WINDOW_TYPE",
+        "_NET_ACTIVE_WINDOW",
+        "_NET_FRAME_EXTENTS",
+        "_XIM_XCONNECT",
+        "_XIM_PROTOCOL",
+        "_XIM_MOREDATA",
+        "_XIM_SERVERS",
+    };
+}
+
+
+AtomCache::AtomCache(Display* const display)
+    : display_(display)
+#ifdef X11KW_WITH_XCB
+    , xcb_(display)
+#endif
+{
+    // The predefined atoms: we know their values, so ask for the names
+    constexpr int predefinedCount = static_cast<int>(XA_LAST_PREDEFINED);
+    Atom predefinedAtoms[predefinedCount];
+    for (int i = 0; i < predefinedCount; ++i)
+        predefinedAtoms[i] = static_cast<Atom>(i + 1);
+
+    // The well-known atoms: we know their names, so ask for the values.
+    // only_if_exists is True to not create the atoms nobody uses on this server.
+    constexpr int wellKnownCount = static_cast<int>(std::size(wellKnownAtomNames));
+
+#ifdef X11KW_WITH_XCB
+    // All the requests of both the groups go out before the first reply is waited for
+    const auto namesRequest = xcb_.sendGetAtomNames(predefinedAtoms, predefinedCount);
+    const auto atomsRequest = xcb_.sendInternAtoms(wellKnownAtomNames, wellKnownCount, true);
+    const std::vector<std::string> predefinedAtomNames = xcb_.receiveAtomNames(namesRequest);
+    const std::vector<Atom> wellKnownAtoms = xcb_.receiveAtoms(atomsRequest);
+    roundTripCount_ += 1;
+
+    for (int i = 0; i < predefinedCount; ++i)
+    {
+        if (!predefinedAtomNames[i].empty())
+            remember(predefinedAtoms[i], predefinedAtomNames[i]);
+    }
+#else
+    char* predefinedAtomNames[predefinedCount] = {};
+    ++roundTripCount_;
+    if (MY_LOG_X11_CALL(XGetAtomNames(display_, predefinedAtoms, predefinedCount, predefinedAtomNames)) != 0)
+    {
+        for (int i = 0; i < predefinedCount; ++i)
+        {
+            if (predefinedAtomNames[i] == nullptr)
+                continue;
+            remember(predefinedAtoms[i], predefinedAtomNames[i]);
+            XFree(predefinedAtomNames[i]);
+        }
+    }
+
+    Atom wellKnownAtoms[wellKnownCount] = {};
+    ++roundTripCount_;
+    MY_LOG_X11_CALL(XInternAtoms(
+        display_,
+        const_cast<char**>(wellKnownAtomNames),
+        wellKnownCount,
+        True,
+        wellKnownAtoms
+    ));
+#endif
+
+    for (int i = 0; i < wellKnownCount; ++i)
+    {
+        if (wellKnownAtoms[i] != None)
+            remember(wellKnownAtoms[i], wellKnownAtomNames[i]);
+    }
+}
+
+
+Atom AtomCache::intern(const std::string& name)
+{
+    if (const auto iter = atoms_.find(name); iter != atoms_.end())
+        return iter->second;
+
+    ++roundTripCount_;
+#ifdef X11KW_WITH_XCB
+    const char* const nameStr = name.c_str();
+    const Atom atom = xcb_.internAtoms(&nameStr, 1, false).front();
+#else
+    const Atom atom = MY_LOG_X11_CALL(XInternAtom(display_, name.c_str(), False));
+#endif
+    if (atom != None)
+        remember(atom, name);
+
+    return atom;
+}
+
+std::vector<Atom> AtomCache::internAll(const std::vector<std::string>& names)
+{
+    std::vector<Atom> atoms(names.size(), None);
+    std::vector<const char*> missingNames;
+    std::vector<std::size_t> missingIndices;
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+        if (const auto iter = atoms_.find(names[i]); iter != atoms_.end())
+        {
+            atoms[i] = iter->second;
+        }
+        else
+        {
+            missingNames.push_back(names[i].c_str());
+            missingIndices.push_back(i);
+        }
+    }
+
+    if (missingNames.empty())
+        return atoms;
+
+    ++roundTripCount_;
+#ifdef X11KW_WITH_XCB
+    const std::vector<Atom> missingAtoms = xcb_.internAtoms(missingNames.data(), missingNames.size(), false);
+#else
+    std::vector<Atom> missingAtoms(missingNames.size(), None);
+    MY_LOG_X11_CALL(XInternAtoms(
+        display_,
+        const_cast<char**>(missingNames.data()),
+        static_cast<int>(missingNames.size()),
+        False,
+        missingAtoms.data()
+    ));
+#endif
+
+    for (std::size_t i = 0; i < missingAtoms.size(); ++i)
+    {
+        atoms[missingIndices[i]] = missingAtoms[i];
+        if (missingAtoms[i] != None)
+            remember(missingAtoms[i], names[missingIndices[i]]);
+    }
+
+    return atoms;
+}
+
+const std::string& AtomCache::getName(const Atom atom)
+{
+    if (const auto iter = names_.find(atom); iter != names_.end())
+        return iter->second;
+
+    std::string name;
+    if (atom != None)
+    {
+        ++roundTripCount_;
+#ifdef X11KW_WITH_XCB
+        name = std::move(xcb_.getAtomNames(&atom, 1).front());
+#else
+        if (char* const atomStr = MY_LOG_X11_CALL(XGetAtomName(display_, atom)); atomStr != nullptr)
+        {
+            name = atomStr;
+            XFree(atomStr);
+        }
+#endif
+    }
+
+    // Remembered even if empty, so the failed lookups aren't repeated either
+    return names_.emplace(atom, std::move(name)).first->second;
+}
+
+
+void AtomCache::remember(const Atom atom, std::string name)
+{
+    atoms_.emplace(name, atom);
+    names_.insert_or_assign(atom, std::move(name));
+}
@@ -0,0 +1,66 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>
+#include <string>           // std::string
+#include <unordered_map>    // std::unordered_map
+#include <vector>           // std::vector
+#include <cstddef>          // std::size_t
+#ifdef X11KW_WITH_XCB
+    #include "xcb_transport.h"
+#endif
+
+
+// Client-side cache of the atom <-> name mappings of one display.
+// Avoids a synchronous server round trip per XGetAtomName/XInternAtom for the already known atoms.
+// Not thread-safe.
+class AtomCache
+{
+public:
+    // Prepopulates the cache with the predefined and well-known atoms (WM_PROTOCOLS, _NET_*, _XIM_*, ...)
+    //   using one batched request for each of the groups.
+    // With X11KW_WITH_XCB both the groups are requested over XCB at once, which is a single round trip.
+    explicit AtomCache(Display* display);
+
+    AtomCache(const AtomCache&) = delete;
+    AtomCache& operator=(const AtomCache&) = delete;
+
+public:
+    // XInternAtom(display, name, False), but asks the server only for the atoms not known yet.
+    Atom intern(const std::string& name);
+
+    // intern() of all the names, but the atoms not known yet are requested together: at most one round trip.
+    std::vector<Atom> internAll(const std::vector<std::string>& names);
+
+    // XGetAtomName, but asks the server only for the atoms not known yet.
+    // Returns an empty string for None and for the atoms the server couldn't name.
+    const std::string& getName(Atom atom);
+
+    // The number of the synchronous requests to the server made so far (including the prepopulation)
+    [[nodiscard]] std::size_t getRoundTripCount() const { return roundTripCount_; }
+
+private:
+    void remember(Atom atom, std::string name);
+
+private:
+    Display* const display_;
+#ifdef X11KW_WITH_XCB
+    XcbTransport xcb_;
+#endif
+    std::unordered_map<Atom, std::string> names_;
+    std::unordered_map<std::string, Atom> atoms_;
+    std::size_t roundTripCount_ = 0;
+};
@@ -0,0 +1,77 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <chrono>       // std::chrono::steady_clock
+#include <cstdint>      // std::uint64_t
+#include <cstdio>       // std::printf
+#include <string_view>  // std::string_view
+#include <algorithm>    // std::min
+
+
+// A minimal microbenchmark harness shared by all the benchmarks, so building them needs nothing besides
+//   the libraries X11KeyboardWindow itself uses.
+namespace bench
+{
+    // Makes the compiler believe the value is used, so the computation of it isn't optimized out
+    template<typename T>
+    inline void doNotOptimize(const T& value)
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    struct Result
+    {
+        std::string_view name;
+        std::uint64_t iterations;
+        double nsPerIteration;
+    };
+
+    // Calls body(iterationIndex) in a loop, growing the number of iterations until a run takes at least
+    //   minRunTime, then repeats the run several times and reports the fastest one.
+    template<typename Body>
+    Result run(const std::string_view name, Body&& body,
+               const std::chrono::nanoseconds minRunTime = std::chrono::milliseconds{ 200 },
+               const int repetitions = 5)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        const auto measure = [&body](const std::uint64_t iterations) {
+            const auto start = Clock::now();
+            for (std::uint64_t i = 0; i < iterations; ++i)
+                body(i);
+            return Clock::now() - start;
+        };
+
+        std::uint64_t iterations = 1;
+        while (measure(iterations) < minRunTime / 10)
+            iterations *= 10;
+        iterations *= 10;
+
+        auto best = measure(iterations);
+        for (int i = 1; i < repetitions; ++i)
+            best = std::min(best, measure(iterations));
+
+        const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(best).count());
+        return { name, iterations, ns / static_cast<double>(iterations) };
+    }
+
+    inline void print(const Result& result)
+    {
+        std::printf("%-48.*s %12.2f ns/iter  (%llu iterations)\n",
+                    static_cast<int>(result.name.size()), result.name.data(),
+                    result.nsPerIteration, static_cast<unsigned long long>(result.iterations));
+    }
+}
@@ -0,0 +1,248 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Microbenchmarks of the CPU-only building blocks: the logging, the flags strings, XRAIIWrapper and
+//   the event formatting. The events are canned, so no display is needed.
+// The log output goes to /dev/null, so the numbers include the hand-off to the log writer thread
+//   but not the terminal.
+
+#include "logging.h"
+#include "event_logging.h"
+#include "x11_flags_strings.h"
+#include "x_raii_wrapper.h"
+#include "benchmark_harness.h"
+#include <X11/Xlib.h>
+#include <fcntl.h>      // open
+#include <unistd.h>     // close, STDERR_FILENO
+#include <cstdint>      // std::uint64_t
+#include <cstdlib>      // std::malloc
+#include <cstring>      // std::memset
+#include <functional>   // std::function
+#include <string>       // std::string
+#include <string_view>  // std::string_view
+#include <utility>      // std::move
+
+
+namespace
+{
+    XEvent makeKeyEvent(const int type)
+    {
+        XEvent event;
+        std::memset(&event, 0, sizeof(event));
+
+        event.xkey.type = type;
+        event.xkey.serial = 1234;
+        event.xkey.window = 0x3a00001;
+        event.xkey.root = 0x1e5;
+        event.xkey.time = 98765432;
+        event.xkey.x = 120;
+        event.xkey.y = 80;
+        event.xkey.x_root = 270;
+        event.xkey.y_root = 130;
+        event.xkey.state = ShiftMask | Mod2Mask;
+        event.xkey.keycode = 38;
+        event.xkey.same_screen = True;
+
+        return event;
+    }
+
+    XEvent makeButtonEvent(const int type)
+    {
+        XEvent event;
+        std::memset(&event, 0, sizeof(event));
+
+        event.xbutton.type = type;
+        event.xbutton.serial = 1234;
+        event.xbutton.window = 0x3a00001;
+        event.xbutton.root = 0x1e5;
+        event.xbutton.time = 98765432;
+        event.xbutton.x = 120;
+        event.xbutton.y = 80;
+        event.xbutton.x_root = 270;
+        event.xbutton.y_root = 130;
+        event.xbutton.state = Button1Mask | Mod2Mask;
+        event.xbutton.button = Button1;
+        event.xbutton.same_screen = True;
+
+        return event;
+    }
+
+    XEvent makeClientMessageEvent(const int format)
+    {
+        XEvent event;
+        std::memset(&event, 0, sizeof(event));
+
+        event.xclient.type = ClientMessage;
+        event.xclient.serial = 1234;
+        event.xclient.window = 0x3a00001;
+        event.xclient.message_type = 300;
+        event.xclient.format = format;
+        for (int i = 0; i < 5; ++i)
+            event.xclient.data.l[i] = 1000 + i;
+
+        return event;
+    }
+
+    XEvent makeUndetailedEvent(const int type)
+    {
+        XEvent event;
+        std::memset(&event, 0, sizeof(event));
+
+        event.xany.type = type;
+        event.xany.serial = 1234;
+        event.xany.window = 0x3a00001;
+
+        return event;
+    }
+}
+
+
+namespace
+{
+    void benchmarkLogging()
+    {
+        bench::print(bench::run("myLogImpl: literal", [](std::uint64_t) {
+            x11kw::logging::myLogImpl("Starting the event loop...", '\n');
+        }));
+
+        bench::print(bench::run("myLogImpl: integers", [](const std::uint64_t i) {
+            x11kw::logging::myLogImpl("Processed a batch of ", i, " events (", i / 3, " coalesced), state ", 0x1234u, '\n');
+        }));
+
+        const std::string text = "composed text";
+        const std::string_view view = "string view";
+        const void* const pointer = &text;
+        const char* const nullString = nullptr;
+        bench::print(bench::run("myLogImpl: pointers and strings", [&](std::uint64_t) {
+            x11kw::logging::myLogImpl(pointer, ", ", nullString, ", ", text, ", ", view, '\n');
+        }));
+
+        bench::print(bench::run("MY_LOG (with the location)", [](std::uint64_t) {
+            MY_LOG("wmDeleteMessage received. Exit the event loop...");
+        }));
+
+        // The records over logging::detail::logRecordCapacity are split into several
+        const std::string longText256(256, 'x');
+        bench::print(bench::run("myLogImpl: 256 bytes", [&longText256](std::uint64_t) {
+            x11kw::logging::myLogImpl(longText256, '\n');
+        }));
+        const std::string longText4096(4096, 'x');
+        bench::print(bench::run("myLogImpl: 4096 bytes", [&longText4096](std::uint64_t) {
+            x11kw::logging::myLogImpl(longText4096, '\n');
+        }));
+
+        const x11kw::logging::Level savedLevel = x11kw::logging::runtimeMinLevel;
+        x11kw::logging::runtimeMinLevel = x11kw::logging::Level::off;
+        bench::print(bench::run("MY_LOG_DEBUG (disabled at runtime)", [](const std::uint64_t i) {
+            MY_LOG_DEBUG("Is never formatted ", i);
+            bench::doNotOptimize(i);
+        }));
+        x11kw::logging::runtimeMinLevel = savedLevel;
+    }
+
+    void benchmarkFlagsStrings()
+    {
+        bench::print(bench::run("XModifiersStateToString", [](const std::uint64_t i) {
+            bench::doNotOptimize(XModifiersStateToString(static_cast<unsigned int>((i * 0x111) & 0x1FFF)));
+        }));
+
+        const XIMStyle styles[] = { XIMPreeditNothing | XIMStatusNothing, XIMPreeditCallbacks | XIMStatusNothing };
+        bench::print(bench::run("XIMStyleToString", [&styles](const std::uint64_t i) {
+            bench::doNotOptimize(XIMStyleToString(styles[i & 1]));
+        }));
+    }
+
+    void benchmarkXRAIIWrapper()
+    {
+        bench::print(bench::run("XRAIIWrapper: noop deleter", [](std::uint64_t) {
+            const XRAIIWrapper<Window> wrapper{ Window{ 0x3a00001 } };
+            bench::doNotOptimize(wrapper.getResource());
+        }));
+
+        static std::size_t releasedCount = 0;
+        bench::print(bench::run("XRAIIWrapper: stateless lambda deleter", [](std::uint64_t) {
+            const XRAIIWrapper wrapper{ Window{ 0x3a00001 }, [](Window& w) { bench::doNotOptimize(w); ++releasedCount; } };
+            bench::doNotOptimize(wrapper.getResource());
+        }));
+
+        // For comparison with the type-erased deleter the wrapper used to have
+        bench::print(bench::run("XRAIIWrapper: std::function deleter", [](std::uint64_t) {
+            const XRAIIWrapper<Window, std::function<void(Window&)>> wrapper{
+                Window{ 0x3a00001 },
+                [](Window& w) { bench::doNotOptimize(w); ++releasedCount; }
+            };
+            bench::doNotOptimize(wrapper.getResource());
+        }));
+        bench::doNotOptimize(releasedCount);
+
+        bench::print(bench::run("XRAIIWrapper: move", [](std::uint64_t) {
+            XRAIIWrapper<Window> first{ Window{ 0x3a00001 } };
+            XRAIIWrapper<Window> second{ std::move(first) };
+            first = std::move(second);
+            bench::doNotOptimize(first.getResource());
+        }));
+
+        // XFree is free() underneath, so it works for malloc'd memory without a display.
+        // Includes the trace logging of the XFree call (unless the trace level is compiled out or disabled).
+        bench::print(bench::run("XRAIIWrapper: XFreeDeleter", [](std::uint64_t) {
+            const XRAIIWrapper<char*, XFreeDeleter> wrapper{ static_cast<char*>(std::malloc(64)) };
+            bench::doNotOptimize(wrapper.getResource());
+        }));
+    }
+
+    void benchmarkEventLogging()
+    {
+        const struct
+        {
+            std::string_view name;
+            XEvent event;
+        } events[] = {
+            { "logX11Event: KeyPress", makeKeyEvent(KeyPress) },
+            { "logX11Event: KeyRelease", makeKeyEvent(KeyRelease) },
+            { "logX11Event: ButtonPress", makeButtonEvent(ButtonPress) },
+            { "logX11Event: ButtonRelease", makeButtonEvent(ButtonRelease) },
+            { "logX11Event: ClientMessage (format 8)", makeClientMessageEvent(8) },
+            { "logX11Event: ClientMessage (format 16)", makeClientMessageEvent(16) },
+            { "logX11Event: ClientMessage (format 32)", makeClientMessageEvent(32) },
+            { "logX11Event: KeymapNotify", makeUndetailedEvent(KeymapNotify) },
+            { "logX11Event: FocusIn", makeUndetailedEvent(FocusIn) },
+        };
+
+        for (const auto& [name, event] : events)
+        {
+            bench::print(bench::run(name, [&event = event](std::uint64_t) {
+                x11kw::logging::logX11Event(event, false);
+            }));
+        }
+    }
+}
+
+
+int main()
+{
+    const int nullFd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (nullFd >= 0)
+        x11kw::logging::setOutputFileDescriptor(nullFd);
+
+    benchmarkLogging();
+    benchmarkFlagsStrings();
+    benchmarkXRAIIWrapper();
+    benchmarkEventLogging();
+
+    x11kw::logging::setOutputFileDescriptor(STDERR_FILENO);
+    if (nullFd >= 0)
+        ::close(nullFd);
+
+    return 0;
+}
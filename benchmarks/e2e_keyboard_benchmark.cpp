@@ -0,0 +1,461 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// End-to-end benchmark: starts X11KeyboardWindow, types into it via XTest and collects its latency statistics.
+// Needs an X server without a window manager, e.g.
+//   xvfb-run -a -s "-screen 0 1024x768x24" X11KeyboardWindowE2EBenchmark --rate 2000 --count 5000
+//
+// The streams:
+//   * ascii   – the lowercase letters, digits and the space;
+//   * compose – dead_acute + vowel sequences (a spare keycode is mapped to dead_acute for the run);
+//   * preedit – long runs of letters followed by a space. With an IME (XMODIFIERS=@im=...) running on the
+//               display they stay in the preedit until committed; without one they're the same as ascii.
+
+#include "x_raii_wrapper.h"
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+#include <sys/wait.h>   // waitpid
+#include <unistd.h>     // fork, execl, pipe, dup2, read, close
+#include <poll.h>       // poll
+#include <signal.h>     // kill, SIGTERM
+#include <chrono>       // std::chrono::steady_clock
+#include <thread>       // std::this_thread::sleep_until
+#include <string>       // std::string
+#include <string_view>  // std::string_view
+#include <vector>       // std::vector
+#include <cstdio>       // std::printf, std::fprintf
+#include <cstdlib>      // std::strtol, std::setenv
+#include <stdexcept>    // std::runtime_error
+#include <exception>    // std::exception
+
+
+#ifndef X11KW_KEYBOARD_WINDOW_PATH
+    #error "X11KW_KEYBOARD_WINDOW_PATH must point to the X11KeyboardWindow executable"
+#endif
+
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        long rate = 1000;           // keystrokes (press + release) per second
+        long count = 2000;          // keystrokes per stream
+        long consumerThreads = 0;   // X11KW_KEY_CONSUMER_THREADS of the window
+        std::vector<std::string> streams = { "ascii", "compose", "preedit" };
+    };
+
+    Options parseOptions(const int argc, char* argv[]) noexcept(false)
+    {
+        Options options;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string_view arg = argv[i];
+            if (i + 1 >= argc)
+                throw std::runtime_error("Missing the value of " + std::string(arg));
+            const char* const value = argv[++i];
+
+            if (arg == "--rate")
+                options.rate = std::strtol(value, nullptr, 10);
+            else if (arg == "--count")
+                options.count = std::strtol(value, nullptr, 10);
+            else if (arg == "--consumer-threads")
+                options.consumerThreads = std::strtol(value, nullptr, 10);
+            else if (arg == "--streams")
+            {
+                options.streams.clear();
+                std::string_view list = value;
+                while (!list.empty())
+                {
+                    const auto comma = list.find(',');
+                    options.streams.emplace_back(list.substr(0, comma));
+                    list = (comma == std::string_view::npos) ? std::string_view{} : list.substr(comma + 1);
+                }
+            }
+            else
+                throw std::runtime_error("Unknown option " + std::string(arg));
+        }
+
+        if ( (options.rate <= 0) || (options.count <= 0) )
+            throw std::runtime_error("--rate and --count must be positive");
+
+        return options;
+    }
+
+
+    struct Stream
+    {
+        std::vector<KeyCode> keystrokes;
+        // The number of the key presses expected to reach the window's handling (not filtered out by the input method)
+        std::size_t expectedKeyPresses;
+    };
+
+    KeyCode requireKeycode(Display* const display, const KeySym keySym) noexcept(false)
+    {
+        const KeyCode keycode = XKeysymToKeycode(display, keySym);
+        if (keycode == 0)
+            throw std::runtime_error(std::string("No keycode for the keysym ") + XKeysymToString(keySym));
+        return keycode;
+    }
+
+    Stream makeStream(Display* const display, const std::string_view name, const long count,
+                      const KeyCode deadAcuteKeycode) noexcept(false)
+    {
+        Stream stream{};
+        stream.keystrokes.reserve(static_cast<std::size_t>(count));
+
+        if (name == "ascii")
+        {
+            std::vector<KeyCode> keycodes;
+            for (KeySym keySym = XK_a; keySym <= XK_z; ++keySym)
+                keycodes.push_back(requireKeycode(display, keySym));
+            for (KeySym keySym = XK_0; keySym <= XK_9; ++keySym)
+                keycodes.push_back(requireKeycode(display, keySym));
+            keycodes.push_back(requireKeycode(display, XK_space));
+
+            for (long i = 0; i < count; ++i)
+                stream.keystrokes.push_back(keycodes[static_cast<std::size_t>(i) % keycodes.size()]);
+            stream.expectedKeyPresses = stream.keystrokes.size();
+        }
+        else if (name == "compose")
+        {
+            const KeyCode vowels[] = {
+                requireKeycode(display, XK_a), requireKeycode(display, XK_e), requireKeycode(display, XK_i),
+                requireKeycode(display, XK_o), requireKeycode(display, XK_u)
+            };
+            for (long i = 0; i + 1 < count; i += 2)
+            {
+                stream.keystrokes.push_back(deadAcuteKeycode);
+                stream.keystrokes.push_back(vowels[static_cast<std::size_t>(i / 2) % 5]);
+            }
+            // Both keys of a sequence are filtered out, the input method commits the composed character instead
+            stream.expectedKeyPresses = stream.keystrokes.size() / 2;
+        }
+        else if (name == "preedit")
+        {
+            const KeyCode space = requireKeycode(display, XK_space);
+            for (long i = 0; i < count; ++i)
+            {
+                // A "word" of 15 letters, then the commit
+                if (i % 16 == 15)
+                    stream.keystrokes.push_back(space);
+                else
+                    stream.keystrokes.push_back(requireKeycode(display, XK_a + static_cast<KeySym>(i % 26)));
+            }
+            // Exact only without an IME: an IME commits the words in its own way
+            stream.expectedKeyPresses = stream.keystrokes.size();
+        }
+        else
+        {
+            throw std::runtime_error("Unknown stream \"" + std::string(name) + "\"");
+        }
+
+        return stream;
+    }
+
+
+    // Maps a keycode without any keysyms to dead_acute. Returns the keycode.
+    KeyCode mapSpareKeycodeToDeadAcute(Display* const display) noexcept(false)
+    {
+        int minKeycode = 0;
+        int maxKeycode = 0;
+        XDisplayKeycodes(display, &minKeycode, &maxKeycode);
+
+        int keySymsPerKeycode = 0;
+        const XRAIIWrapper<KeySym*, XFreeDeleter> keySyms{
+            XGetKeyboardMapping(display, static_cast<KeyCode>(minKeycode), maxKeycode - minKeycode + 1, &keySymsPerKeycode)
+        };
+        if (keySyms == nullptr)
+            throw std::runtime_error("XGetKeyboardMapping failed");
+
+        for (int keycode = maxKeycode; keycode >= minKeycode; --keycode)
+        {
+            const KeySym* const syms = keySyms.getResource() + (keycode - minKeycode) * keySymsPerKeycode;
+
+            bool isSpare = true;
+            for (int i = 0; i < keySymsPerKeycode; ++i)
+                isSpare = isSpare && (syms[i] == NoSymbol);
+
+            if (isSpare)
+            {
+                KeySym deadAcute = XK_dead_acute;
+                XChangeKeyboardMapping(display, keycode, 1, &deadAcute, 1);
+                XSync(display, False);
+                return static_cast<KeyCode>(keycode);
+            }
+        }
+
+        throw std::runtime_error("There is no spare keycode to map dead_acute to");
+    }
+
+    void unmapKeycode(Display* const display, const KeyCode keycode)
+    {
+        KeySym noSymbol = NoSymbol;
+        XChangeKeyboardMapping(display, keycode, 1, &noSymbol, 1);
+        XSync(display, False);
+    }
+
+
+    struct WindowProcess
+    {
+        pid_t pid = -1;
+        int stderrFd = -1;
+    };
+
+    WindowProcess startWindowProcess(const Options& options) noexcept(false)
+    {
+        int pipeFds[2];
+        if (::pipe(pipeFds) != 0)
+            throw std::runtime_error("pipe failed");
+
+        ::setenv("X11KW_LOG_LEVEL", "info", 1);
+        ::setenv("X11KW_KEY_CONSUMER_THREADS", std::to_string(options.consumerThreads).c_str(), 1);
+
+        const pid_t pid = ::fork();
+        if (pid < 0)
+            throw std::runtime_error("fork failed");
+
+        if (pid == 0)
+        {
+            ::dup2(pipeFds[1], STDERR_FILENO);
+            ::close(pipeFds[0]);
+            ::close(pipeFds[1]);
+            ::execl(X11KW_KEYBOARD_WINDOW_PATH, X11KW_KEYBOARD_WINDOW_PATH, static_cast<char*>(nullptr));
+            ::_exit(127);
+        }
+
+        ::close(pipeFds[1]);
+        return { pid, pipeFds[0] };
+    }
+
+    // Waits for a new top-level window to be mapped. The root's SubstructureNotify must be already selected.
+    Window waitForMappedWindow(Display* const display, const std::chrono::milliseconds timeout) noexcept(false)
+    {
+        const auto deadline = Clock::now() + timeout;
+
+        while (Clock::now() < deadline)
+        {
+            while (XPending(display) > 0)
+            {
+                XEvent event;
+                XNextEvent(display, &event);
+                if ( (event.type == MapNotify) && (event.xmap.event == DefaultRootWindow(display)) )
+                    return event.xmap.window;
+            }
+
+            pollfd pfd{ ConnectionNumber(display), POLLIN, 0 };
+            ::poll(&pfd, 1, 50);
+        }
+
+        throw std::runtime_error("X11KeyboardWindow didn't map its window in time");
+    }
+
+    void sendWmDeleteWindow(Display* const display, const Window window)
+    {
+        XEvent event{};
+        event.xclient.type = ClientMessage;
+        event.xclient.window = window;
+        event.xclient.message_type = XInternAtom(display, "WM_PROTOCOLS", False);
+        event.xclient.format = 32;
+        event.xclient.data.l[0] = static_cast<long>(XInternAtom(display, "WM_DELETE_WINDOW", False));
+        event.xclient.data.l[1] = CurrentTime;
+
+        XSendEvent(display, window, False, NoEventMask, &event);
+        XFlush(display);
+    }
+
+    // Reads the whole stderr of the window process until it exits
+    std::string readUntilExit(const WindowProcess& process, const std::chrono::milliseconds timeout)
+    {
+        std::string output;
+        const auto deadline = Clock::now() + timeout;
+
+        char buffer[4096];
+        for (;;)
+        {
+            pollfd pfd{ process.stderrFd, POLLIN, 0 };
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+            if ( (remaining.count() <= 0) || (::poll(&pfd, 1, static_cast<int>(remaining.count())) <= 0) )
+            {
+                std::fprintf(stderr, "X11KeyboardWindow didn't exit in time, terminating it\n");
+                ::kill(process.pid, SIGTERM);
+                break;
+            }
+
+            const ssize_t bytesRead = ::read(process.stderrFd, buffer, sizeof(buffer));
+            if (bytesRead <= 0)
+                break;
+            output.append(buffer, static_cast<std::size_t>(bytesRead));
+        }
+
+        ::close(process.stderrFd);
+        int status = 0;
+        ::waitpid(process.pid, &status, 0);
+
+        return output;
+    }
+
+
+    // Returns the time the injection took, in seconds
+    double inject(Display* const display, const std::vector<KeyCode>& keystrokes, const long rate)
+    {
+        const auto interval = std::chrono::nanoseconds{ 1'000'000'000 / rate };
+        const auto start = Clock::now();
+        auto nextTime = start;
+
+        for (std::size_t i = 0; i < keystrokes.size(); ++i)
+        {
+            std::this_thread::sleep_until(nextTime);
+            nextTime += interval;
+
+            XTestFakeKeyEvent(display, keystrokes[i], True, CurrentTime);
+            XTestFakeKeyEvent(display, keystrokes[i], False, CurrentTime);
+            // Batches the requests a bit at high rates, but never delays them noticeably
+            if ( (i % 8 == 7) || (interval >= std::chrono::milliseconds{ 1 }) )
+                XFlush(display);
+        }
+        XSync(display, False);
+
+        const std::chrono::duration<double> elapsed = Clock::now() - start;
+        return elapsed.count();
+    }
+
+
+    struct WindowReport
+    {
+        std::size_t handledKeyPresses = 0;
+        std::vector<std::string_view> summaryLines;
+    };
+
+    // Every handled key press prints its keysym and/or its composed text (see the KeyPress handling of the window);
+    //   the pairing is exact if there is at most one consumer thread.
+    WindowReport parseWindowOutput(const std::string_view output)
+    {
+        WindowReport report;
+        bool isInLatencyReport = false;
+        bool previousWasKeySym = false;
+
+        std::string_view rest = output;
+        while (!rest.empty())
+        {
+            const auto newLine = rest.find('\n');
+            const std::string_view line = rest.substr(0, newLine);
+            rest = (newLine == std::string_view::npos) ? std::string_view{} : rest.substr(newLine + 1);
+
+            const bool isKeySym = (line.find("keySym: ") != std::string_view::npos);
+            const bool isComposedText = (line.find("composedText (UTF8): ") != std::string_view::npos);
+            if (isKeySym || (isComposedText && !previousWasKeySym))
+                ++report.handledKeyPresses;
+            previousWasKeySym = isKeySym;
+
+            if (line.find("Key event queue statistics") != std::string_view::npos)
+            {
+                report.summaryLines.push_back(line);
+                isInLatencyReport = false;
+            }
+            else if (line.find("Latency statistics") != std::string_view::npos)
+            {
+                isInLatencyReport = true;
+            }
+            else if (isInLatencyReport && (line.substr(0, 4) == "    "))
+            {
+                report.summaryLines.push_back(line);
+            }
+            else
+            {
+                isInLatencyReport = false;
+            }
+        }
+
+        return report;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        const Options options = parseOptions(argc, argv);
+
+        const XRAIIWrapper display{ XOpenDisplay(nullptr), [](auto& d) { if (d != nullptr) XCloseDisplay(d); } };
+        if (display == nullptr)
+            throw std::runtime_error("XOpenDisplay failed (is DISPLAY set?)");
+
+        int eventBase = 0, errorBase = 0, majorVersion = 0, minorVersion = 0;
+        if (!XTestQueryExtension(display, &eventBase, &errorBase, &majorVersion, &minorVersion))
+            throw std::runtime_error("The X server doesn't support XTest");
+
+        // The window must see the new mapping from its start, so it's changed before the window is started
+        const KeyCode deadAcuteKeycode = mapSpareKeycodeToDeadAcute(display);
+
+        std::vector<Stream> streams;
+        for (const auto& name : options.streams)
+            streams.push_back(makeStream(display, name, options.count, deadAcuteKeycode));
+
+        XSelectInput(display, DefaultRootWindow(display.getResource()), SubstructureNotifyMask);
+        XSync(display, False);
+
+        const WindowProcess process = startWindowProcess(options);
+        const Window window = waitForMappedWindow(display, std::chrono::seconds{ 10 });
+
+        // There's no window manager to give the focus to the window
+        XSetInputFocus(display, window, RevertToPointerRoot, CurrentTime);
+        XSync(display, False);
+
+        std::size_t totalKeystrokes = 0;
+        std::size_t expectedKeyPresses = 0;
+        double totalSeconds = 0;
+        for (std::size_t i = 0; i < streams.size(); ++i)
+        {
+            const double seconds = inject(display, streams[i].keystrokes, options.rate);
+            totalKeystrokes += streams[i].keystrokes.size();
+            expectedKeyPresses += streams[i].expectedKeyPresses;
+            totalSeconds += seconds;
+
+            std::printf("%-8s %8zu keystrokes injected in %.3f s (%.0f keystrokes/s)\n",
+                        options.streams[i].c_str(), streams[i].keystrokes.size(), seconds,
+                        static_cast<double>(streams[i].keystrokes.size()) / seconds);
+        }
+
+        // The server delivers the message after all the injected events
+        sendWmDeleteWindow(display, window);
+        const std::string output = readUntilExit(process, std::chrono::seconds{ 30 });
+
+        unmapKeycode(display, deadAcuteKeycode);
+
+        const WindowReport report = parseWindowOutput(output);
+        const std::size_t droppedKeyPresses =
+            (report.handledKeyPresses < expectedKeyPresses) ? (expectedKeyPresses - report.handledKeyPresses) : 0;
+
+        std::printf("\ntotal    %8zu keystrokes injected in %.3f s (%.0f keystrokes/s), "
+                    "%zu of %zu expected key presses handled, %zu dropped\n",
+                    totalKeystrokes, totalSeconds, static_cast<double>(totalKeystrokes) / totalSeconds,
+                    report.handledKeyPresses, expectedKeyPresses, droppedKeyPresses);
+
+        std::printf("\nX11KeyboardWindow statistics (stage, event type: count, p50, p90, p99, p99.9, max):\n");
+        for (const auto line : report.summaryLines)
+            std::printf("%.*s\n", static_cast<int>(line.size()), line.data());
+
+        return (droppedKeyPresses > 0) ? 2 : 0;
+    }
+    catch (const std::exception& err)
+    {
+        std::fprintf(stderr, "Error: %s\n", err.what());
+        return 1;
+    }
+}
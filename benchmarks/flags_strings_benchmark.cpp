@@ -0,0 +1,144 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Compares the precomputed flags strings (x11_flags_strings.h) against the former step-by-step concatenation.
+
+#include "benchmark_harness.h"
+#include "x11_flags_strings.h"
+#include <X11/Xlib.h>
+#include <string>       // std::string
+#include <cstdio>       // std::printf
+#include <cstdint>      // std::uint64_t
+
+
+namespace
+{
+    // The former implementation of XModifiersStateToString
+    std::string concatenateModifiersState(const decltype(XKeyEvent::state) state)
+    {
+        std::string result = "[";
+
+        if ( (state & Button1Mask) == Button1Mask )
+            result += result.length() < 2 ? "Button1" : ", Button1";
+        if ( (state & Button2Mask) == Button2Mask )
+            result += result.length() < 2 ? "Button2" : ", Button2";
+        if ( (state & Button3Mask) == Button3Mask )
+            result += result.length() < 2 ? "Button3" : ", Button3";
+        if ( (state & Button4Mask) == Button4Mask )
+            result += result.length() < 2 ? "Button4" : ", Button4";
+        if ( (state & Button5Mask) == Button5Mask )
+            result += result.length() < 2 ? "Button5" : ", Button5";
+        if ( (state & ShiftMask) == ShiftMask )
+            result += result.length() < 2 ? "Shift" : ", Shift";
+        if ( (state & LockMask) == LockMask )
+            result += result.length() < 2 ? "Lock" : ", Lock";
+        if ( (state & ControlMask) == ControlMask )
+            result += result.length() < 2 ? "Control" : ", Control";
+        if ( (state & Mod1Mask) == Mod1Mask )
+            result += result.length() < 2 ? "Mod1" : ", Mod1";
+        if ( (state & Mod2Mask) == Mod2Mask )
+            result += result.length() < 2 ? "Mod2" : ", Mod2";
+        if ( (state & Mod3Mask) == Mod3Mask )
+            result += result.length() < 2 ? "Mod3" : ", Mod3";
+        if ( (state & Mod4Mask) == Mod4Mask )
+            result += result.length() < 2 ? "Mod4" : ", Mod4";
+        if ( (state & Mod5Mask) == Mod5Mask )
+            result += result.length() < 2 ? "Mod5" : ", Mod5";
+
+        return result += ']';
+    }
+
+    // The former input style decoding of obtainSupportedInputStyles
+    std::string concatenateInputStyle(const XIMStyle style)
+    {
+        std::string buffer;
+
+        if ( (style & XIMPreeditArea) != 0 )
+            buffer += buffer.empty() ? "XIMPreeditArea" : " | XIMPreeditArea";
+        if ( (style & XIMPreeditCallbacks) != 0 )
+            buffer += buffer.empty() ? "XIMPreeditCallbacks" : " | XIMPreeditCallbacks";
+        if ( (style & XIMPreeditPosition) != 0 )
+            buffer += buffer.empty() ? "XIMPreeditPosition" : " | XIMPreeditPosition";
+        if ( (style & XIMPreeditNothing) != 0 )
+            buffer += buffer.empty() ? "XIMPreeditNothing" : " | XIMPreeditNothing";
+        if ( (style & XIMPreeditNone) != 0 )
+            buffer += buffer.empty() ? "XIMPreeditNone" : " | XIMPreeditNone";
+        if ( (style & XIMStatusArea) != 0 )
+            buffer += buffer.empty() ? "XIMStatusArea" : " | XIMStatusArea";
+        if ( (style & XIMStatusCallbacks) != 0 )
+            buffer += buffer.empty() ? "XIMStatusCallbacks" : " | XIMStatusCallbacks";
+        if ( (style & XIMStatusNothing) != 0 )
+            buffer += buffer.empty() ? "XIMStatusNothing" : " | XIMStatusNothing";
+        if ( (style & XIMStatusNone) != 0 )
+            buffer += buffer.empty() ? "XIMStatusNone" : " | XIMStatusNone";
+
+        return buffer;
+    }
+
+    // Typical states of the key events: nothing, Shift, NumLock (Mod2), Shift+NumLock, Control+Shift, ...
+    constexpr unsigned int typicalStates[] = {
+        0, ShiftMask, Mod2Mask, ShiftMask | Mod2Mask, ControlMask | ShiftMask, ControlMask | Mod2Mask,
+        Mod1Mask | Mod2Mask, Button1Mask | Mod2Mask
+    };
+    constexpr std::uint64_t typicalStatesCount = sizeof(typicalStates) / sizeof(typicalStates[0]);
+
+    constexpr XIMStyle typicalStyles[] = {
+        XIMPreeditNothing | XIMStatusNothing, XIMPreeditCallbacks | XIMStatusNothing,
+        XIMPreeditPosition | XIMStatusArea, XIMPreeditNone | XIMStatusNone
+    };
+    constexpr std::uint64_t typicalStylesCount = sizeof(typicalStyles) / sizeof(typicalStyles[0]);
+}
+
+
+int main()
+{
+    // Both implementations must agree on every combination
+    for (unsigned int state = 0; state < (1u << 13); ++state)
+    {
+        if (concatenateModifiersState(state) != XModifiersStateToString(state))
+        {
+            std::printf("MISMATCH for the modifiers state %u\n", state);
+            return 1;
+        }
+    }
+    for (XIMStyle style = 0; style < 0x1000; ++style)
+    {
+        if (concatenateInputStyle(style) != XIMStyleToString(style))
+        {
+            std::printf("MISMATCH for the input style %lu\n", style);
+            return 1;
+        }
+    }
+
+    bench::print(bench::run("modifiers state: concatenation", [](const std::uint64_t i) {
+        bench::doNotOptimize(concatenateModifiersState(typicalStates[i % typicalStatesCount]));
+    }));
+    bench::print(bench::run("modifiers state: precomputed table", [](const std::uint64_t i) {
+        bench::doNotOptimize(XModifiersStateToString(typicalStates[i % typicalStatesCount]));
+    }));
+    bench::print(bench::run("modifiers state (all 8192): concatenation", [](const std::uint64_t i) {
+        bench::doNotOptimize(concatenateModifiersState(static_cast<unsigned int>(i & 0x1FFF)));
+    }));
+    bench::print(bench::run("modifiers state (all 8192): precomputed table", [](const std::uint64_t i) {
+        bench::doNotOptimize(XModifiersStateToString(static_cast<unsigned int>(i & 0x1FFF)));
+    }));
+    bench::print(bench::run("input style: concatenation", [](const std::uint64_t i) {
+        bench::doNotOptimize(concatenateInputStyle(typicalStyles[i % typicalStylesCount]));
+    }));
+    bench::print(bench::run("input style: precomputed table", [](const std::uint64_t i) {
+        bench::doNotOptimize(XIMStyleToString(typicalStyles[i % typicalStylesCount]));
+    }));
+
+    return 0;
+}
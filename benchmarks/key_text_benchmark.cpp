@@ -0,0 +1,172 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Compares the direct keysym-to-UTF-8 translation (InputMethodText::obtainDirectly) against Xutf8LookupString.
+// The keysym table part runs anywhere; the lookups need an X server (e.g. xvfb-run) and are skipped without one.
+
+#include "benchmark_harness.h"
+#include "input_method_text.h"
+#include "keysym_text.h"
+#include "keymap_cache.h"
+#include "logging.h"
+#include <X11/Xlib.h>
+#include <X11/keysym.h> // XK_a, XK_Cyrillic_a, ...
+#include <clocale>      // std::setlocale
+#include <cstdio>       // std::printf
+#include <cstdint>      // std::uint64_t
+#include <iterator>     // std::size
+#include <string_view>  // std::string_view
+#include <vector>       // std::vector
+
+
+namespace
+{
+    const KeySym typicalKeySyms[] = {
+        XK_a, XK_e, XK_t, XK_space, XK_o, XK_n, XK_A, XK_1, XK_period, XK_Return,
+        XK_Cyrillic_a, XK_Cyrillic_o, XK_Greek_alpha, XK_EuroSign, XK_BackSpace, XK_KP_5,
+    };
+    constexpr std::size_t typicalKeySymsCount = std::size(typicalKeySyms);
+
+    void benchmarkKeySymTable()
+    {
+        bench::print(bench::run("keysym table: toCodepoint + encodeUtf8", [](const std::uint64_t i) {
+            char text[4];
+            const std::size_t length = x11kw::keysyms::encodeUtf8(x11kw::keysyms::toCodepoint(typicalKeySyms[i % typicalKeySymsCount]), text);
+            bench::doNotOptimize(text);
+            bench::doNotOptimize(length);
+        }));
+    }
+
+    // The key presses of the keysyms present in the keyboard mapping (without modifiers, or with Shift)
+    std::vector<XKeyEvent> makeKeyPresses(Display* const display, const Window window, const KeymapCache& keymapCache)
+    {
+        std::vector<XKeyEvent> events;
+        for (const KeySym keySym : typicalKeySyms)
+        {
+            const KeyCode keycode = XKeysymToKeycode(display, keySym);
+            if (keycode == 0)
+                continue;
+
+            XKeyEvent event{};
+            event.type = KeyPress;
+            event.display = display;
+            event.window = window;
+            event.root = DefaultRootWindow(display);
+            event.keycode = keycode;
+            event.state = (keymapCache.getKeySym(keycode, 0) == keySym) ? 0 : ShiftMask;
+            event.same_screen = True;
+            events.push_back(event);
+        }
+        return events;
+    }
+
+    // The X resources left behind on the early returns go away with the display
+    int benchmarkLookups(Display* const display)
+    {
+        const Window window = XCreateSimpleWindow(display, DefaultRootWindow(display), 0, 0, 100, 100, 0, 0, 0);
+
+        XIM inputMethod = XOpenIM(display, nullptr, nullptr, nullptr);
+        if (inputMethod == nullptr)
+        {
+            std::printf("XOpenIM failed, the lookups are skipped\n");
+            return 0;
+        }
+        XIC inputContext = XCreateIC(
+            inputMethod,
+            XNInputStyle, XIMPreeditNothing | XIMStatusNothing,
+            XNClientWindow, window,
+            XNFocusWindow, window,
+            nullptr
+        );
+        if (inputContext == nullptr)
+        {
+            std::printf("XCreateIC failed, the lookups are skipped\n");
+            return 0;
+        }
+
+        const KeymapCache keymapCache{ display };
+        std::vector<XKeyEvent> events = makeKeyPresses(display, window, keymapCache);
+        if (events.empty())
+        {
+            std::printf("None of the keysyms is in the keyboard mapping, the lookups are skipped\n");
+            return 0;
+        }
+
+        InputMethodText::LookupBuffer buffer;
+        InputMethodText::LookupBuffer directBuffer;
+
+        // Where the direct translation applies, it must give the same as Xutf8LookupString
+        std::size_t directCount = 0;
+        for (XKeyEvent& event : events)
+        {
+            const auto direct = InputMethodText::obtainDirectly(event, keymapCache, directBuffer);
+            if (!direct.has_value())
+                continue;
+            ++directCount;
+
+            const InputMethodText full = InputMethodText::obtainFrom(inputContext, event, buffer);
+            if ( (full.keySym != direct->keySym) || (full.composedTextUtf8 != direct->composedTextUtf8) )
+            {
+                std::printf("MISMATCH for the keycode %u, state %u: keysym 0x%lx vs 0x%lx\n",
+                            event.keycode, event.state, full.keySym.value_or(NoSymbol), direct->keySym.value_or(NoSymbol));
+                return 1;
+            }
+        }
+        std::printf("%zu of %zu key presses take the direct path\n", directCount, events.size());
+
+        bench::print(bench::run("lookup: Xutf8LookupString", [&](const std::uint64_t i) {
+            const InputMethodText text = InputMethodText::obtainFrom(inputContext, events[i % events.size()], buffer);
+            bench::doNotOptimize(text);
+        }));
+        bench::print(bench::run("lookup: keymap cache + keysym table", [&](const std::uint64_t i) {
+            const auto text = InputMethodText::obtainDirectly(events[i % events.size()], keymapCache, buffer);
+            bench::doNotOptimize(text);
+        }));
+        bench::print(bench::run("lookup: direct, falling back to Xutf8LookupString", [&](const std::uint64_t i) {
+            XKeyEvent& event = events[i % events.size()];
+            auto text = InputMethodText::obtainDirectly(event, keymapCache, buffer);
+            if (!text.has_value())
+                text = InputMethodText::obtainFrom(inputContext, event, buffer);
+            bench::doNotOptimize(text);
+        }));
+
+        XDestroyIC(inputContext);
+        XCloseIM(inputMethod);
+        XDestroyWindow(display, window);
+        return 0;
+    }
+}
+
+
+int main()
+{
+    // MY_LOG_X11_CALL would log every lookup otherwise
+    x11kw::logging::runtimeMinLevel = x11kw::logging::Level::off;
+
+    benchmarkKeySymTable();
+
+    std::setlocale(LC_CTYPE, "");
+    XSetLocaleModifiers("");
+
+    Display* const display = XOpenDisplay(nullptr);
+    if (display == nullptr)
+    {
+        std::printf("No X display, the lookups are skipped\n");
+        return 0;
+    }
+
+    const int result = benchmarkLookups(display);
+    XCloseDisplay(display);
+    return result;
+}
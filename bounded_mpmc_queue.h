@@ -0,0 +1,119 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <atomic>       // std::atomic
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::intptr_t
+#include <memory>       // std::unique_ptr
+#include <type_traits>  // std::is_trivially_copyable_v
+
+
+// Bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's algorithm).
+// Neither tryPush nor tryPop ever blocks: they fail if the queue is full/empty respectively.
+template<typename T>
+class BoundedMpmcQueue
+{
+    static_assert( std::is_trivially_copyable_v<T> );
+
+public:
+    // capacity must be a power of 2
+    explicit BoundedMpmcQueue(const std::size_t capacity)
+        : mask_(capacity - 1)
+        , cells_(new Cell[capacity])
+    {
+        for (std::size_t i = 0; i < capacity; ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedMpmcQueue(const BoundedMpmcQueue&) = delete;
+    BoundedMpmcQueue& operator=(const BoundedMpmcQueue&) = delete;
+
+public:
+    bool tryPush(const T& value)
+    {
+        std::size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            const std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+            if (diff == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
+
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& value)
+    {
+        std::size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            const std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+
+            if (diff == 0)
+            {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+        }
+
+        value = cell->value;
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate when used concurrently
+    [[nodiscard]] std::size_t size() const
+    {
+        const std::size_t enqueued = enqueuePos_.load(std::memory_order_relaxed);
+        const std::size_t dequeued = dequeuePos_.load(std::memory_order_relaxed);
+        return (enqueued > dequeued) ? (enqueued - dequeued) : 0;
+    }
+
+    [[nodiscard]] std::size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+private:
+    const std::size_t mask_;
+    const std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<std::size_t> enqueuePos_{ 0 };
+    alignas(64) std::atomic<std::size_t> dequeuePos_{ 0 };
+};
@@ -0,0 +1,145 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "event_capture.h"
+#include <sys/stat.h>   // stat
+#include <cstring>      // std::memcpy
+#include <stdexcept>    // std::runtime_error
+
+
+namespace x11kw::tracing
+{
+    namespace
+    {
+        // Version 2: the skipped events are captured too. Version 3: the long texts are in the text file
+        constexpr RecordFileFormat captureFormat{ { 'X', '1', '1', 'K', 'W', 'C', 'A', 'P' }, 3, sizeof(CaptureRecord) };
+        constexpr RecordFileFormat captureTextFormat{ { 'X', '1', '1', 'K', 'W', 'C', 'T', 'X' }, 1, sizeof(CaptureTextChunk) };
+
+        void storeEvent(CaptureRecord& record, const XEvent& event)
+        {
+            std::memcpy(&record.event, &event, sizeof(event));
+            record.event.xany.display = nullptr;
+        }
+    }
+
+
+    std::string getCaptureTextFilePath(const std::string& captureFilePath)
+    {
+        return captureFilePath + ".text";
+    }
+
+
+    EventCaptureWriter::EventCaptureWriter(const std::string& filePath) noexcept(false)
+        : file_{ filePath, captureFormat }
+        , textFile_{ getCaptureTextFilePath(filePath), captureTextFormat }
+    {}
+
+    std::uint64_t EventCaptureWriter::append(const XEvent& event) noexcept(false)
+    {
+        CaptureRecord record{};
+        storeEvent(record, event);
+        record.repeatCount = 1;
+
+        file_.append(&record);
+        return file_.getRecordCount() - 1;
+    }
+
+    void EventCaptureWriter::markSkipped(const std::uint64_t index)
+    {
+        getRecord(index).flags |= CaptureRecord::Skipped;
+    }
+
+    void EventCaptureWriter::markFilteredOut(const std::uint64_t index)
+    {
+        getRecord(index).flags |= CaptureRecord::FilteredOut;
+    }
+
+    void EventCaptureWriter::replaceEvent(const std::uint64_t index, const XEvent& event)
+    {
+        storeEvent(getRecord(index), event);
+    }
+
+    void EventCaptureWriter::setLookupResult(const std::uint64_t index,
+                                             const std::optional<KeySym> keySym,
+                                             const std::optional<std::string_view> text,
+                                             const bool isRepeat,
+                                             const int repeatCount) noexcept(false)
+    {
+        CaptureRecord& record = getRecord(index);
+        record.flags |= CaptureRecord::LookedUp;
+        record.repeatCount = static_cast<std::uint16_t>(repeatCount);
+        if (isRepeat)
+            record.flags |= CaptureRecord::Repeat;
+
+        if (keySym.has_value())
+        {
+            record.flags |= CaptureRecord::HasKeySym;
+            record.keySym = *keySym;
+        }
+
+        if (text.has_value())
+        {
+            record.flags |= CaptureRecord::HasText;
+
+            record.textLength = static_cast<std::uint32_t>(text->size());
+
+            if (text->size() <= CaptureRecord::maxInlineTextBytes)
+            {
+                std::memcpy(record.inlineText, text->data(), text->size());
+                return;
+            }
+
+            record.flags |= CaptureRecord::TextInFile;
+            record.textChunkIndex = textFile_.getRecordCount();
+            for (std::size_t offset = 0; offset < text->size(); offset += sizeof(CaptureTextChunk))
+            {
+                CaptureTextChunk chunk{};
+                text->copy(chunk.bytes, sizeof(chunk.bytes), offset);
+                textFile_.append(&chunk);
+            }
+        }
+    }
+
+    CaptureRecord& EventCaptureWriter::getRecord(const std::uint64_t index)
+    {
+        return *static_cast<CaptureRecord*>(file_.getRecord(index));
+    }
+
+
+    EventCaptureReader::EventCaptureReader(const std::string& filePath) noexcept(false)
+        : file_{ filePath, captureFormat }
+    {
+        const std::string textFilePath = getCaptureTextFilePath(filePath);
+        if (struct stat textFileStat{}; ::stat(textFilePath.c_str(), &textFileStat) == 0)
+            textFile_.emplace(textFilePath, captureTextFormat);
+    }
+
+    std::optional<std::string_view> EventCaptureReader::getText(const CaptureRecord& record) const noexcept(false)
+    {
+        if ((record.flags & CaptureRecord::HasText) == 0)
+            return std::nullopt;
+        if ((record.flags & CaptureRecord::TextInFile) == 0)
+            return std::string_view{ record.inlineText, record.textLength };
+
+        const std::size_t chunkCount = (record.textLength + sizeof(CaptureTextChunk) - 1) / sizeof(CaptureTextChunk);
+        if ( !textFile_.has_value() || (record.textChunkIndex > textFile_->size())
+             || (textFile_->size() - record.textChunkIndex < chunkCount) )
+        {
+            throw std::runtime_error("The text file of the capture doesn't have the text of a key press");
+        }
+
+        const auto* const chunks = static_cast<const CaptureTextChunk*>(textFile_->getRecords());
+        return std::string_view{ chunks[record.textChunkIndex].bytes, record.textLength };
+    }
+}
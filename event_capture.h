@@ -0,0 +1,145 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "event_trace.h"
+#include <X11/Xlib.h>
+#include <cstdint>      // std::uint8_t, std::uint64_t
+#include <cstddef>      // std::size_t
+#include <optional>     // std::optional
+#include <string>       // std::string
+#include <string_view>  // std::string_view
+
+
+// Lossless capture of the received X11 events for replaying them without an X server (see tools/event_replay.cpp).
+// Unlike the trace, a record keeps the whole XEvent together with what the client side made of it:
+//   the XFilterEvent result and the outputs of the key press lookup. The records are of fixed size,
+//   so the file can be seeked by the record index. The texts longer than the inline part of the record go into
+//   the text file of the capture (<capture-file>.text), as consecutive chunks.
+// Every event XNextEvent returns is captured, also the ones the event loop skips (they are marked), so a replay
+//   sees exactly the stream the loop did.
+// The XEvent is stored as is, so a capture is readable only on the same architecture; the display pointer
+//   is zeroed (it would be dangling in a replay), the other pointers (e.g. the XI2 cookie data) are meaningless.
+namespace x11kw::tracing
+{
+    struct CaptureRecord
+    {
+        enum Flags : std::uint8_t
+        {
+            FilteredOut   = 1 << 0,
+            // The key event has been looked up; keySym and text are valid according to the next flags
+            LookedUp      = 1 << 1,
+            HasKeySym     = 1 << 2,
+            HasText       = 1 << 3,
+            // The text is in the text file, from the chunk textChunkIndex (it's longer than maxInlineTextBytes)
+            TextInFile    = 1 << 4,
+            // Received, but dropped by the event loop without being handled
+            Skipped       = 1 << 5,
+            // The key press is an autorepeat of the held key
+            Repeat        = 1 << 6
+        };
+
+        static constexpr std::size_t maxInlineTextBytes = 48;
+
+        XEvent event;
+        std::uint64_t keySym;
+        std::uint32_t textLength;   // UTF-8 bytes
+        // The number of the autorepeats collapsed into the key press (1 if none)
+        std::uint16_t repeatCount;
+        std::uint8_t flags;
+        std::uint8_t reserved[1];
+        union
+        {
+            char inlineText[maxInlineTextBytes];
+            std::uint64_t textChunkIndex;
+        };
+
+        [[nodiscard]] std::optional<KeySym> getKeySym() const
+        {
+            return (flags & HasKeySym) ? std::optional<KeySym>{ static_cast<KeySym>(keySym) } : std::nullopt;
+        }
+    };
+    static_assert( sizeof(CaptureRecord) == sizeof(XEvent) + 64 );
+
+    // A piece of the texts in the text file of a capture
+    struct CaptureTextChunk
+    {
+        char bytes[64];
+    };
+
+    std::string getCaptureTextFilePath(const std::string& captureFilePath);
+
+
+    class EventCaptureWriter
+    {
+    public:
+        // Opens (or creates) the capture file. The records of an existing capture are kept and appended to.
+        explicit EventCaptureWriter(const std::string& filePath) noexcept(false);
+
+    public:
+        // Appends the event exactly as XNextEvent returned it (the display is not kept).
+        // Returns the index of the record for the updates below, which can be made until flush().
+        std::uint64_t append(const XEvent& event) noexcept(false);
+
+        // The event loop dropped the event without handling it (e.g. coalesced it or collapsed the autorepeat)
+        void markSkipped(std::uint64_t index);
+        void markFilteredOut(std::uint64_t index);
+        // The event was turned into another one before the handling (the XI2 key events into the core ones)
+        void replaceEvent(std::uint64_t index, const XEvent& event);
+        // The results of the key event lookup, as the event loop passes them to the sink.
+        // The texts longer than CaptureRecord::maxInlineTextBytes are appended to the text file.
+        void setLookupResult(std::uint64_t index, std::optional<KeySym> keySym, std::optional<std::string_view> text,
+                             bool isRepeat = false, int repeatCount = 1) noexcept(false);
+
+        // The appended records become visible to readers of the file only after flush().
+        // The texts go first, so a visible record never refers to the missing ones.
+        void flush()
+        {
+            textFile_.flush();
+            file_.flush();
+        }
+
+        [[nodiscard]] std::uint64_t getRecordCount() const { return file_.getRecordCount(); }
+
+    private:
+        CaptureRecord& getRecord(std::uint64_t index);
+
+    private:
+        RecordFileWriter file_;
+        RecordFileWriter textFile_;
+    };
+
+
+    class EventCaptureReader
+    {
+    public:
+        explicit EventCaptureReader(const std::string& filePath) noexcept(false);
+
+    public:
+        [[nodiscard]] const CaptureRecord* begin() const { return static_cast<const CaptureRecord*>(file_.getRecords()); }
+        [[nodiscard]] const CaptureRecord* end() const { return begin() + size(); }
+        [[nodiscard]] std::size_t size() const { return file_.size(); }
+
+        [[nodiscard]] const CaptureRecord& operator[](const std::size_t index) const { return begin()[index]; }
+
+        // The text of the key press, wherever it's stored. Throws if the text file doesn't have it
+        [[nodiscard]] std::optional<std::string_view> getText(const CaptureRecord& record) const noexcept(false);
+
+    private:
+        RecordFileReader file_;
+        // The captures without long texts may come without the text file
+        std::optional<RecordFileReader> textFile_;
+    };
+}
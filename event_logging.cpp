@@ -0,0 +1,451 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "event_logging.h"
+#include "logging.h"
+#include "atom_cache.h"
+#include "x11_flags_strings.h"
+#include <string>       // std::string
+#include <string_view>  // std::string_view
+#include <ostream>      // std::ostream
+#include <iomanip>      // std::setbase
+#include <iterator>     // std::begin, std::end
+#include <type_traits>  // std::make_unsigned_t
+#include <cstdlib>      // std::getenv
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint64_t, std::uint8_t
+#include <atomic>       // std::atomic
+#include <chrono>       // std::chrono::steady_clock
+#include <charconv>     // std::from_chars
+#include <optional>     // std::optional
+#include <system_error> // std::errc
+
+
+namespace x11kw::logging
+{
+    void logX11Event(const XClientMessageEvent& event, AtomCache* atomCache);
+    void logX11Event(const XKeyEvent& event);
+    void logX11Event(const XButtonEvent& event);
+
+    namespace
+    {
+        // Logs the fields of the event (after its name)
+        using EventDetailsLogger = void(*)(const XEvent& event, AtomCache* atomCache);
+
+        // The types without a details logger are logged by their names only
+        constexpr auto eventLogTable = dispatch::EventTypeTable<EventDetailsLogger>{}
+            .on(ClientMessage, [](const XEvent& event, AtomCache* const atomCache) { logX11Event(event.xclient, atomCache); })
+            .on({ KeyPress, KeyRelease }, [](const XEvent& event, AtomCache*) { logX11Event(event.xkey); })
+            .on({ ButtonPress, ButtonRelease }, [](const XEvent& event, AtomCache*) { logX11Event(event.xbutton); });
+
+
+        struct LoggedEventTypes
+        {
+            dispatch::EventTypeMask types = dispatch::EventTypeMask::all();
+            bool shouldLogFiltered = false;
+        };
+
+        // X11KW_LOGGED_EVENTS: comma-separated event type names, "all", "unknown" (the extension events)
+        //   and "filtered" (the events filtered out by the input method, which aren't logged otherwise).
+        LoggedEventTypes readLoggedEventTypes()
+        {
+            LoggedEventTypes result;
+
+            const char* const envValue = std::getenv("X11KW_LOGGED_EVENTS");
+            if (envValue == nullptr)
+                return result;
+
+            result.types = {};
+            std::string_view remaining = envValue;
+            while (!remaining.empty())
+            {
+                const std::size_t commaPos = remaining.find(',');
+                const std::string_view name = remaining.substr(0, commaPos);
+                remaining = (commaPos == std::string_view::npos) ? std::string_view{} : remaining.substr(commaPos + 1);
+
+                if (name == "all")
+                    result.types = dispatch::EventTypeMask::all();
+                else if (name == "filtered")
+                    result.shouldLogFiltered = true;
+                else if (name == "unknown")
+                    result.types.set(0);
+                else
+                {
+                    for (int type = KeyPress; type < LASTEvent; ++type)
+                    {
+                        if (dispatch::eventTypeNames[type] == name)
+                            result.types.set(type);
+                    }
+                }
+            }
+
+            return result;
+        }
+    }
+
+    const LoggedEventTypes loggedEventTypes = readLoggedEventTypes();
+
+    dispatch::EventTypeMask loggedX11EventTypes = loggedEventTypes.types;
+    bool shouldLogFilteredX11Events = loggedEventTypes.shouldLogFiltered;
+
+
+    namespace
+    {
+        struct SamplingRule
+        {
+            enum class Kind : std::uint8_t
+            {
+                All,
+                OneInN,
+                // The generic cell rate algorithm: the same as a token bucket of burstSize tokens, but with
+                //   a single atomic (the theoretical arrival time of the next record)
+                RateLimit
+            };
+
+            Kind kind = Kind::All;
+            std::uint64_t oneInN = 1;
+            std::uint64_t emissionIntervalNs = 0;
+            std::uint64_t burstToleranceNs = 0;
+        };
+
+        struct alignas(64) SamplingState
+        {
+            SamplingRule rule;
+            std::atomic<std::uint64_t> seenCount{ 0 };
+            std::atomic<std::uint64_t> suppressedCount{ 0 };
+            std::atomic<std::uint64_t> theoreticalArrivalNs{ 0 };
+        };
+
+        // The event types (0 for the unknown ones), and then the autorepeat key presses
+        constexpr std::size_t autorepeatSamplingIndex = LASTEvent;
+        SamplingState samplingStates[LASTEvent + 1];
+
+        std::uint64_t nowNs()
+        {
+            return static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+            );
+        }
+
+        // "1/N" logs every N-th record, "N/s" at most N records per second (in bursts of up to N).
+        std::optional<SamplingRule> parseSamplingRule(const std::string_view text)
+        {
+            const std::size_t slashPos = text.find('/');
+            if (slashPos == std::string_view::npos)
+                return std::nullopt;
+
+            std::uint64_t number = 0;
+            const std::string_view numberText = text.substr(0, slashPos);
+            const std::string_view unitText = text.substr(slashPos + 1);
+
+            if (numberText == "1")
+            {
+                const auto [ptr, error] = std::from_chars(unitText.data(), unitText.data() + unitText.size(), number);
+                if ( (error != std::errc{}) || (ptr != unitText.data() + unitText.size()) || (number == 0) )
+                    return std::nullopt;
+
+                SamplingRule rule;
+                rule.kind = (number == 1) ? SamplingRule::Kind::All : SamplingRule::Kind::OneInN;
+                rule.oneInN = number;
+                return rule;
+            }
+
+            if (unitText == "s")
+            {
+                const auto [ptr, error] = std::from_chars(numberText.data(), numberText.data() + numberText.size(), number);
+                if ( (error != std::errc{}) || (ptr != numberText.data() + numberText.size()) || (number == 0) )
+                    return std::nullopt;
+
+                SamplingRule rule;
+                rule.kind = SamplingRule::Kind::RateLimit;
+                rule.emissionIntervalNs = 1'000'000'000 / number;
+                rule.burstToleranceNs = rule.emissionIntervalNs * (number - 1);
+                return rule;
+            }
+
+            return std::nullopt;
+        }
+
+        // X11KW_LOG_SAMPLING: comma-separated <type>=<rule> pairs, e.g. "MotionNotify=1/100,autorepeat=20/s".
+        // The type is an event type name, "unknown" (the extension events), "autorepeat" (the autorepeat key presses;
+        //   they follow the KeyPress rule otherwise) or "all". The later pairs override the earlier ones.
+        bool readLogSampling()
+        {
+            const char* const envValue = std::getenv("X11KW_LOG_SAMPLING");
+            if (envValue == nullptr)
+                return false;
+
+            bool isAnySampled = false;
+            std::string_view remaining = envValue;
+            while (!remaining.empty())
+            {
+                const std::size_t commaPos = remaining.find(',');
+                const std::string_view pair = remaining.substr(0, commaPos);
+                remaining = (commaPos == std::string_view::npos) ? std::string_view{} : remaining.substr(commaPos + 1);
+
+                const std::size_t equalsPos = pair.find('=');
+                const std::optional<SamplingRule> rule =
+                    (equalsPos == std::string_view::npos) ? std::nullopt : parseSamplingRule(pair.substr(equalsPos + 1));
+                if (!rule.has_value())
+                {
+                    MY_LOG_WARN("X11KW_LOG_SAMPLING: ignoring \"", pair, "\" (expected <type>=1/N or <type>=N/s)");
+                    continue;
+                }
+
+                const std::string_view name = pair.substr(0, equalsPos);
+                for (std::size_t index = 0; index <= autorepeatSamplingIndex; ++index)
+                {
+                    const bool matches = (name == "all")
+                        || ( (index == 0) && (name == "unknown") )
+                        || ( (index == autorepeatSamplingIndex) && (name == "autorepeat") )
+                        || ( (index >= KeyPress) && (index < autorepeatSamplingIndex) && (dispatch::eventTypeNames[index] == name) );
+                    if (matches)
+                        samplingStates[index].rule = *rule;
+                }
+
+                isAnySampled = isAnySampled || (rule->kind != SamplingRule::Kind::All);
+            }
+
+            return isAnySampled;
+        }
+    }
+
+    bool isX11EventLogSamplingEnabled = readLogSampling();
+
+
+    bool detail::admitX11EventLogRecord(const int type, const bool isAutorepeat)
+    {
+        const std::size_t typeIndex = dispatch::getEventTypeIndex(type);
+        const bool hasAutorepeatRule = samplingStates[autorepeatSamplingIndex].rule.kind != SamplingRule::Kind::All;
+        SamplingState& state = samplingStates[(isAutorepeat && hasAutorepeatRule) ? autorepeatSamplingIndex : typeIndex];
+
+        switch (state.rule.kind)
+        {
+            case SamplingRule::Kind::All:
+                return true;
+            case SamplingRule::Kind::OneInN:
+            {
+                if (state.seenCount.fetch_add(1, std::memory_order_relaxed) % state.rule.oneInN == 0)
+                    return true;
+                break;
+            }
+            case SamplingRule::Kind::RateLimit:
+            {
+                const std::uint64_t now = nowNs();
+                std::uint64_t arrival = state.theoreticalArrivalNs.load(std::memory_order_relaxed);
+                for (;;)
+                {
+                    const std::uint64_t scheduled = (arrival > now) ? arrival : now;
+                    // Too far ahead of the schedule: the burst has been used up
+                    if (scheduled - now > state.rule.burstToleranceNs)
+                        break;
+                    if (state.theoreticalArrivalNs.compare_exchange_weak(
+                            arrival, scheduled + state.rule.emissionIntervalNs, std::memory_order_relaxed))
+                    {
+                        return true;
+                    }
+                }
+                break;
+            }
+        }
+
+        state.suppressedCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void reportSuppressedX11EventLogRecords()
+    {
+        if (!isEnabled(Level::info))
+            return;
+
+        bool isHeaderLogged = false;
+        for (std::size_t index = 0; index <= autorepeatSamplingIndex; ++index)
+        {
+            const std::uint64_t suppressedCount = samplingStates[index].suppressedCount.exchange(0, std::memory_order_relaxed);
+            if (suppressedCount == 0)
+                continue;
+
+            if (!isHeaderLogged)
+            {
+                myLogImpl("Event log records suppressed by the sampling (X11KW_LOG_SAMPLING) since the previous report:", '\n');
+                isHeaderLogged = true;
+            }
+
+            const std::string_view name = (index == autorepeatSamplingIndex) ? std::string_view{ "autorepeat KeyPress" }
+                                        : (index == 0)                        ? std::string_view{ "unknown" }
+                                                                              : dispatch::eventTypeNames[index];
+            myLogImpl("    ", name, ": ", suppressedCount, '\n');
+        }
+    }
+
+
+    void logX11Event(const XEvent& event, bool isFilteredOut, AtomCache* const atomCache)
+    {
+        const std::string_view prefix = isFilteredOut ? "Filtered " : "";
+
+        if (dispatch::getEventTypeIndex(event.type) == 0)
+        {
+            MY_LOG_DEBUG(prefix, "UNKOWN (", event.type, " ) EVENT");
+            return;
+        }
+
+        const auto& entry = eventLogTable[event.type];
+        MY_LOG_DEBUG(prefix, entry.name, " EVENT");
+        if (entry.handler != nullptr)
+            entry.handler(event, atomCache);
+    }
+
+    namespace
+    {
+        // The data of a ClientMessage, written into the log record directly (without building a string)
+        struct ClientMessageData
+        {
+            int format;
+            const decltype(XClientMessageEvent::data)& data;
+        };
+
+        template<typename IntsRange>
+        void joinInts(std::ostream& stream, const IntsRange& intsRange)
+        {
+            auto currentIter = std::begin(intsRange);
+            const auto endIter = std::end(intsRange);
+
+            if (currentIter == endIter) return;
+
+            constexpr std::string_view prefix = "0x";
+
+            auto first = *currentIter++;
+            using UnsignedType = std::make_unsigned_t<decltype(first)>;
+            using OutputType = unsigned long long;
+
+            stream << prefix << OutputType{ static_cast<UnsignedType>(first) };
+            while (currentIter != endIter)
+            {
+                stream << ", " << prefix << OutputType{ static_cast<UnsignedType>(*currentIter++) };
+            }
+        }
+
+        std::ostream& operator<<(std::ostream& stream, const ClientMessageData& value)
+        {
+            const std::ios_base::fmtflags initialFlags = stream.flags();
+            stream << std::setbase(16);
+
+            switch (value.format)
+            {
+                case 8:
+                    stream << '[';
+                    joinInts(stream, value.data.b);
+                    stream << ']';
+                    break;
+                case 16:
+                    stream << '[';
+                    joinInts(stream, value.data.s);
+                    stream << ']';
+                    break;
+                case 32:
+                    stream << '[';
+                    joinInts(stream, value.data.l);
+                    stream << ']';
+                    break;
+                default:
+                    stream << "<unknown format>";
+                    break;
+            }
+
+            stream.flags(initialFlags);
+            return stream;
+        }
+    }
+
+    void logX11Event(const XClientMessageEvent& event, AtomCache* const atomCache)
+    {
+        std::string_view msgTypeStr;
+        char* atomStr = nullptr;
+        // Replayed events (e.g. the decoded traces) have no connection to ask the atom name from
+        if ( (event.message_type != None) && (event.display != nullptr) )
+        {
+            if (atomCache != nullptr)
+                msgTypeStr = atomCache->getName(event.message_type);
+            else if (atomStr = XGetAtomName(event.display, event.message_type); atomStr != nullptr)
+                msgTypeStr = atomStr;
+        }
+
+        myLogImpl("event@", &event, ": \n",
+                             "                 type: ", event.type, " (ClientMessage)", "\n",
+                             "               serial: ", event.serial, "\n",
+                             "           send_event: ", event.send_event ? "true" : "false", "\n",
+                             "              display: ", event.display, "\n",
+                             "               window: ", event.window, "\n",
+                             "         message_type: ", event.message_type, " (\"", msgTypeStr, "\")", "\n",
+                             "               format: ", event.format, "\n",
+                             "                 data: ", ClientMessageData{ event.format, event.data },
+                             "\n"
+        );
+
+        if (atomStr != nullptr)
+            XFree(atomStr);
+    }
+
+    void logX11Event(const XKeyEvent& event)
+    {
+        const auto eventTypeStr = (event.type == KeyPress) ? "KeyPress"
+                                   : (event.type == KeyRelease) ? "KeyRelease"
+                                   : "<Unknown>";
+
+        myLogImpl("event@", &event, ": \n",
+                             "                 type: ", eventTypeStr, " (", event.type, ")", "\n",
+                             "               serial: ", event.serial, "\n",
+                             "           send_event: ", event.send_event ? "true" : "false", "\n",
+                             "              display: ", event.display, "\n",
+                             "               window: ", event.window, "\n",
+                             "                 root: ", event.root, "\n",
+                             "            subwindow: ", event.subwindow, "\n",
+                             "                 time: ", event.time, " ms.", "\n",
+                             "                    x: ", event.x, "\n",
+                             "                    y: ", event.y, "\n",
+                             "               x_root: ", event.x_root, "\n",
+                             "               y_root: ", event.y_root, "\n",
+                             "                state: ", event.state, " (", XModifiersStateToString(event.state), ")", "\n",
+                             "              keycode: ", event.keycode, "\n",
+                             "          same_screen: ", event.same_screen ? "true" : "false",
+                             "\n"
+        );
+    }
+
+    void logX11Event(const XButtonEvent& event)
+    {
+        const auto eventTypeStr = (event.type == ButtonPress) ? "ButtonPress"
+                                   : (event.type == ButtonRelease) ? "ButtonRelease"
+                                   : "<Unknown>";
+
+        myLogImpl("event@", &event, ": \n",
+                             "                 type: ", eventTypeStr, " (", event.type, ")", "\n",
+                             "               serial: ", event.serial, "\n",
+                             "           send_event: ", event.send_event ? "true" : "false", "\n",
+                             "              display: ", event.display, "\n",
+                             "               window: ", event.window, "\n",
+                             "                 root: ", event.root, "\n",
+                             "            subwindow: ", event.subwindow, "\n",
+                             "                 time: ", event.time, " ms.", "\n",
+                             "                    x: ", event.x, "\n",
+                             "                    y: ", event.y, "\n",
+                             "               x_root: ", event.x_root, "\n",
+                             "               y_root: ", event.y_root, "\n",
+                             "                state: ", event.state, " (", XModifiersStateToString(event.state), ")", "\n",
+                             "               button: ", event.button, "\n",
+                             "          same_screen: ", event.same_screen ? "true" : "false",
+                             "\n"
+        );
+    }
+}
@@ -0,0 +1,61 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "event_type_table.h"
+#include "logging.h"
+#include <X11/Xlib.h>
+
+
+class AtomCache;
+
+
+namespace x11kw::logging
+{
+    // The names of the atoms (e.g. of the ClientMessage types) are resolved via the cache, if there is one;
+    //   otherwise they are asked from the server of the event's display.
+    void logX11Event(const XEvent& event, bool isFilteredOut, AtomCache* atomCache = nullptr);
+
+    // The event types the event loops log (see isX11EventLogged), obtained from the X11KW_LOGGED_EVENTS
+    //   environment variable at startup. All the types except the filtered out events by default.
+    extern dispatch::EventTypeMask loggedX11EventTypes;
+    extern bool shouldLogFilteredX11Events;
+
+    // Per event type sampling of the logged events, obtained from the X11KW_LOG_SAMPLING environment variable
+    //   at startup. Off by default.
+    extern bool isX11EventLogSamplingEnabled;
+
+    namespace detail
+    {
+        // Whether the sampling lets the record through; counts the suppressed ones.
+        // It's a couple of relaxed atomic operations (and a clock read for the rate limits).
+        bool admitX11EventLogRecord(int type, bool isAutorepeat);
+    }
+
+    // The check to do before logX11Event: the events which aren't logged skip the formatting completely.
+    // The autorepeat key presses may be sampled separately from the rest of KeyPress'es.
+    inline bool isX11EventLogged(const int type, const bool isFilteredOut, const bool isAutorepeat = false)
+    {
+        return isEnabled(Level::debug)
+               && (!isFilteredOut || shouldLogFilteredX11Events)
+               && loggedX11EventTypes.test(type)
+               && (!isX11EventLogSamplingEnabled || detail::admitX11EventLogRecord(type, isAutorepeat));
+    }
+
+    // Logs (at the info level) the numbers of the event records the sampling has suppressed since the previous call,
+    //   per event type. Logs nothing if there were none.
+    void reportSuppressedX11EventLogRecords();
+}
+
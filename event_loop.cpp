@@ -0,0 +1,307 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "event_loop.h"
+#include <sys/epoll.h>      // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/eventfd.h>    // eventfd
+#include <sys/signalfd.h>   // signalfd, signalfd_siginfo
+#include <signal.h>         // sigset_t, sigemptyset, sigaddset
+#include <pthread.h>        // pthread_sigmask
+#include <unistd.h>         // close, read, write
+#include <cerrno>           // errno, EINTR
+#include <cstring>          // std::strerror
+#include <stdexcept>        // std::runtime_error
+#include <string>           // std::string
+#include <utility>          // std::move, std::swap
+#include <algorithm>        // std::max
+
+
+namespace
+{
+    [[noreturn]] void throwErrno(const std::string& what)
+    {
+        throw std::runtime_error(what + " failed: " + std::strerror(errno));
+    }
+}
+
+
+EventLoop::EventLoop() noexcept(false)
+    : timerWheel_(timerWheelSize)
+    , currentTickTime_(Clock::now())
+{
+    epollFd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0)
+        throwErrno("epoll_create1");
+
+    wakeupFd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeupFd_ < 0)
+    {
+        const int savedErrno = errno;
+        ::close(epollFd_);
+        errno = savedErrno;
+        throwErrno("eventfd");
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = wakeupFd_;
+    if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeupFd_, &event) != 0)
+    {
+        const int savedErrno = errno;
+        ::close(wakeupFd_);
+        ::close(epollFd_);
+        errno = savedErrno;
+        throwErrno("epoll_ctl(wakeup fd)");
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    for (const int signalFd : signalFds_)
+        ::close(signalFd);
+    ::close(wakeupFd_);
+    ::close(epollFd_);
+}
+
+
+void EventLoop::watchFd(const int fd, const std::uint32_t epollEvents, FdHandler handler, PrepareHook prepareHook) noexcept(false)
+{
+    epoll_event event{};
+    event.events = epollEvents;
+    event.data.fd = fd;
+    if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) != 0)
+        throwErrno("epoll_ctl(EPOLL_CTL_ADD, " + std::to_string(fd) + ")");
+
+    fdWatches_.insert_or_assign(fd, FdWatch{ std::move(handler), std::move(prepareHook) });
+}
+
+void EventLoop::unwatchFd(const int fd)
+{
+    if (fdWatches_.erase(fd) > 0)
+        ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+
+void EventLoop::watchSignal(const int signalNumber, Task handler) noexcept(false)
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, signalNumber);
+    if (const int error = ::pthread_sigmask(SIG_BLOCK, &signals, nullptr); error != 0)
+    {
+        errno = error;
+        throwErrno("pthread_sigmask");
+    }
+
+    const int signalFd = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd < 0)
+        throwErrno("signalfd(" + std::to_string(signalNumber) + ")");
+
+    try
+    {
+        watchFd(signalFd, EPOLLIN, [signalFd, handler = std::move(handler)](std::uint32_t /*epollEvents*/) {
+            signalfd_siginfo info;
+            while (::read(signalFd, &info, sizeof(info)) == static_cast<ssize_t>(sizeof(info)))
+                handler();
+        });
+    }
+    catch (...)
+    {
+        ::close(signalFd);
+        throw;
+    }
+
+    signalFds_.push_back(signalFd);
+}
+
+
+void EventLoop::post(Task task)
+{
+    {
+        std::lock_guard lock{ postedTasksMutex_ };
+        postedTasks_.push_back(std::move(task));
+    }
+    wakeUp();
+}
+
+void EventLoop::stop()
+{
+    stopRequested_.store(true, std::memory_order_release);
+    wakeUp();
+}
+
+void EventLoop::wakeUp()
+{
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const ssize_t written = ::write(wakeupFd_, &one, sizeof(one));
+}
+
+void EventLoop::runPostedTasks()
+{
+    std::uint64_t counter;
+    while (::read(wakeupFd_, &counter, sizeof(counter)) > 0) {}
+
+    std::vector<Task> tasks;
+    {
+        std::lock_guard lock{ postedTasksMutex_ };
+        std::swap(tasks, postedTasks_);
+    }
+
+    for (auto& task : tasks)
+        task();
+}
+
+
+EventLoop::TimerId EventLoop::addTimer(const std::chrono::milliseconds delay, Task task)
+{
+    // The wheel may lag behind the clock if no timers were pending for a while
+    if (timers_.empty())
+        currentTickTime_ = Clock::now();
+
+    const auto ticks = static_cast<std::size_t>( std::max<std::chrono::milliseconds::rep>(1, (delay + timerTick - std::chrono::milliseconds{1}) / timerTick) );
+
+    const TimerId timerId = nextTimerId_++;
+    timers_.emplace(timerId, Timer{ std::move(task), (ticks - 1) / timerWheelSize });
+    timerWheel_[(currentTimerSlot_ + ticks) % timerWheelSize].push_back(timerId);
+
+    return timerId;
+}
+
+void EventLoop::cancelTimer(const TimerId timerId)
+{
+    // The id stays in its wheel slot and is skipped when the slot is reached
+    timers_.erase(timerId);
+}
+
+int EventLoop::computeTimerTimeoutMs(const Clock::time_point now) const
+{
+    if (timers_.empty())
+        return -1;
+
+    std::size_t ticksToWait = timerWheelSize;
+    for (std::size_t i = 1; i <= timerWheelSize; ++i)
+    {
+        bool hasExpiringTimer = false;
+        for (const TimerId timerId : timerWheel_[(currentTimerSlot_ + i) % timerWheelSize])
+        {
+            if (const auto iter = timers_.find(timerId); (iter != timers_.end()) && (iter->second.remainingRounds == 0))
+            {
+                hasExpiringTimer = true;
+                break;
+            }
+        }
+
+        if (hasExpiringTimer)
+        {
+            ticksToWait = i;
+            break;
+        }
+    }
+
+    const auto deadline = currentTickTime_ + timerTick * ticksToWait;
+    if (deadline <= now)
+        return 0;
+
+    // Rounded up: waking up a bit later is fine, but too early means a useless iteration
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+    return static_cast<int>(remaining.count());
+}
+
+void EventLoop::advanceTimers(const Clock::time_point now)
+{
+    if (timers_.empty())
+    {
+        currentTickTime_ = now;
+        return;
+    }
+
+    std::vector<TimerId> slotTimers;
+    while ( (currentTickTime_ + timerTick <= now) && !timers_.empty() )
+    {
+        currentTickTime_ += timerTick;
+        currentTimerSlot_ = (currentTimerSlot_ + 1) % timerWheelSize;
+
+        // The fired tasks may add timers into this very slot, so the slot is processed as a copy
+        slotTimers.clear();
+        std::swap(slotTimers, timerWheel_[currentTimerSlot_]);
+
+        for (const TimerId timerId : slotTimers)
+        {
+            const auto iter = timers_.find(timerId);
+            if (iter == timers_.end())
+                continue;
+
+            if (iter->second.remainingRounds > 0)
+            {
+                --iter->second.remainingRounds;
+                timerWheel_[currentTimerSlot_].push_back(timerId);
+                continue;
+            }
+
+            Task task = std::move(iter->second.task);
+            timers_.erase(iter);
+            task();
+        }
+    }
+
+    if (timers_.empty())
+        currentTickTime_ = now;
+}
+
+
+void EventLoop::run() noexcept(false)
+{
+    constexpr int maxEvents = 32;
+    epoll_event events[maxEvents];
+
+    std::vector<int> preparedFds;
+
+    while (!stopRequested_.load(std::memory_order_acquire))
+    {
+        preparedFds.clear();
+        for (auto& [fd, watch] : fdWatches_)
+        {
+            if (watch.prepareHook && watch.prepareHook())
+                preparedFds.push_back(fd);
+        }
+
+        const int timeoutMs = preparedFds.empty() ? computeTimerTimeoutMs(Clock::now()) : 0;
+
+        const int readyCount = ::epoll_wait(epollFd_, events, maxEvents, timeoutMs);
+        if ( (readyCount < 0) && (errno != EINTR) )
+            throwErrno("epoll_wait");
+
+        for (const int fd : preparedFds)
+        {
+            if (const auto iter = fdWatches_.find(fd); iter != fdWatches_.end())
+                iter->second.handler(0);
+        }
+
+        for (int i = 0; i < readyCount; ++i)
+        {
+            const int fd = events[i].data.fd;
+            if (fd == wakeupFd_)
+            {
+                runPostedTasks();
+                continue;
+            }
+
+            // The handler could have been removed by one of the previous handlers
+            if (const auto iter = fdWatches_.find(fd); iter != fdWatches_.end())
+                iter->second.handler(events[i].events);
+        }
+
+        advanceTimers(Clock::now());
+    }
+}
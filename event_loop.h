@@ -0,0 +1,112 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <cstdint>          // std::uint32_t, std::uint64_t
+#include <cstddef>          // std::size_t
+#include <chrono>           // std::chrono::steady_clock, std::chrono::milliseconds
+#include <functional>       // std::function
+#include <vector>           // std::vector
+#include <unordered_map>    // std::unordered_map
+#include <mutex>            // std::mutex
+#include <atomic>           // std::atomic
+
+
+// epoll-based event loop: file descriptor readiness, tasks posted from other threads (woken via an eventfd)
+//   and timers (a hashed timing wheel with the 1 ms resolution).
+// All the methods except post() and stop() must be called from the thread running the loop.
+class EventLoop
+{
+public:
+    using Task = std::function<void()>;
+    // Receives the epoll events of the fd (0 if it's called because the prepare hook reported pending work)
+    using FdHandler = std::function<void(std::uint32_t epollEvents)>;
+    // Called before each wait; returns true if the source already has data to handle without waiting.
+    //   E.g. Xlib may have read the events into its own queue, so the socket won't become readable for them.
+    using PrepareHook = std::function<bool()>;
+    using TimerId = std::uint64_t;
+
+public:
+    EventLoop() noexcept(false);
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    ~EventLoop();
+
+public:
+    void watchFd(int fd, std::uint32_t epollEvents, FdHandler handler, PrepareHook prepareHook = {}) noexcept(false);
+    // Must not be called from the handler of the same fd.
+    void unwatchFd(int fd);
+
+    // Runs the handler on the loop thread whenever the signal arrives (it's received through a signalfd).
+    // The signal must be blocked in all the threads, so block it before starting any thread.
+    void watchSignal(int signalNumber, Task handler) noexcept(false);
+
+    // Runs the task on the loop thread. Thread-safe.
+    void post(Task task);
+
+    // Runs the task on the loop thread once after the delay.
+    TimerId addTimer(std::chrono::milliseconds delay, Task task);
+    void cancelTimer(TimerId timerId);
+
+    // Runs until stop() is called.
+    void run() noexcept(false);
+    // Thread-safe.
+    void stop();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::milliseconds timerTick{ 1 };
+    static constexpr std::size_t timerWheelSize = 512;
+
+    struct FdWatch
+    {
+        FdHandler handler;
+        PrepareHook prepareHook;
+    };
+
+    struct Timer
+    {
+        Task task;
+        std::size_t remainingRounds;
+    };
+
+private:
+    void wakeUp();
+    void runPostedTasks();
+
+    // Returns the epoll_wait timeout until the next timer expiration (-1 if there are no timers)
+    int computeTimerTimeoutMs(Clock::time_point now) const;
+    void advanceTimers(Clock::time_point now);
+
+private:
+    int epollFd_ = -1;
+    int wakeupFd_ = -1;
+    std::atomic<bool> stopRequested_{ false };
+
+    std::unordered_map<int, FdWatch> fdWatches_;
+    std::vector<int> signalFds_;
+
+    std::mutex postedTasksMutex_;
+    std::vector<Task> postedTasks_;
+
+    std::vector<std::vector<TimerId>> timerWheel_;
+    std::unordered_map<TimerId, Timer> timers_;
+    std::size_t currentTimerSlot_ = 0;
+    Clock::time_point currentTickTime_;
+    TimerId nextTimerId_ = 1;
+};
@@ -0,0 +1,307 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "event_trace.h"
+#include <sys/mman.h>   // mmap, munmap
+#include <sys/stat.h>   // fstat
+#include <fcntl.h>      // open
+#include <unistd.h>     // close, ftruncate
+#include <cerrno>       // errno
+#include <cstring>      // std::memcpy, std::memcmp, std::memset, std::strerror
+#include <stdexcept>    // std::runtime_error
+
+
+namespace x11kw::tracing
+{
+    namespace
+    {
+        constexpr RecordFileFormat traceFormat{ { 'X', '1', '1', 'K', 'W', 'T', 'R', 'C' }, 1, sizeof(TraceRecord) };
+
+        // The file grows by this number of records at once
+        constexpr std::size_t growthRecordCount = 16384;
+
+        [[noreturn]] void throwErrno(const std::string& what)
+        {
+            throw std::runtime_error(what + " failed: " + std::strerror(errno));
+        }
+
+        template<typename XEventT>
+        void fillPointerEventFields(TraceRecord& record, const XEventT& event)
+        {
+            record.time = event.time;
+            record.root = event.root;
+            record.subwindow = event.subwindow;
+            record.state = event.state;
+            record.x = static_cast<std::int16_t>(event.x);
+            record.y = static_cast<std::int16_t>(event.y);
+            record.xRoot = static_cast<std::int16_t>(event.x_root);
+            record.yRoot = static_cast<std::int16_t>(event.y_root);
+            if (event.same_screen)
+                record.flags |= TraceRecord::SameScreen;
+        }
+
+        template<typename XEventT>
+        void restorePointerEventFields(XEventT& event, const TraceRecord& record)
+        {
+            event.time = record.time;
+            event.root = record.root;
+            event.subwindow = record.subwindow;
+            event.state = record.state;
+            event.x = record.x;
+            event.y = record.y;
+            event.x_root = record.xRoot;
+            event.y_root = record.yRoot;
+            event.same_screen = (record.flags & TraceRecord::SameScreen) ? True : False;
+        }
+    }
+
+
+    TraceRecord makeTraceRecord(const XEvent& event, const bool isFilteredOut)
+    {
+        TraceRecord record{};
+
+        record.type = event.type;
+        record.serial = event.xany.serial;
+        record.window = event.xany.window;
+        if (isFilteredOut)
+            record.flags |= TraceRecord::FilteredOut;
+        if (event.xany.send_event)
+            record.flags |= TraceRecord::SendEvent;
+
+        switch (event.type)
+        {
+            case KeyPress:
+            case KeyRelease:
+                fillPointerEventFields(record, event.xkey);
+                record.detail = event.xkey.keycode;
+                break;
+            case ButtonPress:
+            case ButtonRelease:
+                fillPointerEventFields(record, event.xbutton);
+                record.detail = event.xbutton.button;
+                break;
+            case ClientMessage:
+                record.detail = static_cast<std::uint32_t>(event.xclient.message_type);
+                break;
+            default:
+                break;
+        }
+
+        return record;
+    }
+
+    XEvent restoreEvent(const TraceRecord& record)
+    {
+        XEvent event;
+        std::memset(&event, 0, sizeof(event));
+
+        event.type = record.type;
+        event.xany.serial = record.serial;
+        event.xany.window = record.window;
+        event.xany.send_event = (record.flags & TraceRecord::SendEvent) ? True : False;
+        event.xany.display = nullptr;
+
+        switch (record.type)
+        {
+            case KeyPress:
+            case KeyRelease:
+                restorePointerEventFields(event.xkey, record);
+                event.xkey.keycode = record.detail;
+                break;
+            case ButtonPress:
+            case ButtonRelease:
+                restorePointerEventFields(event.xbutton, record);
+                event.xbutton.button = record.detail;
+                break;
+            case ClientMessage:
+                event.xclient.message_type = record.detail;
+                break;
+            default:
+                break;
+        }
+
+        return event;
+    }
+
+
+    RecordFileWriter::RecordFileWriter(const std::string& filePath, const RecordFileFormat& format) noexcept(false)
+        : recordSize_(format.recordSize)
+    {
+        fd_ = ::open(filePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ < 0)
+            throwErrno("open(\"" + filePath + "\")");
+
+        try
+        {
+            struct stat fileStat{};
+            if (::fstat(fd_, &fileStat) != 0)
+                throwErrno("fstat");
+
+            const auto existingSize = static_cast<std::size_t>(fileStat.st_size);
+            if (existingSize == 0)
+            {
+                remap(sizeof(TraceFileHeader) + growthRecordCount * recordSize_);
+
+                std::memcpy(header_->magic, format.magic, sizeof(format.magic));
+                header_->version = format.version;
+                header_->recordSize = recordSize_;
+                header_->recordCount = 0;
+            }
+            else
+            {
+                if (existingSize < sizeof(TraceFileHeader))
+                    throw std::runtime_error("\"" + filePath + "\" is not a record file");
+
+                remap(existingSize);
+                if ( (std::memcmp(header_->magic, format.magic, sizeof(format.magic)) != 0)
+                     || (header_->version != format.version)
+                     || (header_->recordSize != recordSize_) )
+                {
+                    throw std::runtime_error("\"" + filePath + "\" is not a compatible record file");
+                }
+
+                // Drop the records which didn't make it into the file completely
+                const std::size_t recordsFitting = (existingSize - sizeof(TraceFileHeader)) / recordSize_;
+                if (header_->recordCount > recordsFitting)
+                    header_->recordCount = recordsFitting;
+                recordCount_ = header_->recordCount;
+            }
+        }
+        catch (...)
+        {
+            if (header_ != nullptr)
+                ::munmap(header_, mappedSize_);
+            ::close(fd_);
+            throw;
+        }
+    }
+
+    RecordFileWriter::~RecordFileWriter()
+    {
+        flush();
+
+        // Cut off the preallocated but unused tail
+        const std::size_t usedSize = sizeof(TraceFileHeader) + recordCount_ * recordSize_;
+
+        if (header_ != nullptr)
+            ::munmap(header_, mappedSize_);
+        [[maybe_unused]] const int truncateResult = ::ftruncate(fd_, static_cast<off_t>(usedSize));
+        ::close(fd_);
+    }
+
+    void RecordFileWriter::append(const void* const record) noexcept(false)
+    {
+        const std::size_t offset = sizeof(TraceFileHeader) + recordCount_ * recordSize_;
+        if (offset + recordSize_ > mappedSize_)
+            remap(mappedSize_ + growthRecordCount * recordSize_);
+
+        std::memcpy(reinterpret_cast<char*>(header_) + offset, record, recordSize_);
+
+        ++recordCount_;
+    }
+
+    void* RecordFileWriter::getRecord(const std::uint64_t index)
+    {
+        return reinterpret_cast<char*>(header_) + sizeof(TraceFileHeader) + index * recordSize_;
+    }
+
+    void RecordFileWriter::flush()
+    {
+        // The records are published only after they have been written completely
+        if (header_ != nullptr)
+            header_->recordCount = recordCount_;
+    }
+
+    void RecordFileWriter::remap(const std::size_t newFileSize) noexcept(false)
+    {
+        // The current mapping is replaced only once the new one exists: if growing fails (e.g. ENOSPC),
+        //   the writer stays as it was, with all the records appended so far
+        if (::ftruncate(fd_, static_cast<off_t>(newFileSize)) != 0)
+            throwErrno("ftruncate");
+
+        void* const mapping = ::mmap(nullptr, newFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (mapping == MAP_FAILED)
+            throwErrno("mmap");
+
+        if (header_ != nullptr)
+            ::munmap(header_, mappedSize_);
+
+        header_ = static_cast<TraceFileHeader*>(mapping);
+        mappedSize_ = newFileSize;
+    }
+
+
+    RecordFileReader::RecordFileReader(const std::string& filePath, const RecordFileFormat& format) noexcept(false)
+    {
+        const int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throwErrno("open(\"" + filePath + "\")");
+
+        struct stat fileStat{};
+        if (::fstat(fd, &fileStat) != 0)
+        {
+            const int savedErrno = errno;
+            ::close(fd);
+            errno = savedErrno;
+            throwErrno("fstat");
+        }
+
+        const auto fileSize = static_cast<std::size_t>(fileStat.st_size);
+        if (fileSize < sizeof(TraceFileHeader))
+        {
+            ::close(fd);
+            throw std::runtime_error("\"" + filePath + "\" is not a record file");
+        }
+
+        mapping_ = ::mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping_ == MAP_FAILED)
+            throwErrno("mmap");
+        mappedSize_ = fileSize;
+
+        const auto* const header = static_cast<const TraceFileHeader*>(mapping_);
+        if ( (std::memcmp(header->magic, format.magic, sizeof(format.magic)) != 0)
+             || (header->version != format.version)
+             || (header->recordSize != format.recordSize) )
+        {
+            ::munmap(mapping_, mappedSize_);
+            throw std::runtime_error("\"" + filePath + "\" is not a compatible record file");
+        }
+
+        const std::size_t recordsFitting = (fileSize - sizeof(TraceFileHeader)) / format.recordSize;
+        recordCount_ = (header->recordCount < recordsFitting) ? header->recordCount : recordsFitting;
+        records_ = static_cast<const char*>(mapping_) + sizeof(TraceFileHeader);
+    }
+
+    RecordFileReader::~RecordFileReader()
+    {
+        ::munmap(mapping_, mappedSize_);
+    }
+
+
+    EventTraceWriter::EventTraceWriter(const std::string& filePath) noexcept(false)
+        : file_{ filePath, traceFormat }
+    {}
+
+    void EventTraceWriter::append(const XEvent& event, const bool isFilteredOut) noexcept(false)
+    {
+        const TraceRecord record = makeTraceRecord(event, isFilteredOut);
+        file_.append(&record);
+    }
+
+
+    EventTraceReader::EventTraceReader(const std::string& filePath) noexcept(false)
+        : file_{ filePath, traceFormat }
+    {}
+}
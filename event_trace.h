@@ -0,0 +1,171 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>
+#include <cstdint>      // std::uint64_t, std::uint32_t, ...
+#include <cstddef>      // std::size_t
+#include <string>       // std::string
+
+
+// Compact binary trace of the received X11 events.
+// A trace file is the TraceFileHeader followed by the fixed-size TraceRecords;
+//   the file is memory-mapped and only ever appended to.
+namespace x11kw::tracing
+{
+    // The header of the record files (the traces and the captures)
+    struct TraceFileHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t recordSize;
+        // The number of complete records following the header
+        std::uint64_t recordCount;
+        std::uint8_t reserved[40];
+    };
+    static_assert( sizeof(TraceFileHeader) == 64 );
+
+    // What tells the record files of different kinds and versions apart
+    struct RecordFileFormat
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t recordSize;
+    };
+
+
+    // Memory-mapped file of fixed-size records
+    class RecordFileWriter
+    {
+    public:
+        // Opens (or creates) the file. The records of an existing file are kept and appended to.
+        RecordFileWriter(const std::string& filePath, const RecordFileFormat& format) noexcept(false);
+
+        RecordFileWriter(const RecordFileWriter&) = delete;
+        RecordFileWriter& operator=(const RecordFileWriter&) = delete;
+
+        ~RecordFileWriter();
+
+    public:
+        // Copies format.recordSize bytes from the record.
+        // The appended records become visible to readers of the file only after flush()
+        void append(const void* record) noexcept(false);
+        void flush();
+
+        // An appended record, for updating it in place. Valid until the next append()
+        [[nodiscard]] void* getRecord(std::uint64_t index);
+
+        [[nodiscard]] std::uint64_t getRecordCount() const { return recordCount_; }
+
+    private:
+        void remap(std::size_t newFileSize) noexcept(false);
+
+    private:
+        const std::size_t recordSize_;
+        int fd_ = -1;
+        std::size_t mappedSize_ = 0;
+        TraceFileHeader* header_ = nullptr;
+        std::uint64_t recordCount_ = 0;
+    };
+
+
+    class RecordFileReader
+    {
+    public:
+        RecordFileReader(const std::string& filePath, const RecordFileFormat& format) noexcept(false);
+
+        RecordFileReader(const RecordFileReader&) = delete;
+        RecordFileReader& operator=(const RecordFileReader&) = delete;
+
+        ~RecordFileReader();
+
+    public:
+        [[nodiscard]] const void* getRecords() const { return records_; }
+        [[nodiscard]] std::size_t size() const { return recordCount_; }
+
+    private:
+        void* mapping_ = nullptr;
+        std::size_t mappedSize_ = 0;
+        const void* records_ = nullptr;
+        std::size_t recordCount_ = 0;
+    };
+
+
+    struct TraceRecord
+    {
+        enum Flags : std::uint8_t
+        {
+            FilteredOut = 1 << 0,
+            SendEvent   = 1 << 1,
+            SameScreen  = 1 << 2
+        };
+
+        std::uint64_t serial;
+        std::uint64_t time;         // ms; only for key and button events
+        std::uint64_t window;
+        std::uint64_t root;
+        std::uint64_t subwindow;
+        std::int32_t type;
+        std::uint32_t state;
+        std::uint32_t detail;       // keycode, button or ClientMessage's message_type
+        std::int16_t x;
+        std::int16_t y;
+        std::int16_t xRoot;
+        std::int16_t yRoot;
+        std::uint8_t flags;
+        std::uint8_t reserved[3];
+    };
+    static_assert( sizeof(TraceRecord) == 64 );
+
+
+    TraceRecord makeTraceRecord(const XEvent& event, bool isFilteredOut);
+
+    // The inverse of makeTraceRecord (as far as the record allows).
+    // The resulting event has no display.
+    XEvent restoreEvent(const TraceRecord& record);
+
+
+    class EventTraceWriter
+    {
+    public:
+        // Opens (or creates) the trace file. The records of an existing trace are kept and appended to.
+        explicit EventTraceWriter(const std::string& filePath) noexcept(false);
+
+    public:
+        // The appended records become visible to readers of the file only after flush()
+        void append(const XEvent& event, bool isFilteredOut) noexcept(false);
+        void flush() { file_.flush(); }
+
+        [[nodiscard]] std::uint64_t getRecordCount() const { return file_.getRecordCount(); }
+
+    private:
+        RecordFileWriter file_;
+    };
+
+
+    class EventTraceReader
+    {
+    public:
+        explicit EventTraceReader(const std::string& filePath) noexcept(false);
+
+    public:
+        [[nodiscard]] const TraceRecord* begin() const { return static_cast<const TraceRecord*>(file_.getRecords()); }
+        [[nodiscard]] const TraceRecord* end() const { return begin() + size(); }
+        [[nodiscard]] std::size_t size() const { return file_.size(); }
+
+    private:
+        RecordFileReader file_;
+    };
+}
@@ -0,0 +1,123 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>
+#include <cstdint>      // std::uint64_t
+#include <initializer_list> // std::initializer_list
+#include <string_view>  // std::string_view
+
+
+// The per-event-type tables and sets: everything that depends on XEvent::type is looked up by the index
+//   instead of being switched over. Index 0 (never a real event type) stands for the unknown types,
+//   i.e. those >= LASTEvent (the extension events).
+namespace x11kw::dispatch
+{
+    inline constexpr std::string_view eventTypeNames[LASTEvent] = {
+        "<unknown>", "<unknown>", "KeyPress", "KeyRelease", "ButtonPress", "ButtonRelease", "MotionNotify",
+        "EnterNotify", "LeaveNotify", "FocusIn", "FocusOut", "KeymapNotify", "Expose", "GraphicsExpose", "NoExpose",
+        "VisibilityNotify", "CreateNotify", "DestroyNotify", "UnmapNotify", "MapNotify", "MapRequest",
+        "ReparentNotify", "ConfigureNotify", "ConfigureRequest", "GravityNotify", "ResizeRequest", "CirculateNotify",
+        "CirculateRequest", "PropertyNotify", "SelectionClear", "SelectionRequest", "SelectionNotify",
+        "ColormapNotify", "ClientMessage", "MappingNotify", "GenericEvent"
+    };
+    static_assert( KeyPress == 2 && GenericEvent == 35 && LASTEvent == 36 );
+
+    // The index of the type in the tables
+    constexpr int getEventTypeIndex(const int type) { return ( (type > 0) && (type < LASTEvent) ) ? type : 0; }
+
+
+    // A set of event types
+    class EventTypeMask
+    {
+        static_assert( LASTEvent <= 64 );
+
+    public:
+        constexpr EventTypeMask() = default;
+        constexpr EventTypeMask(const std::initializer_list<int> types)
+        {
+            for (const int type : types)
+                set(type);
+        }
+
+        static constexpr EventTypeMask all()
+        {
+            EventTypeMask result;
+            result.bits_ = (std::uint64_t{ 1 } << LASTEvent) - 1;
+            return result;
+        }
+
+    public:
+        constexpr EventTypeMask& set(const int type) { bits_ |= getBit(type); return *this; }
+        constexpr EventTypeMask& reset(const int type) { bits_ &= ~getBit(type); return *this; }
+
+        [[nodiscard]] constexpr bool test(const int type) const { return (bits_ & getBit(type)) != 0; }
+        [[nodiscard]] constexpr bool empty() const { return bits_ == 0; }
+
+    private:
+        static constexpr std::uint64_t getBit(const int type) { return std::uint64_t{ 1 } << getEventTypeIndex(type); }
+
+    private:
+        std::uint64_t bits_ = 0;
+    };
+
+
+    // Handler (e.g. a function pointer) and the name per event type, indexed by XEvent::type.
+    // It's meant to be built at compile time:
+    //   constexpr auto table = EventTypeTable<Handler>{}.on(KeyPress, &handleKey).on(KeyRelease, &handleKey);
+    template<typename Handler>
+    class EventTypeTable
+    {
+    public:
+        struct Entry
+        {
+            std::string_view name;
+            Handler handler{};
+        };
+
+    public:
+        constexpr EventTypeTable()
+        {
+            for (int type = 0; type < LASTEvent; ++type)
+                entries_[type].name = eventTypeNames[type];
+        }
+
+    public:
+        constexpr EventTypeTable on(const int type, const Handler handler) const
+        {
+            EventTypeTable result = *this;
+            result.entries_[getEventTypeIndex(type)].handler = handler;
+            result.handledTypes_.set(type);
+            return result;
+        }
+
+        constexpr EventTypeTable on(const std::initializer_list<int> types, const Handler handler) const
+        {
+            EventTypeTable result = *this;
+            for (const int type : types)
+                result = result.on(type, handler);
+            return result;
+        }
+
+        [[nodiscard]] constexpr const Entry& operator[](const int type) const { return entries_[getEventTypeIndex(type)]; }
+
+        // The types which have their own handlers
+        [[nodiscard]] constexpr EventTypeMask getHandledTypes() const { return handledTypes_; }
+
+    private:
+        Entry entries_[LASTEvent]{};
+        EventTypeMask handledTypes_;
+    };
+}
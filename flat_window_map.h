@@ -0,0 +1,153 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>
+#include <vector>       // std::vector
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint64_t
+#include <utility>      // std::move
+
+
+// Open-addressing (linear probing) hash map from a Window to V, stored in one flat array.
+// None is the marker of the empty slots, so it can't be a key. Erasing shifts the following entries back,
+//   so there are no tombstones and the lookups stay short.
+template<typename V>
+class FlatWindowMap
+{
+public:
+    explicit FlatWindowMap(const std::size_t initialCapacity = 16)
+    {
+        std::size_t capacity = 8;
+        while (capacity < initialCapacity)
+            capacity *= 2;
+        slots_.resize(capacity);
+    }
+
+public:
+    [[nodiscard]] std::size_t size() const { return size_; }
+    [[nodiscard]] bool empty() const { return size_ == 0; }
+
+    V* find(const Window key)
+    {
+        for (std::size_t index = getHomeIndex(key); ; index = (index + 1) & getMask())
+        {
+            Slot& slot = slots_[index];
+            if (slot.key == key)
+                return &slot.value;
+            if (slot.key == None)
+                return nullptr;
+        }
+    }
+
+    // Adds the entry or replaces the value of the existing one
+    V& insertOrAssign(const Window key, V value)
+    {
+        // The load factor is kept at 1/2 at most
+        if ( (size_ + 1) * 2 > slots_.size() )
+            rehash(slots_.size() * 2);
+
+        for (std::size_t index = getHomeIndex(key); ; index = (index + 1) & getMask())
+        {
+            Slot& slot = slots_[index];
+            if (slot.key == key)
+            {
+                slot.value = std::move(value);
+                return slot.value;
+            }
+            if (slot.key == None)
+            {
+                slot.key = key;
+                slot.value = std::move(value);
+                ++size_;
+                return slot.value;
+            }
+        }
+    }
+
+    bool erase(const Window key)
+    {
+        std::size_t index = getHomeIndex(key);
+        for (; slots_[index].key != key; index = (index + 1) & getMask())
+        {
+            if (slots_[index].key == None)
+                return false;
+        }
+
+        // Backward shift deletion: the entries of the probe sequence after the hole are moved into it
+        //   unless they're at their home position (or between the home and the hole) already
+        for (std::size_t next = (index + 1) & getMask(); slots_[next].key != None; next = (next + 1) & getMask())
+        {
+            const std::size_t home = getHomeIndex(slots_[next].key);
+            const bool canMove = (index <= next) ? ( (home <= index) || (home > next) )
+                                                 : ( (home <= index) && (home > next) );
+            if (canMove)
+            {
+                slots_[index] = std::move(slots_[next]);
+                index = next;
+            }
+        }
+
+        slots_[index].key = None;
+        slots_[index].value = V{};
+        --size_;
+        return true;
+    }
+
+    // Calls function(Window, V&) for every entry
+    template<typename Function>
+    void forEach(Function&& function)
+    {
+        for (Slot& slot : slots_)
+        {
+            if (slot.key != None)
+                function(slot.key, slot.value);
+        }
+    }
+
+private:
+    struct Slot
+    {
+        Window key = None;
+        V value{};
+    };
+
+private:
+    [[nodiscard]] std::size_t getMask() const { return slots_.size() - 1; }
+
+    // Fibonacci hashing: the XIDs of one client differ in the low bits only, the multiplication spreads them
+    [[nodiscard]] std::size_t getHomeIndex(const Window key) const
+    {
+        const std::uint64_t hash = static_cast<std::uint64_t>(key) * 0x9E3779B97F4A7C15ull;
+        return static_cast<std::size_t>(hash >> 32) & getMask();
+    }
+
+    void rehash(const std::size_t newCapacity)
+    {
+        std::vector<Slot> oldSlots(newCapacity);
+        oldSlots.swap(slots_);
+        size_ = 0;
+
+        for (Slot& slot : oldSlots)
+        {
+            if (slot.key != None)
+                insertOrAssign(slot.key, std::move(slot.value));
+        }
+    }
+
+private:
+    std::vector<Slot> slots_;
+    std::size_t size_ = 0;
+};
@@ -0,0 +1,118 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <vector>       // std::vector
+#include <cstddef>      // std::size_t
+#include <algorithm>    // std::copy, std::copy_backward, std::max
+#include <type_traits>  // std::is_trivially_copyable_v
+
+
+// A sequence with a movable gap at the editing position: a replacement costs O(distance from the previous edit
+//   + the size of the change), not O(size). Consecutive edits around the same place (which is what typing is)
+//   don't move much.
+template<typename T>
+class GapBuffer
+{
+    static_assert( std::is_trivially_copyable_v<T> );
+
+public:
+    [[nodiscard]] std::size_t size() const { return storage_.size() - getGapSize(); }
+    [[nodiscard]] bool empty() const { return size() == 0; }
+    [[nodiscard]] std::size_t capacity() const { return storage_.size(); }
+
+    const T& operator[](const std::size_t index) const
+    {
+        return (index < gapBegin_) ? storage_[index] : storage_[index + getGapSize()];
+    }
+    T& operator[](const std::size_t index)
+    {
+        return (index < gapBegin_) ? storage_[index] : storage_[index + getGapSize()];
+    }
+
+    void reserve(const std::size_t newCapacity)
+    {
+        if (newCapacity > capacity())
+            regrow(newCapacity);
+    }
+
+    // Replaces eraseCount items starting at position with insertCount items. position + eraseCount must be <= size().
+    void replace(const std::size_t position, const std::size_t eraseCount, const T* const items, const std::size_t insertCount)
+    {
+        moveGapTo(position);
+
+        // The erased items are right after the gap, so they just join it
+        gapEnd_ += eraseCount;
+
+        if (getGapSize() < insertCount)
+            regrow(std::max(capacity() * 2, size() + insertCount));
+
+        std::copy(items, items + insertCount, storage_.begin() + static_cast<std::ptrdiff_t>(gapBegin_));
+        gapBegin_ += insertCount;
+    }
+
+    // Keeps the capacity
+    void clear()
+    {
+        gapBegin_ = 0;
+        gapEnd_ = storage_.size();
+    }
+
+private:
+    [[nodiscard]] std::size_t getGapSize() const { return gapEnd_ - gapBegin_; }
+
+    void moveGapTo(const std::size_t position)
+    {
+        const auto begin = storage_.begin();
+
+        if (position < gapBegin_)
+        {
+            // [position, gapBegin_) moves to the end of the gap
+            std::copy_backward(begin + static_cast<std::ptrdiff_t>(position), begin + static_cast<std::ptrdiff_t>(gapBegin_),
+                               begin + static_cast<std::ptrdiff_t>(gapEnd_));
+            gapEnd_ -= gapBegin_ - position;
+            gapBegin_ = position;
+        }
+        else if (position > gapBegin_)
+        {
+            // [gapEnd_, gapEnd_ + distance) moves to the beginning of the gap
+            const std::size_t distance = position - gapBegin_;
+            std::copy(begin + static_cast<std::ptrdiff_t>(gapEnd_), begin + static_cast<std::ptrdiff_t>(gapEnd_ + distance),
+                      begin + static_cast<std::ptrdiff_t>(gapBegin_));
+            gapBegin_ = position;
+            gapEnd_ += distance;
+        }
+    }
+
+    void regrow(std::size_t newCapacity)
+    {
+        newCapacity = std::max<std::size_t>(newCapacity, 16);
+
+        std::vector<T> newStorage(newCapacity);
+        const std::size_t tailSize = storage_.size() - gapEnd_;
+
+        std::copy(storage_.begin(), storage_.begin() + static_cast<std::ptrdiff_t>(gapBegin_), newStorage.begin());
+        std::copy(storage_.end() - static_cast<std::ptrdiff_t>(tailSize), storage_.end(),
+                  newStorage.end() - static_cast<std::ptrdiff_t>(tailSize));
+
+        gapEnd_ = newCapacity - tailSize;
+        storage_.swap(newStorage);
+    }
+
+private:
+    std::vector<T> storage_;
+    std::size_t gapBegin_ = 0;
+    std::size_t gapEnd_ = 0;
+};
@@ -0,0 +1,123 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "input_method_text.h"
+#include "keysym_text.h"
+#include "logging.h"
+#include <X11/Xutil.h>  // XLookupString
+#include <stdexcept>    // std::runtime_error
+#include <string>       // std::to_string
+
+
+InputMethodText InputMethodText::obtainFrom(XIC imContext, XKeyPressedEvent& kpEvent, LookupBuffer& buffer)
+{
+    KeySym keySym;
+    Status status;
+
+    // https://opennet.ru/man.shtml?topic=XmbLookupString
+
+    int composedTextLengthBytes = MY_LOG_X11_CALL(Xutf8LookupString(
+        imContext,
+        &kpEvent,
+        buffer.data(),
+        buffer.capacity(),
+        &keySym,
+        &status
+    ));
+    if (status == XBufferOverflow)
+    {
+        // Keep room for twice as long texts, so a series of long commits (CJK paste, emoji sequences)
+        //   doesn't overflow every time
+        buffer.growTo(static_cast<std::size_t>(composedTextLengthBytes) * 2);
+        composedTextLengthBytes = MY_LOG_X11_CALL(Xutf8LookupString(
+            imContext,
+            &kpEvent,
+            buffer.data(),
+            buffer.capacity(),
+            &keySym,
+            &status
+        ));
+    }
+
+    const std::string_view composedText{ buffer.data(), static_cast<std::size_t>(composedTextLengthBytes) };
+
+    switch (status) {
+        case XLookupNone:
+            return { std::nullopt, std::nullopt };
+        case XLookupChars:
+            return { std::nullopt, composedText };
+        case XLookupKeySym:
+            return { keySym, std::nullopt };
+        case XLookupBoth:
+            return { keySym, composedText };
+        default:
+            throw std::runtime_error("Xutf8LookupString: unknown status: " + std::to_string(status));
+    }
+}
+
+std::optional<InputMethodText> InputMethodText::obtainDirectly(
+    const XKeyPressedEvent& kpEvent,
+    const KeymapCache& keymapCache,
+    LookupBuffer& buffer
+)
+{
+    // The input method delivers its commits (and Xlib its composed characters) as the key presses without a keycode;
+    //   only Xutf8LookupString knows their text
+    if (kpEvent.keycode == 0)
+        return std::nullopt;
+
+    // Control changes the text, and the rest of the modifiers may mean anything to the input method
+    const unsigned int plainModifiers = ShiftMask | LockMask | keymapCache.getNumLockMask();
+    if ( (kpEvent.state & ~plainModifiers) != 0 )
+        return std::nullopt;
+
+    const KeySym keySym = keymapCache.lookupKeySym(static_cast<KeyCode>(kpEvent.keycode), kpEvent.state);
+    if ( (keySym == NoSymbol) || x11kw::keysyms::isInputMethodKey(keySym) )
+        return std::nullopt;
+
+    const char32_t codepoint = x11kw::keysyms::toCodepoint(keySym);
+    if (codepoint == 0)
+        return std::nullopt;
+
+    // Room for the longest UTF-8 sequence
+    buffer.growTo(4);
+    const std::size_t textLength = x11kw::keysyms::encodeUtf8(codepoint, buffer.data());
+    return InputMethodText{ keySym, std::string_view{ buffer.data(), textLength } };
+}
+
+InputMethodText InputMethodText::obtainWithoutInputMethod(XKeyPressedEvent& kpEvent, LookupBuffer& buffer)
+{
+    KeySym keySym = NoSymbol;
+    const int textLength = MY_LOG_X11_CALL(XLookupString(&kpEvent, buffer.data(), buffer.capacity(), &keySym, nullptr));
+
+    std::optional<std::string_view> text;
+    if (textLength > 0)
+    {
+        text.emplace(buffer.data(), static_cast<std::size_t>(textLength));
+        // XLookupString's text is Latin-1, which is UTF-8 only as far as ASCII goes
+        for (const char ch : *text)
+        {
+            if (static_cast<unsigned char>(ch) >= 0x80)
+            {
+                text.reset();
+                break;
+            }
+        }
+    }
+
+    return {
+        (keySym == NoSymbol) ? std::nullopt : std::optional<KeySym>{ keySym },
+        text
+    };
+}
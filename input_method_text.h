@@ -0,0 +1,63 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "keymap_cache.h"
+#include <X11/Xlib.h>
+#include <optional>     // std::optional
+#include <string_view>  // std::string_view
+#include <vector>       // std::vector
+#include <cstddef>      // std::size_t
+
+
+// The result of looking the key press up: the keysym and the text it types (composed by the input method, if any).
+struct InputMethodText
+{
+    // Reusable storage for the composed text. Grows on demand and keeps its capacity,
+    //   so the steady-state lookups neither allocate nor hit XBufferOverflow.
+    class LookupBuffer
+    {
+    public:
+        explicit LookupBuffer(std::size_t initialCapacity = 128) : storage_(initialCapacity + 1, '\0') {}
+
+    public:
+        char* data() { return storage_.data(); }
+        // The number of bytes available for the text (excluding the trailing '\0')
+        [[nodiscard]] int capacity() const { return static_cast<int>(storage_.size() - 1); }
+
+        void growTo(const std::size_t newCapacity)
+        {
+            if (newCapacity + 1 > storage_.size())
+                storage_.resize(newCapacity + 1, '\0');
+        }
+
+    private:
+        std::vector<char> storage_;
+    };
+
+    std::optional<KeySym> keySym;
+    // Points into the LookupBuffer passed to obtainFrom; valid until the buffer is reused
+    std::optional<std::string_view> composedTextUtf8;
+
+    static InputMethodText obtainFrom(XIC imContext, XKeyPressedEvent& kpEvent, LookupBuffer& buffer);
+    // The fast path of obtainFrom for the plain key presses, while nothing is being composed (no preedit is active):
+    //   the keysym comes from the keymap cache and the text from keysyms::toCodepoint, without Xutf8LookupString.
+    // nullopt if the key press needs the full lookup: the input method's commits, the dead and compose keys,
+    //   the modifiers other than Shift, Lock and NumLock, the keysyms without a known character.
+    static std::optional<InputMethodText> obtainDirectly(const XKeyPressedEvent& kpEvent, const KeymapCache& keymapCache,
+                                                         LookupBuffer& buffer);
+    // The raw key input, while there is no input context: the keysym and the text without any composition
+    static InputMethodText obtainWithoutInputMethod(XKeyPressedEvent& kpEvent, LookupBuffer& buffer);
+};
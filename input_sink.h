@@ -0,0 +1,247 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "allocation_stats.h"
+#include "logging.h"
+#include <X11/Xlib.h>
+#include <cstdint>      // std::uint8_t, std::uint16_t
+#include <cstddef>      // std::size_t
+#include <cstring>      // std::memcpy
+#include <memory>       // std::unique_ptr
+#include <optional>     // std::optional
+#include <string_view>  // std::string_view
+#include <type_traits>  // std::enable_if_t, std::is_same_v, std::decay_t
+#include <utility>      // std::move
+#include <vector>       // std::vector
+
+
+// The delivery of the key and button input to its consumers.
+// The event loop collects the records of a drained event batch and hands them to the sink all at once,
+//   as spans, after the batch. A sink is any callable taking the const InputBatch&; the loop calls it through
+//   BatchSinkRef, so the delivery costs one indirect call per batch and none per record
+//   (see runKeyboardWindow in keyboard_window.h).
+namespace x11kw::input
+{
+    // A key press or release
+    struct KeyRecord
+    {
+        enum Flags : std::uint8_t
+        {
+            Press     = 1 << 0,
+            HasKeySym = 1 << 1,
+            HasText   = 1 << 2,
+            // An autorepeat of the held key
+            Repeat    = 1 << 3
+        };
+
+        Window window;
+        Time time;              // the server time, ms
+        KeySym keySym;
+        unsigned int state;
+        unsigned int keycode;
+        std::uint8_t flags;
+        // The number of the key presses (the collapsed autorepeats) the record stands for, each giving the same text
+        std::uint16_t repeatCount;
+        // The composed text (UTF-8). Valid only until the sink returns
+        std::string_view text;
+
+        [[nodiscard]] bool isPress() const { return (flags & Press) != 0; }
+    };
+
+    // A mouse button press or release
+    struct ButtonRecord
+    {
+        Window window;
+        Time time;              // the server time, ms
+        unsigned int state;
+        unsigned int button;
+        int x;
+        int y;
+        int xRoot;
+        int yRoot;
+        bool isPress;
+    };
+
+
+    // A read-only view of the contiguous records (std::span is C++20)
+    template<typename T>
+    class RecordSpan
+    {
+    public:
+        constexpr RecordSpan() = default;
+        constexpr RecordSpan(const T* const data, const std::size_t size) : data_(data), size_(size) {}
+
+    public:
+        [[nodiscard]] constexpr const T* begin() const { return data_; }
+        [[nodiscard]] constexpr const T* end() const { return data_ + size_; }
+        [[nodiscard]] constexpr const T* data() const { return data_; }
+        [[nodiscard]] constexpr std::size_t size() const { return size_; }
+        [[nodiscard]] constexpr bool empty() const { return size_ == 0; }
+        [[nodiscard]] constexpr const T& operator[](const std::size_t index) const { return data_[index]; }
+
+    private:
+        const T* data_ = nullptr;
+        std::size_t size_ = 0;
+    };
+
+    // The input of one event batch, in the order of the events
+    struct InputBatch
+    {
+        RecordSpan<KeyRecord> keys;
+        RecordSpan<ButtonRecord> buttons;
+
+        [[nodiscard]] bool empty() const { return keys.empty() && buttons.empty(); }
+    };
+
+
+    // Collects the records of a batch. In the steady state it doesn't allocate: the storage is reserved upfront
+    //   and the texts are copied into an arena, which is reset together with the records.
+    class InputBatchBuilder
+    {
+    public:
+        explicit InputBatchBuilder(const std::size_t maxRecordCount)
+        {
+            keys_.reserve(maxRecordCount);
+            buttons_.reserve(maxRecordCount);
+        }
+
+    public:
+        void addKey(const XKeyEvent& event, const std::optional<KeySym> keySym, const std::optional<std::string_view> textUtf8,
+                    const bool isRepeat = false, const int repeatCount = 1)
+        {
+            KeyRecord& record = keys_.emplace_back();
+            record.window = event.window;
+            record.time = event.time;
+            record.keySym = keySym.value_or(NoSymbol);
+            record.state = event.state;
+            record.keycode = event.keycode;
+            record.flags = (event.type == KeyPress) ? KeyRecord::Press : 0;
+            record.repeatCount = static_cast<std::uint16_t>( (repeatCount > 0xFFFF) ? 0xFFFF : repeatCount );
+
+            if (isRepeat)
+                record.flags |= KeyRecord::Repeat;
+            if (keySym.has_value())
+                record.flags |= KeyRecord::HasKeySym;
+            if (textUtf8.has_value())
+            {
+                record.flags |= KeyRecord::HasText;
+
+                char* const text = static_cast<char*>(textArena_.getResource()->allocate(textUtf8->size(), 1));
+                std::memcpy(text, textUtf8->data(), textUtf8->size());
+                record.text = { text, textUtf8->size() };
+            }
+        }
+
+        void addButton(const XButtonEvent& event)
+        {
+            buttons_.push_back({
+                event.window, event.time, event.state, event.button,
+                event.x, event.y, event.x_root, event.y_root,
+                event.type == ButtonPress
+            });
+        }
+
+        [[nodiscard]] InputBatch getBatch() const
+        {
+            return { { keys_.data(), keys_.size() }, { buttons_.data(), buttons_.size() } };
+        }
+
+        // Invalidates the batch obtained before
+        void clear()
+        {
+            keys_.clear();
+            buttons_.clear();
+            textArena_.reset();
+        }
+
+    private:
+        std::vector<KeyRecord> keys_;
+        std::vector<ButtonRecord> buttons_;
+        memory::EventArena<2048> textArena_;
+    };
+
+
+    // A non-owning reference to a sink. It's what the event loop gets instead of the sink's type:
+    //   the sink is called through a function pointer, where its call operator can be inlined.
+    class BatchSinkRef
+    {
+    public:
+        template<typename Sink, typename = std::enable_if_t< !std::is_same_v<std::decay_t<Sink>, BatchSinkRef> >>
+        BatchSinkRef(Sink& sink)
+            : sink_(&sink)
+            , consume_([](void* const erasedSink, const InputBatch& batch) { (*static_cast<Sink*>(erasedSink))(batch); })
+        {}
+
+    public:
+        void operator()(const InputBatch& batch) const { consume_(sink_, batch); }
+
+    private:
+        void* sink_;
+        void (*consume_)(void* sink, const InputBatch& batch);
+    };
+
+
+    // The interface of the consumers which aren't known at compile time (e.g. the plugins loaded at runtime).
+    // It costs a virtual call per batch (on top of the call of the sink), not per record.
+    class InputBatchConsumer
+    {
+    public:
+        virtual ~InputBatchConsumer() = default;
+
+    public:
+        virtual void consume(const InputBatch& batch) = 0;
+    };
+
+    // The sink handing every batch to the added consumers in turn
+    class ConsumerListSink
+    {
+    public:
+        void add(std::unique_ptr<InputBatchConsumer> consumer) { consumers_.push_back(std::move(consumer)); }
+
+        void operator()(const InputBatch& batch) const
+        {
+            for (const auto& consumer : consumers_)
+                consumer->consume(batch);
+        }
+
+    private:
+        std::vector<std::unique_ptr<InputBatchConsumer>> consumers_;
+    };
+
+
+    // The default sink: prints the key presses (at the info level)
+    struct LoggingInputSink
+    {
+        void operator()(const InputBatch& batch) const
+        {
+            if (!logging::isEnabled(logging::Level::info))
+                return;
+
+            for (const KeyRecord& key : batch.keys)
+            {
+                if (!key.isPress())
+                    continue;
+
+                if (key.flags & KeyRecord::HasKeySym)
+                    logging::myLogImpl("               keySym: ", key.keySym, "\n");
+                if (key.flags & KeyRecord::HasText)
+                    logging::myLogImpl("  composedText (UTF8): \"", key.text, "\"", "\n");
+                if (key.flags & KeyRecord::Repeat)
+                    logging::myLogImpl("               repeat: x", key.repeatCount, "\n");
+            }
+        }
+    };
+}
@@ -0,0 +1,320 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "input_surface_manager.h"
+#include "logging.h"
+#include <stdexcept>    // std::runtime_error
+#include <utility>      // std::move
+#include <exception>    // std::exception
+
+
+// Returns the maximum size of the preedit string
+static int preeditStartCallback(XIC ic, XPointer client_data, XPointer call_data);
+static void preeditDoneCallback(XIC ic, XPointer client_data, XPointer call_data);
+static void preeditDrawCallback(XIC ic, XPointer client_data, XIMPreeditDrawCallbackStruct *call_data);
+static void preeditCaretCallback(XIC ic, XPointer client_data, XIMPreeditCaretCallbackStruct *call_data);
+
+
+InputSurfaceManager::InputSurfaceManager(const char* const displayName) noexcept(false)
+    : display_{ MY_LOG_X11_CALL(XOpenDisplay(displayName)) }
+{
+    if (display_ == nullptr)
+        throw std::runtime_error("XOpenDisplay failed");
+}
+
+InputSurfaceManager::~InputSurfaceManager()
+{
+    focusedSurface_ = nullptr;
+
+    if (isWaitingForInputMethod_)
+    {
+        MY_LOG_X11_CALL(XUnregisterIMInstantiateCallback(
+            display_, nullptr, nullptr, nullptr, &inputMethodInstantiateCallback, reinterpret_cast<XPointer>(this)
+        ));
+    }
+
+    // The input contexts go before their windows, the input method and the connection
+    surfacesByWindow_.forEach([this](const Window window, std::unique_ptr<InputSurface>& surface) {
+        surface.reset();
+        MY_LOG_X11_CALL(XDestroyWindow(display_, window));
+    });
+}
+
+
+bool InputSurfaceManager::openInputMethod() noexcept(false)
+{
+    if (inputMethod_ != nullptr)
+        return true;
+
+    // Initialize input methods. The only one is shared by all the input contexts.
+    inputMethod_ = MY_LOG_X11_CALL(XOpenIM(display_, nullptr, nullptr, nullptr));
+    if (inputMethod_ == nullptr)
+        return false;
+
+    // Lets the server restart without leaving the dangling input contexts behind
+    inputMethodDestroyCallback_ = { reinterpret_cast<XPointer>(this), reinterpret_cast<XIMProc>(&inputMethodDestroyCallback) };
+    if (const char* const failedArg = MY_LOG_X11_CALL(XSetIMValues(
+            inputMethod_, XNDestroyCallback, &inputMethodDestroyCallback_, nullptr
+        )); failedArg != nullptr)
+    {
+        MY_LOG_WARN("XSetIMValues failed on \"", failedArg, '"');
+    }
+
+    if (isWaitingForInputMethod_)
+    {
+        MY_LOG_X11_CALL(XUnregisterIMInstantiateCallback(
+            display_, nullptr, nullptr, nullptr, &inputMethodInstantiateCallback, reinterpret_cast<XPointer>(this)
+        ));
+        isWaitingForInputMethod_ = false;
+    }
+
+    if (inputMethodReadyHandler_)
+        inputMethodReadyHandler_(inputMethod_);
+
+    // The keyboard focus may have come already
+    if (focusedSurface_ != nullptr)
+        obtainInputContext(*focusedSurface_);
+
+    return true;
+}
+
+void InputSurfaceManager::openInputMethodWhenAvailable() noexcept(false)
+{
+    if ( (inputMethod_ != nullptr) || isWaitingForInputMethod_ )
+        return;
+
+    if (!MY_LOG_X11_CALL(XRegisterIMInstantiateCallback(
+            display_, nullptr, nullptr, nullptr, &inputMethodInstantiateCallback, reinterpret_cast<XPointer>(this)
+        )))
+    {
+        throw std::runtime_error("XRegisterIMInstantiateCallback failed");
+    }
+
+    isWaitingForInputMethod_ = true;
+}
+
+void InputSurfaceManager::inputMethodInstantiateCallback(Display* const display, const XPointer clientData, const XPointer callData)
+{
+    (void)display; (void)callData;
+    MY_LOG_DEBUG(__func__, '(', static_cast<void*>(display), ", ", static_cast<void*>(clientData), ", ", static_cast<void*>(callData), ')');
+
+    // Called from inside Xlib, so nothing may be thrown through it
+    try
+    {
+        if (!reinterpret_cast<InputSurfaceManager*>(clientData)->openInputMethod())
+            MY_LOG_WARN("The input method server has appeared, but XOpenIM failed");
+    }
+    catch (const std::exception& err)
+    {
+        MY_LOG_ERROR("Failed to set up the input method: ", err.what());
+    }
+}
+
+void InputSurfaceManager::inputMethodDestroyCallback(XIM const inputMethod, const XPointer clientData, const XPointer callData)
+{
+    (void)inputMethod; (void)callData;
+    MY_LOG_DEBUG(__func__, '(', static_cast<void*>(inputMethod), ", ", static_cast<void*>(clientData), ", ", static_cast<void*>(callData), ')');
+
+    auto& manager = *reinterpret_cast<InputSurfaceManager*>(clientData);
+    manager.forgetInputMethod();
+
+    try
+    {
+        manager.openInputMethodWhenAvailable();
+    }
+    catch (const std::exception& err)
+    {
+        MY_LOG_ERROR("Failed to wait for the input method: ", err.what());
+    }
+}
+
+void InputSurfaceManager::forgetInputMethod()
+{
+    MY_LOG_WARN("The input method has been destroyed; falling back to the raw key input");
+
+    surfacesByWindow_.forEach([](Window, std::unique_ptr<InputSurface>& surface) {
+        surface->spotLocation.reset();
+        surface->inputContext.getResource() = nullptr;
+        // A composition the server died in the middle of won't be finished by it: its text is dropped
+        //   (and redrawn as cleared), and the key presses use the direct lookup again
+        surface->preedit.done();
+    });
+    inputMethod_.getResource() = nullptr;
+}
+
+
+Window InputSurfaceManager::createWindow(const int x, const int y, const unsigned width, const unsigned height) noexcept(false)
+{
+    const int screenIndex = MY_LOG_X11_CALL(DefaultScreen(display_.getResource()));
+
+    const Window window = MY_LOG_X11_CALL(XCreateSimpleWindow(
+        /* display      */ display_,
+        /* parent       */ DefaultRootWindow(display_.getResource()),
+        /* x            */ x,
+        /* y            */ y,
+        /* width        */ width,
+        /* height       */ height,
+        /* border_width */ 5,
+        /* border       */ BlackPixel(display_.getResource(), screenIndex),
+        /* background   */ WhitePixel(display_.getResource(), screenIndex)
+    ));
+
+    surfacesByWindow_.insertOrAssign(window, std::make_unique<InputSurface>(window));
+
+    return window;
+}
+
+bool InputSurfaceManager::destroyWindow(const Window window)
+{
+    std::unique_ptr<InputSurface>* const surface = surfacesByWindow_.find(window);
+    if (surface == nullptr)
+        return false;
+
+    if (surface->get() == focusedSurface_)
+        focusedSurface_ = nullptr;
+
+    surfacesByWindow_.erase(window);
+    MY_LOG_X11_CALL(XDestroyWindow(display_, window));
+
+    return true;
+}
+
+
+XIC InputSurfaceManager::obtainInputContext(InputSurface& surface) noexcept(false)
+{
+    if ( (surface.inputContext != nullptr) || (inputMethod_ == nullptr) )
+        return surface.inputContext;
+
+    // Setup preedit callbacks. They maintain the preedit model of the surface.
+    const auto preeditClientData = reinterpret_cast<XPointer>(&surface.preedit);
+    surface.preeditCallbacks[0] = { preeditClientData, reinterpret_cast<XIMProc>((void*)&preeditStartCallback) };
+    surface.preeditCallbacks[1] = { preeditClientData, reinterpret_cast<XIMProc>(&preeditDoneCallback) };
+    surface.preeditCallbacks[2] = { preeditClientData, reinterpret_cast<XIMProc>(&preeditDrawCallback) };
+    surface.preeditCallbacks[3] = { preeditClientData, reinterpret_cast<XIMProc>(&preeditCaretCallback) };
+
+    const XRAIIWrapper<XVaNestedList, XFreeDeleter> preeditAttributes{
+        MY_LOG_X11_CALL(XVaCreateNestedList(0,
+            XNPreeditStartCallback, &surface.preeditCallbacks[0],
+            XNPreeditDoneCallback, &surface.preeditCallbacks[1],
+            XNPreeditDrawCallback, &surface.preeditCallbacks[2],
+            XNPreeditCaretCallback, &surface.preeditCallbacks[3],
+            nullptr
+        ))
+    };
+    if (preeditAttributes == nullptr)
+        throw std::runtime_error("XVaCreateNestedList failed");
+
+    // Initialize input context.
+    // See
+    //   * https://www.x.org/releases/X11R7.6/doc/libX11/specs/libX11/libX11.html#Input_Context_Values;
+    //   * https://www.x.org/releases/X11R7.6/doc/libX11/specs/libX11/libX11.html#Query_Input_Style.
+    //   for the used flags.
+    XRAIIWrapper<XIC, XDestroyICDeleter> inputContext{
+        MY_LOG_X11_CALL(XCreateIC(
+            inputMethod_.getResource(),
+            XNInputStyle, XIMPreeditCallbacks | XIMStatusNothing,
+            XNPreeditAttributes, preeditAttributes.getResource(),
+            XNClientWindow, surface.window,
+            XNFocusWindow, surface.window,
+            nullptr
+        ))
+    };
+    if (inputContext == nullptr)
+        throw std::runtime_error("XCreateIC failed");
+
+    surface.spotLocation.emplace(inputContext.getResource());
+    surface.inputContext = std::move(inputContext);
+
+    // The focus may have come before the input context
+    if (surface.hasFocus)
+        MY_LOG_X11_CALL_VALUELESS(XSetICFocus(surface.inputContext));
+
+    MY_LOG_DEBUG("Created the input context of the window ", surface.window,
+                 " (", surfacesByWindow_.size(), " surface(s) in total)");
+
+    return surface.inputContext;
+}
+
+
+InputSurface* InputSurfaceManager::handleFocusEvent(const XFocusChangeEvent& event) noexcept(false)
+{
+    // The focus of the pointer's window (the focus is on PointerRoot) isn't the keyboard focus of the window itself
+    if (event.detail == NotifyPointer)
+        return nullptr;
+
+    InputSurface* const surface = findSurface(event.window);
+    if (surface == nullptr)
+        return nullptr;
+
+    if (event.type == FocusIn)
+    {
+        if (focusedSurface_ == surface)
+            return surface;
+
+        // The FocusOut of the previous window (if it's one of ours) usually comes first, but it's not guaranteed
+        if ( (focusedSurface_ != nullptr) && (focusedSurface_->inputContext != nullptr) )
+            MY_LOG_X11_CALL_VALUELESS(XUnsetICFocus(focusedSurface_->inputContext));
+        if (focusedSurface_ != nullptr)
+            focusedSurface_->hasFocus = false;
+
+        focusedSurface_ = surface;
+        surface->hasFocus = true;
+        if (surface->inputContext != nullptr)
+            MY_LOG_X11_CALL_VALUELESS(XSetICFocus(surface->inputContext));
+        else
+            obtainInputContext(*surface);   // Sets the focus of the new input context as well
+    }
+    else if (surface->hasFocus)
+    {
+        surface->hasFocus = false;
+        if (focusedSurface_ == surface)
+            focusedSurface_ = nullptr;
+        if (surface->inputContext != nullptr)
+            MY_LOG_X11_CALL_VALUELESS(XUnsetICFocus(surface->inputContext));
+    }
+
+    return surface;
+}
+
+
+// Returns the maximum size of the preedit string
+static int preeditStartCallback(XIC ic, XPointer client_data, XPointer call_data)
+{
+    (void)ic; (void)client_data; (void)call_data;
+    MY_LOG_DEBUG(__func__, '(', ic, ", ", static_cast<void*>(client_data), ", ", static_cast<void*>(call_data), ')');
+    return reinterpret_cast<PreeditBuffer*>(client_data)->start();
+}
+
+static void preeditDoneCallback(XIC ic, XPointer client_data, XPointer call_data)
+{
+    (void)ic; (void)client_data; (void)call_data;
+    MY_LOG_DEBUG(__func__, '(', ic, ", ", static_cast<void*>(client_data), ", ", static_cast<void*>(call_data), ')');
+    reinterpret_cast<PreeditBuffer*>(client_data)->done();
+}
+
+static void preeditDrawCallback(XIC ic, XPointer client_data, XIMPreeditDrawCallbackStruct* call_data)
+{
+    (void)ic; (void)client_data; (void)call_data;
+    MY_LOG_DEBUG(__func__, '(', ic, ", ", static_cast<void*>(client_data), ", ", static_cast<void*>(call_data), ')');
+    if (call_data != nullptr)
+        reinterpret_cast<PreeditBuffer*>(client_data)->draw(*call_data);
+}
+
+static void preeditCaretCallback(XIC ic, XPointer client_data, XIMPreeditCaretCallbackStruct* call_data)
+{
+    (void)ic; (void)client_data; (void)call_data;
+    MY_LOG_DEBUG(__func__, '(', ic, ", ", static_cast<void*>(client_data), ", ", static_cast<void*>(call_data), ')');
+    if (call_data != nullptr)
+        reinterpret_cast<PreeditBuffer*>(client_data)->moveCaret(*call_data);
+}
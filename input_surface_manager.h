@@ -0,0 +1,134 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "x_raii_wrapper.h"
+#include "flat_window_map.h"
+#include "preedit_buffer.h"
+#include "spot_location_updater.h"
+#include <X11/Xlib.h>
+#include <memory>       // std::unique_ptr
+#include <utility>      // std::move
+#include <optional>     // std::optional
+#include <cstddef>      // std::size_t
+#include <functional>   // std::function
+
+
+// An input surface: a window with its (lazily created) input context and the preedit state.
+struct InputSurface
+{
+    // The preedit text is limited to this number of characters. The preedit buffer is preallocated for it.
+    static constexpr int preeditMaxLength = 256;
+
+    explicit InputSurface(Window windowToServe) : window(windowToServe) {}
+
+    InputSurface(const InputSurface&) = delete;
+    InputSurface& operator=(const InputSurface&) = delete;
+
+    const Window window;
+    bool hasFocus = false;
+
+    PreeditBuffer preedit{ preeditMaxLength };
+    // The input context points to them (and they point to the preedit), so the surface never moves
+    XIMCallback preeditCallbacks[4]{};
+
+    XRAIIWrapper<XIC, XDestroyICDeleter> inputContext{ nullptr };
+    // The candidates window follows the clicks; exists together with the inputContext
+    std::optional<SpotLocationUpdater> spotLocation;
+};
+
+
+// Owns the X connection, the input method and all the input surfaces sharing them.
+// The input contexts are created on demand (the first FocusIn or key event of the window),
+//   so the surfaces which never get the keyboard focus cost no input method resources at all.
+// The input method is opened separately from the connection (see openInputMethod), so the windows can be shown
+//   before it's ready; until then the surfaces have no input contexts.
+class InputSurfaceManager
+{
+public:
+    using InputMethodReadyHandler = std::function<void(XIM)>;
+
+public:
+    // displayName is passed to XOpenDisplay as is (nullptr means the DISPLAY environment variable)
+    explicit InputSurfaceManager(const char* displayName = nullptr) noexcept(false);
+
+    InputSurfaceManager(const InputSurfaceManager&) = delete;
+    InputSurfaceManager& operator=(const InputSurfaceManager&) = delete;
+
+    ~InputSurfaceManager();
+
+public:
+    [[nodiscard]] Display* getDisplay() const { return display_; }
+    [[nodiscard]] XIM getInputMethod() const { return inputMethod_; }
+    [[nodiscard]] bool hasInputMethod() const { return inputMethod_ != nullptr; }
+
+    // Opens the input method right away. It blocks while the input method server is being connected,
+    //   which may take hundreds of milliseconds. Returns false if no input method is available.
+    bool openInputMethod() noexcept(false);
+
+    // Opens the input method as soon as its server appears (see XRegisterIMInstantiateCallback), and again
+    //   every time the server restarts. Xlib notices the server via XFilterEvent, so the events have to go through it.
+    void openInputMethodWhenAvailable() noexcept(false);
+
+    // Called each time the input method has been opened
+    void setInputMethodReadyHandler(InputMethodReadyHandler handler) { inputMethodReadyHandler_ = std::move(handler); }
+
+    // Creates a top-level window served by the manager. The window isn't mapped.
+    Window createWindow(int x, int y, unsigned width, unsigned height) noexcept(false);
+    // Destroys the input context of the window and the window itself. Returns false if the window isn't known.
+    bool destroyWindow(Window window);
+
+    // The dispatch of the events: nullptr if the window isn't one of the manager's
+    [[nodiscard]] InputSurface* findSurface(const Window window)
+    {
+        auto* const found = surfacesByWindow_.find(window);
+        return (found == nullptr) ? nullptr : found->get();
+    }
+
+    [[nodiscard]] std::size_t getSurfaceCount() const { return surfacesByWindow_.size(); }
+    [[nodiscard]] InputSurface* getFocusedSurface() const { return focusedSurface_; }
+
+    // Creates the input context of the surface if it hasn't been created yet.
+    // nullptr if the input method isn't open (yet).
+    XIC obtainInputContext(InputSurface& surface) noexcept(false);
+
+    // FocusIn/FocusOut: moves the input method focus to the input context of the focused window.
+    // Returns the surface the event is for (nullptr if none).
+    InputSurface* handleFocusEvent(const XFocusChangeEvent& event) noexcept(false);
+
+    // Calls function(InputSurface&) for every surface
+    template<typename Function>
+    void forEachSurface(Function&& function)
+    {
+        surfacesByWindow_.forEach([&function](Window, std::unique_ptr<InputSurface>& surface) { function(*surface); });
+    }
+
+private:
+    static void inputMethodInstantiateCallback(Display* display, XPointer clientData, XPointer callData);
+    static void inputMethodDestroyCallback(XIM inputMethod, XPointer clientData, XPointer callData);
+
+    // The server is gone, so are the input method and the input contexts: only the handles are released
+    void forgetInputMethod();
+
+private:
+    XRAIIWrapper<Display*, XCloseDisplayDeleter> display_;
+    XRAIIWrapper<XIM, XCloseIMDeleter> inputMethod_{ nullptr };
+    FlatWindowMap<std::unique_ptr<InputSurface>> surfacesByWindow_;
+    InputSurface* focusedSurface_ = nullptr;
+
+    InputMethodReadyHandler inputMethodReadyHandler_;
+    bool isWaitingForInputMethod_ = false;
+    XIMCallback inputMethodDestroyCallback_{};
+};
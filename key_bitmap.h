@@ -0,0 +1,100 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>
+#include <cstdint>          // std::uint64_t
+#include <initializer_list> // std::initializer_list
+
+
+// A set of keycodes as a 256-bit bitmap (the keycode k is the bit k % 64 of the word k / 64).
+// All the set operations are done on 4 64-bit words, which the compilers turn into a few SIMD instructions.
+class KeyBitmap
+{
+public:
+    static constexpr int wordCount = 4;
+
+public:
+    constexpr KeyBitmap() = default;
+
+    constexpr KeyBitmap(const std::initializer_list<KeyCode> keycodes)
+    {
+        for (const KeyCode keycode : keycodes)
+            words_[keycode / 64] |= std::uint64_t{ 1 } << (keycode % 64);
+    }
+
+    // From the XKeymapEvent::key_vector / XQueryKeymap's keys_return: the keycode k is the bit k % 8 of the byte k / 8.
+    // (It's a plain load of the words on the little-endian machines.)
+    static KeyBitmap fromKeyVector(const char (&keyVector)[32])
+    {
+        KeyBitmap result;
+        for (int i = 0; i < 32; ++i)
+            result.words_[i / 8] |= std::uint64_t{ static_cast<unsigned char>(keyVector[i]) } << (i % 8 * 8);
+        return result;
+    }
+
+public:
+    void set(const KeyCode keycode) { words_[keycode / 64] |= std::uint64_t{ 1 } << (keycode % 64); }
+    void reset(const KeyCode keycode) { words_[keycode / 64] &= ~(std::uint64_t{ 1 } << (keycode % 64)); }
+    void clear() { *this = KeyBitmap{}; }
+
+    [[nodiscard]] bool test(const KeyCode keycode) const
+    {
+        return ( words_[keycode / 64] >> (keycode % 64) ) & 1;
+    }
+
+    // Is any of the keys in the set
+    [[nodiscard]] bool intersects(const KeyBitmap& keys) const
+    {
+        std::uint64_t common = 0;
+        for (int i = 0; i < wordCount; ++i)
+            common |= words_[i] & keys.words_[i];
+        return common != 0;
+    }
+
+    // Are all the keys in the set
+    [[nodiscard]] bool contains(const KeyBitmap& keys) const
+    {
+        std::uint64_t missing = 0;
+        for (int i = 0; i < wordCount; ++i)
+            missing |= keys.words_[i] & ~words_[i];
+        return missing == 0;
+    }
+
+    [[nodiscard]] int count() const
+    {
+        int result = 0;
+        for (int i = 0; i < wordCount; ++i)
+            result += __builtin_popcountll(words_[i]);
+        return result;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return (words_[0] | words_[1] | words_[2] | words_[3]) == 0;
+    }
+
+    friend bool operator==(const KeyBitmap& lhs, const KeyBitmap& rhs)
+    {
+        std::uint64_t difference = 0;
+        for (int i = 0; i < wordCount; ++i)
+            difference |= lhs.words_[i] ^ rhs.words_[i];
+        return difference == 0;
+    }
+    friend bool operator!=(const KeyBitmap& lhs, const KeyBitmap& rhs) { return !(lhs == rhs); }
+
+private:
+    std::uint64_t words_[wordCount] = {};
+};
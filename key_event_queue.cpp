@@ -0,0 +1,234 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "key_event_queue.h"
+#include "logging.h"
+#include <cstring>      // std::memcpy
+#include <thread>       // std::this_thread
+#include <utility>      // std::move
+
+
+namespace
+{
+    void setText(DecodedKeyEvent& result, const std::string_view textUtf8)
+    {
+        result.flags |= DecodedKeyEvent::HasText;
+
+        std::size_t length = textUtf8.size();
+        if (length > DecodedKeyEvent::maxTextBytes)
+        {
+            result.flags |= DecodedKeyEvent::TextTruncated;
+            // Don't cut a UTF-8 sequence in the middle: step back over the continuation bytes
+            length = DecodedKeyEvent::maxTextBytes;
+            while ( (length > 0) && ((static_cast<unsigned char>(textUtf8[length]) & 0xC0) == 0x80) )
+                --length;
+        }
+
+        std::memcpy(result.textUtf8, textUtf8.data(), length);
+        result.textLength = static_cast<std::uint8_t>(length);
+    }
+}
+
+
+DecodedKeyEvent DecodedKeyEvent::make(
+    const XKeyEvent& event,
+    const std::optional<KeySym> keySym,
+    const std::optional<std::string_view> textUtf8,
+    const bool isRepeat,
+    const int repeatCount)
+{
+    DecodedKeyEvent result;
+    result.time = event.time;
+    result.keySym = keySym.value_or(NoSymbol);
+    result.state = event.state;
+    result.keycode = event.keycode;
+    result.flags = (event.type == KeyPress) ? Press : 0;
+    result.textLength = 0;
+    result.repeatCount = static_cast<std::uint16_t>( (repeatCount > 0xFFFF) ? 0xFFFF : repeatCount );
+
+    if (isRepeat)
+        result.flags |= Repeat;
+
+    if (keySym.has_value())
+        result.flags |= HasKeySym;
+
+    if (textUtf8.has_value())
+        setText(result, *textUtf8);
+
+    return result;
+}
+
+
+DecodedKeyEvent DecodedKeyEvent::make(const x11kw::input::KeyRecord& record)
+{
+    DecodedKeyEvent result;
+    result.time = record.time;
+    result.keySym = record.keySym;
+    result.state = record.state;
+    result.keycode = record.keycode;
+    result.flags = 0;
+    result.textLength = 0;
+    result.repeatCount = record.repeatCount;
+
+    if (record.flags & x11kw::input::KeyRecord::Press)
+        result.flags |= Press;
+    if (record.flags & x11kw::input::KeyRecord::HasKeySym)
+        result.flags |= HasKeySym;
+    if (record.flags & x11kw::input::KeyRecord::Repeat)
+        result.flags |= Repeat;
+    if (record.flags & x11kw::input::KeyRecord::HasText)
+        setText(result, record.text);
+
+    return result;
+}
+
+
+void logDecodedKeyEvent(const DecodedKeyEvent& event)
+{
+    if ( !(event.flags & DecodedKeyEvent::Press) || !x11kw::logging::isEnabled(x11kw::logging::Level::info) )
+        return;
+
+    if (event.flags & DecodedKeyEvent::HasKeySym)
+        x11kw::logging::myLogImpl("               keySym: ", event.keySym, "\n");
+    if (event.flags & DecodedKeyEvent::HasText)
+        x11kw::logging::myLogImpl("  composedText (UTF8): \"", event.getText(), "\"", "\n");
+    if (event.flags & DecodedKeyEvent::Repeat)
+        x11kw::logging::myLogImpl("               repeat: x", event.repeatCount, "\n");
+}
+
+
+KeyEventQueue::KeyEventQueue(const std::size_t capacity)
+    : queue_(capacity)
+{}
+
+
+bool KeyEventQueue::push(const DecodedKeyEvent& event)
+{
+    if (event.flags & DecodedKeyEvent::TextTruncated)
+        truncatedCount_.store(truncatedCount_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    if (!queue_.tryPush(event))
+    {
+        droppedCount_.store(droppedCount_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    pushedCount_.store(pushedCount_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (const std::size_t depth = queue_.size(); depth > maxDepth_.load(std::memory_order_relaxed))
+        maxDepth_.store(depth, std::memory_order_relaxed);
+
+    // Pairs with the fence in pop: either a consumer sees the event or we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepingConsumers_.load(std::memory_order_relaxed) > 0)
+    {
+        std::lock_guard lock{ consumersMutex_ };
+        consumersCV_.notify_one();
+    }
+
+    return true;
+}
+
+bool KeyEventQueue::pop(DecodedKeyEvent& event)
+{
+    constexpr int spinsBeforeSleeping = 64;
+
+    for (;;)
+    {
+        for (int i = 0; i < spinsBeforeSleeping; ++i)
+        {
+            if (queue_.tryPop(event))
+            {
+                poppedCount_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            if (isClosed_.load(std::memory_order_acquire))
+            {
+                // The last chance for the events pushed before close()
+                if (queue_.tryPop(event))
+                {
+                    poppedCount_.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                return false;
+            }
+            std::this_thread::yield();
+        }
+
+        std::unique_lock lock{ consumersMutex_ };
+        sleepingConsumers_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        consumersCV_.wait(lock, [this] {
+            return (queue_.size() > 0) || isClosed_.load(std::memory_order_acquire);
+        });
+        sleepingConsumers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void KeyEventQueue::close()
+{
+    isClosed_.store(true, std::memory_order_release);
+
+    std::lock_guard lock{ consumersMutex_ };
+    consumersCV_.notify_all();
+}
+
+
+KeyEventQueue::Statistics KeyEventQueue::getStatistics() const
+{
+    return {
+        pushedCount_.load(std::memory_order_relaxed),
+        droppedCount_.load(std::memory_order_relaxed),
+        truncatedCount_.load(std::memory_order_relaxed),
+        poppedCount_.load(std::memory_order_relaxed),
+        maxDepth_.load(std::memory_order_relaxed),
+        queue_.capacity()
+    };
+}
+
+
+KeyEventConsumerThreads::KeyEventConsumerThreads(KeyEventQueue& queue, const int threadsCount, Consumer consumer) noexcept(false)
+    : queue_(queue)
+    , consumer_(std::move(consumer))
+{
+    try
+    {
+        threads_.reserve(static_cast<std::size_t>(threadsCount));
+        for (int i = 0; i < threadsCount; ++i)
+        {
+            threads_.emplace_back([this] {
+                DecodedKeyEvent event;
+                while (queue_.pop(event))
+                    consumer_(event);
+            });
+        }
+    }
+    catch (...)
+    {
+        // The destructor isn't called for a partially constructed object, and the started threads are joinable
+        closeAndJoin();
+        throw;
+    }
+}
+
+KeyEventConsumerThreads::~KeyEventConsumerThreads()
+{
+    closeAndJoin();
+}
+
+void KeyEventConsumerThreads::closeAndJoin()
+{
+    queue_.close();
+    for (auto& thread : threads_)
+        thread.join();
+}
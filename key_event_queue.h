@@ -0,0 +1,155 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "bounded_mpmc_queue.h"
+#include "input_sink.h"
+#include <X11/Xlib.h>
+#include <cstdint>          // std::uint8_t, std::uint64_t
+#include <cstddef>          // std::size_t
+#include <optional>         // std::optional
+#include <string_view>      // std::string_view
+#include <atomic>           // std::atomic
+#include <mutex>            // std::mutex
+#include <condition_variable>   // std::condition_variable
+#include <functional>       // std::function
+#include <thread>           // std::thread
+#include <vector>           // std::vector
+
+
+// A key event decoded by the X I/O thread: everything the consumers need, without the Display or XIC.
+struct DecodedKeyEvent
+{
+    static constexpr std::size_t maxTextBytes = 100;
+
+    enum Flags : std::uint8_t
+    {
+        Press         = 1 << 0,
+        HasKeySym     = 1 << 1,
+        HasText       = 1 << 2,
+        // The composed text was longer than maxTextBytes and got cut
+        TextTruncated = 1 << 3,
+        // An autorepeat of the held key
+        Repeat        = 1 << 4
+    };
+
+    Time time;              // the server time, ms
+    KeySym keySym;
+    unsigned int state;
+    unsigned int keycode;
+    std::uint8_t flags;
+    std::uint8_t textLength;
+    // The number of the key presses (the collapsed autorepeats) the event stands for, each giving the same text
+    std::uint16_t repeatCount;
+    char textUtf8[maxTextBytes];
+
+    [[nodiscard]] std::string_view getText() const { return { textUtf8, textLength }; }
+
+    static DecodedKeyEvent make(const XKeyEvent& event, std::optional<KeySym> keySym, std::optional<std::string_view> textUtf8,
+                                bool isRepeat = false, int repeatCount = 1);
+    static DecodedKeyEvent make(const x11kw::input::KeyRecord& record);
+};
+static_assert( sizeof(DecodedKeyEvent) == 128 );
+
+
+// Hands the decoded key events over from the X I/O thread to the consumer threads.
+// The producer never blocks: if the consumers fall behind and the queue is full, the event is dropped and counted.
+class KeyEventQueue
+{
+public:
+    struct Statistics
+    {
+        std::uint64_t pushedCount;
+        std::uint64_t droppedCount;
+        std::uint64_t truncatedCount;
+        std::uint64_t poppedCount;
+        std::size_t maxDepth;
+        std::size_t capacity;
+    };
+
+public:
+    // capacity must be a power of 2
+    explicit KeyEventQueue(std::size_t capacity = 1024);
+
+public:
+    // Returns false if the event was dropped because the queue is full.
+    bool push(const DecodedKeyEvent& event);
+
+    // Blocks until there is an event or the queue is closed. Returns false if the queue is closed and empty.
+    bool pop(DecodedKeyEvent& event);
+
+    // Wakes up all the consumers; they drain the remaining events and stop.
+    void close();
+
+    [[nodiscard]] Statistics getStatistics() const;
+
+private:
+    BoundedMpmcQueue<DecodedKeyEvent> queue_;
+
+    std::atomic<bool> isClosed_{ false };
+    std::atomic<int> sleepingConsumers_{ 0 };
+    std::mutex consumersMutex_;
+    std::condition_variable consumersCV_;
+
+    // Written by the producer only
+    std::atomic<std::uint64_t> pushedCount_{ 0 };
+    std::atomic<std::uint64_t> droppedCount_{ 0 };
+    std::atomic<std::uint64_t> truncatedCount_{ 0 };
+    std::atomic<std::size_t> maxDepth_{ 0 };
+
+    std::atomic<std::uint64_t> poppedCount_{ 0 };
+};
+
+
+// The sink of the threaded mode: the key records of every batch are handed over to the consumer threads
+struct KeyEventQueueSink
+{
+    KeyEventQueue& queue;
+
+    void operator()(const x11kw::input::InputBatch& batch) const
+    {
+        for (const x11kw::input::KeyRecord& key : batch.keys)
+            queue.push(DecodedKeyEvent::make(key));
+    }
+};
+
+// The consumer of the threaded mode: prints the key event the way input::LoggingInputSink does (only the key presses)
+void logDecodedKeyEvent(const DecodedKeyEvent& event);
+
+
+// Runs the consumer function on its own threads for each popped event until the queue is closed.
+// The destructor closes the queue and joins the threads. If a thread can't be started, the constructor does so
+//   with the ones already started before rethrowing.
+class KeyEventConsumerThreads
+{
+public:
+    using Consumer = std::function<void(const DecodedKeyEvent&)>;
+
+public:
+    KeyEventConsumerThreads(KeyEventQueue& queue, int threadsCount, Consumer consumer) noexcept(false);
+
+    KeyEventConsumerThreads(const KeyEventConsumerThreads&) = delete;
+    KeyEventConsumerThreads& operator=(const KeyEventConsumerThreads&) = delete;
+
+    ~KeyEventConsumerThreads();
+
+private:
+    void closeAndJoin();
+
+private:
+    KeyEventQueue& queue_;
+    const Consumer consumer_;
+    std::vector<std::thread> threads_;
+};
@@ -0,0 +1,726 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "keyboard_window.h"
+#include "logging.h"
+#include "event_logging.h"
+#include "event_trace.h"
+#include "event_capture.h"
+#include "atom_cache.h"
+#include "x_raii_wrapper.h"
+#include "event_loop.h"
+#include "x11_flags_strings.h"
+#include "latency_stats.h"
+#include "keymap_cache.h"
+#include "key_bitmap.h"
+#include "input_surface_manager.h"
+#include "keystroke_publisher.h"
+#include "startup_batch.h"
+#include "allocation_stats.h"
+#include "input_method_text.h"
+#ifdef X11KW_WITH_XINPUT2
+    #include "xinput2_keyboard.h"
+#endif
+#include <sys/epoll.h>  // EPOLLIN
+#include <signal.h>     // SIGUSR1, sigset_t, sigemptyset, sigaddset
+#include <pthread.h>    // pthread_sigmask
+#include <unistd.h>     // getpid
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>  // Atom, XInternAtom
+#include <X11/XKBlib.h> // XkbSetDetectableAutoRepeat
+#include <optional>     // std::optional
+#include <memory>       // std::make_unique
+#include <string>       // std::string, std::pmr::string
+#include <string_view>  // std::string_view
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint32_t, std::uint64_t
+#include <chrono>       // std::chrono::milliseconds
+#include <clocale>      // std::setlocale
+#include <cstdlib>      // std::getenv, std::atoi
+#include <stdexcept>    // std::runtime_error
+#include <utility>      // std::move
+
+
+static XRAIIWrapper<XIMStyles*, XFreeDeleter> obtainSupportedInputStyles(XIM inputMethod) noexcept(false);
+
+// The upper bound of the events processed without looking at the socket again
+constexpr int maxEventBatchSize = 256;
+
+// Returns true if the event is made redundant by the next queued one, so it can be skipped.
+// E.g. only the last of the consecutive KeymapNotify's matters.
+static bool isSupersededByNextEvent(Display* display, const XEvent& event);
+
+// Is it the KeyRelease half of an autorepeat: the KeyPress of the same key with the same time is queued right after it.
+static bool isAutorepeatRelease(Display* display, const XEvent& event);
+
+// Removes (up to maxCount) autorepeats of the key press queued right after it: the KeyPress'es of the same key
+//   (the detectable autorepeat) or the KeyRelease/KeyPress pairs. Returns the number of the removed KeyPress'es.
+// The removed events are added to the capture (if any) as skipped.
+static int consumeQueuedAutorepeats(Display* display, const XKeyEvent& press, int maxCount,
+                                    x11kw::tracing::EventCaptureWriter* capture);
+
+// Keeps the set of the held keys up to date: incrementally from KeyPress/KeyRelease, fully from KeymapNotify.
+// So the key state (e.g. for chords and hotkeys) is known without XQueryKeymap round trips.
+static void updatePressedKeys(KeyBitmap& pressedKeys, const XEvent& event);
+
+// The time from XKeyEvent::time to the moment (in latency::now() terms), or nullopt if it doesn't look sane.
+// The server's timestamps are CLOCK_MONOTONIC milliseconds, so it's meaningful only for the servers on this machine.
+static std::optional<std::uint64_t> getNanosecondsSinceServerTime(Time serverTime, std::uint64_t moment);
+
+
+namespace x11kw
+{
+    KeyboardWindowOptions KeyboardWindowOptions::fromEnvironment() noexcept(false)
+    {
+        KeyboardWindowOptions options;
+
+        const char* const collapseAutorepeatEnv = std::getenv("X11KW_COLLAPSE_AUTOREPEAT");
+        options.shouldCollapseAutorepeat = (collapseAutorepeatEnv != nullptr) && (std::atoi(collapseAutorepeatEnv) != 0);
+
+        const char* const deferInputMethodEnv = std::getenv("X11KW_DEFER_IM");
+        options.shouldDeferInputMethod = (deferInputMethodEnv != nullptr) && (std::atoi(deferInputMethodEnv) != 0);
+
+        if (const char* const windowCountEnv = std::getenv("X11KW_WINDOW_COUNT"); windowCountEnv != nullptr)
+        {
+            options.windowCount = std::atoi(windowCountEnv);
+            if (options.windowCount < 1)
+                throw std::runtime_error("X11KW_WINDOW_COUNT must be positive");
+        }
+
+        if (const char* const xinput2Env = std::getenv("X11KW_XINPUT2"); xinput2Env != nullptr)
+            options.xinput2DeviceId = std::atoi(xinput2Env);
+
+        if (const char* const traceFilePath = std::getenv("X11KW_EVENT_TRACE"); traceFilePath != nullptr)
+            options.eventTracePath = traceFilePath;
+        if (const char* const captureFilePath = std::getenv("X11KW_EVENT_CAPTURE"); captureFilePath != nullptr)
+            options.eventCapturePath = captureFilePath;
+        if (const char* const keystrokeShmName = std::getenv("X11KW_KEYSTROKE_SHM"); keystrokeShmName != nullptr)
+            options.keystrokeShmName = keystrokeShmName;
+
+        return options;
+    }
+
+
+    void blockKeyboardWindowSignals()
+    {
+        sigset_t handledSignals;
+        sigemptyset(&handledSignals);
+        sigaddset(&handledSignals, SIGUSR1);
+        ::pthread_sigmask(SIG_BLOCK, &handledSignals, nullptr);
+    }
+
+
+    void runKeyboardWindow(const KeyboardWindowOptions& options, const input::BatchSinkRef sink) noexcept(false)
+    {
+        if (options.windowCount < 1)
+            throw std::runtime_error("KeyboardWindowOptions::windowCount must be positive");
+
+        const std::uint64_t startupStart = latency::now();
+
+        // https://www.x.org/releases/X11R7.6/doc/libX11/specs/libX11/libX11.html#X_Locale_Management
+        const auto locale = MY_LOG_X11_CALL(std::setlocale(LC_CTYPE, ""));
+        if (locale == nullptr)
+            throw std::runtime_error("std::setlocale failed");
+        if (!MY_LOG_X11_CALL(XSupportsLocale()))
+            throw std::runtime_error(std::string("X11 does not support the current locale ") + locale);
+
+        // Set all X modifiers for the current locale to implementation-dependent defaults (of the current locale).
+        // The local host X locale modifiers announcer (on POSIX-compliant systems, the XMODIFIERS environment variable) is used.
+        // https://www.x.org/releases/X11R7.6/doc/libX11/specs/libX11/libX11.html#X_Locale_Management
+        if (MY_LOG_X11_CALL(XSetLocaleModifiers("")) == nullptr)
+            throw std::runtime_error("XSetLocaleModifiers failed");
+
+        // The connection and the input method are shared by all the windows
+        InputSurfaceManager surfaceManager;
+        Display* const display = surfaceManager.getDisplay();
+
+        AtomCache atomCache{ display };
+
+        if (options.shouldCollapseAutorepeat)
+        {
+            // With the detectable autorepeat the server doesn't send the KeyRelease halves of the repeats at all.
+            // Without it (no XKB) the KeyRelease/KeyPress pairs are recognized in the queue.
+            Bool isDetectableAutorepeatSupported = False;
+            MY_LOG_X11_CALL(XkbSetDetectableAutoRepeat(display, True, &isDetectableAutorepeatSupported));
+            MY_LOG("Collapsing the autorepeats; the detectable autorepeat is ",
+                   isDetectableAutorepeatSupported ? "on" : "not supported");
+        }
+
+        // Kept up to date via MappingNotify (which is always delivered, there is no mask to select it)
+        KeymapCache keymapCache{ display };
+
+        surfaceManager.setInputMethodReadyHandler([startupStart](XIM inputMethod) {
+            MY_LOG("Time to IME ready: ", (latency::now() - startupStart) / 1000, " us");
+            [[maybe_unused]] const XRAIIWrapper supportedInputStyles = obtainSupportedInputStyles(inputMethod);
+        });
+        if ( !options.shouldDeferInputMethod && !surfaceManager.openInputMethod() )
+            throw std::runtime_error("XOpenIM failed");
+
+#ifdef X11KW_WITH_XINPUT2
+        // The XInput2 key events instead of the core ones
+        std::optional<XInput2Keyboard> xinput2Keyboard;
+        if (options.xinput2DeviceId > 0)
+            xinput2Keyboard.emplace(display, options.xinput2DeviceId);
+#endif
+
+        constexpr long windowEventMask =
+            KeyPressMask | KeyReleaseMask | KeymapStateMask | FocusChangeMask | ButtonPressMask | ButtonReleaseMask
+            | ExposureMask;
+
+        // The whole window setup goes out at once, and the atoms it needs take one round trip at most
+        StartupBatch startupBatch{ display, atomCache };
+        for (int windowIndex = 0; windowIndex < options.windowCount; ++windowIndex)
+        {
+            // Cascaded, so that every window can be clicked
+            const Window window = surfaceManager.createWindow(150 + 30 * (windowIndex % 16), 50 + 30 * (windowIndex % 16), 400, 300);
+
+            // "Subscribes" to delete window message.
+            // Then received ClientMessage with attached WM_DELETE_WINDOW in the event loop (see below) will mean
+            //   user have closed the window.
+            startupBatch.setAtomListProperty(window, "WM_PROTOCOLS", { "WM_DELETE_WINDOW" });
+            startupBatch.setUtf8Property(window, "_NET_WM_NAME", "X11KeyboardWindow");
+            startupBatch.setCardinalProperty(window, "_NET_WM_PID", static_cast<std::uint32_t>(::getpid()));
+            startupBatch.setInputHint(window, true);
+
+            // Subscribe to keyboard, focus, mouse and exposure events
+            startupBatch.selectInput(window, windowEventMask);
+#ifdef X11KW_WITH_XINPUT2
+            if (xinput2Keyboard.has_value())
+                xinput2Keyboard->selectEvents(window);
+#endif
+
+            // Show window
+            startupBatch.mapWindow(window);
+        }
+        // Only the atom requests are counted: the input method, the keymap and the XKB calls make their own round trips
+        const std::size_t windowSetupRoundTrips = startupBatch.commit();
+        MY_LOG("Startup round trips of the atom cache: ", atomCache.getRoundTripCount(),
+               " (", windowSetupRoundTrips, " of them in the window setup)");
+
+        // Known since the commit, so it's not a round trip
+        const Atom wmDeleteMessage = atomCache.intern("WM_DELETE_WINDOW");
+
+        // Optional compact binary trace of all the received events. See tools/trace_decoder.cpp for decoding it.
+        std::optional<tracing::EventTraceWriter> eventTrace;
+        if (options.eventTracePath.has_value())
+            eventTrace.emplace(*options.eventTracePath);
+
+        // Optional lossless capture for the offline replays. See tools/event_replay.cpp for replaying it.
+        std::optional<tracing::EventCaptureWriter> eventCapture;
+        if (options.eventCapturePath.has_value())
+            eventCapture.emplace(*options.eventCapturePath);
+
+        // Optional publishing of the keystrokes to the other processes. See keystroke_ring.h for reading them.
+        std::optional<KeystrokePublisher> keystrokePublisher;
+        if (options.keystrokeShmName.has_value())
+            keystrokePublisher.emplace(*options.keystrokeShmName);
+
+        InputMethodText::LookupBuffer imLookupBuffer;
+        KeyBitmap pressedKeys;
+        // The key and button records of the current batch, for the sink
+        input::InputBatchBuilder inputBatch{ maxEventBatchSize };
+
+        MY_LOG("Starting the event loop...");
+
+        // The event loop
+        // https://tronche.com/gui/x/xlib/event-handling/
+        // The X connection is one of the file descriptors of the EventLoop, so the loop is free to serve
+        //   timers, cross-thread tasks and other descriptors between the event batches.
+        // ~2 MB of counters, so they are on the heap. Owned by this run: every run reports its own statistics
+        const auto latencyStats = std::make_unique<latency::LatencyStats>();
+        using latency::Stage;
+
+        // In the steady state handling an event is expected not to allocate anything; this shows which ones do
+        const auto allocationStats = std::make_unique<memory::AllocationStats>();
+
+        EventLoop eventLoop;
+        bool shouldExit = false;
+        bool wasFirstFrameShown = false;
+
+        // The temporaries of a batch. Reset at its end
+        memory::EventArena<4096> batchArena;
+
+        // Processes the events in batches: everything already received is drained without blocking,
+        //   redundant events are coalesced.
+        const auto processEventBatch = [&](std::uint32_t /*epollEvents*/) {
+            // The events are drained directly from the Xlib queue (not copied out into a local array first)
+            //   because XFilterEvent may put events back to the head of the queue, and they must be processed
+            //   right after the event which caused them.
+            // The socket is readable, but Xlib hasn't read the data out yet
+            const std::uint64_t readStart = latency::now();
+            MY_LOG_X11_CALL(XEventsQueued(display, QueuedAfterReading));
+            latencyStats->record(Stage::SocketRead, latency::LatencyStats::noEventType, latency::now() - readStart);
+
+            int batchSize = 0;
+            int coalescedCount = 0;
+            int collapsedAutorepeatsCount = 0;
+            while ( !shouldExit && (batchSize < maxEventBatchSize) && (XEventsQueued(display, QueuedAlready) > 0) )
+            {
+                XEvent event;
+                const std::uint64_t eventStart = latency::now();
+                const memory::AllocationCounters eventStartAllocations = memory::getThreadAllocations();
+                MY_LOG_X11_CALL(XNextEvent(display, &event));
+                std::uint64_t stageEnd = latency::now();
+                latencyStats->record(Stage::NextEvent, event.type, stageEnd - eventStart);
+                ++batchSize;
+
+                // Captured as received, before anything can skip it; what happens to it later is added to the record
+                const std::uint64_t captureIndex = eventCapture.has_value() ? eventCapture->append(event) : 0;
+
+                [[maybe_unused]] bool isXInput2KeyEvent = false;
+#ifdef X11KW_WITH_XINPUT2
+                if (xinput2Keyboard.has_value())
+                {
+                    switch (xinput2Keyboard->handleEvent(event, stageEnd))
+                    {
+                        case XInput2Keyboard::EventKind::NotXInput2:
+                            break;
+                        case XInput2Keyboard::EventKind::Raw:
+                            if (eventCapture.has_value())
+                                eventCapture->markSkipped(captureIndex);
+                            continue;
+                        case XInput2Keyboard::EventKind::Translated:
+                            isXInput2KeyEvent = true;
+                            if (eventCapture.has_value())
+                                eventCapture->replaceEvent(captureIndex, event);
+                            break;
+                    }
+                }
+#endif
+
+                if (isSupersededByNextEvent(display, event))
+                {
+                    if (eventCapture.has_value())
+                        eventCapture->markSkipped(captureIndex);
+                    ++coalescedCount;
+                    continue;
+                }
+
+                bool isAutorepeat = false;
+                int repeatCount = 1;
+                if (options.shouldCollapseAutorepeat)
+                {
+                    // The key stays held, the following KeyPress is the repeat
+                    if (isAutorepeatRelease(display, event))
+                    {
+                        if (eventCapture.has_value())
+                            eventCapture->markSkipped(captureIndex);
+                        ++collapsedAutorepeatsCount;
+                        continue;
+                    }
+
+                    isAutorepeat = (event.type == KeyPress) && (event.xkey.keycode != 0)
+                                   && pressedKeys.test(static_cast<KeyCode>(event.xkey.keycode));
+                }
+
+#ifdef X11KW_WITH_XINPUT2
+                // The server marks the XI2 autorepeats itself
+                if ( isXInput2KeyEvent && (event.type == KeyPress) && xinput2Keyboard->wasLastPressRepeated() )
+                    isAutorepeat = true;
+#endif
+
+                // Also the events the input method filters out are the real key state changes
+                updatePressedKeys(pressedKeys, event);
+
+                // XFilterEvent returns True when some input method has filtered the event,
+                //   and the client should discard the event.
+                std::uint64_t stageStart = stageEnd;
+                [[maybe_unused]] const bool eventWasFiltered = MY_LOG_X11_CALL(XFilterEvent(&event, None));
+                stageEnd = latency::now();
+                latencyStats->record(Stage::FilterEvent, event.type, stageEnd - stageStart);
+                if ( eventWasFiltered && eventCapture.has_value() )
+                    eventCapture->markFilteredOut(captureIndex);
+
+                // The next autorepeats of the key give the same text, unless the input method is involved:
+                //   it filters the event, or it's composing something the repeats may change
+                const InputSurface* const repeatedSurface =
+                    (isAutorepeat && !eventWasFiltered) ? surfaceManager.findSurface(event.xkey.window) : nullptr;
+                const bool isRepeatedIntoPreedit = (repeatedSurface != nullptr) && (repeatedSurface->inputContext != nullptr)
+                                                   && repeatedSurface->preedit.isActive();
+                if (isAutorepeat && !eventWasFiltered && !isRepeatedIntoPreedit)
+                {
+                    const int collapsedCount = consumeQueuedAutorepeats(display, event.xkey, maxEventBatchSize - batchSize,
+                                                                       eventCapture.has_value() ? &*eventCapture : nullptr);
+                    repeatCount += collapsedCount;
+                    batchSize += collapsedCount;
+                    collapsedAutorepeatsCount += collapsedCount;
+                }
+
+                if (eventTrace.has_value())
+                    eventTrace->append(event, eventWasFiltered);
+
+                if (logging::isX11EventLogged(event.type, eventWasFiltered, isAutorepeat))
+                    logging::logX11Event(event, eventWasFiltered, &atomCache);
+
+                if (eventWasFiltered)
+                {
+                    latencyStats->record(Stage::EventTotal, event.type, latency::now() - eventStart);
+                    allocationStats->record(event.type, memory::getThreadAllocations() - eventStartAllocations);
+                    continue;
+                }
+
+                stageStart = latency::now();
+
+                switch (event.type)
+                {
+                    case ClientMessage:
+                    {
+                        if (static_cast<Atom>(event.xclient.data.l[0]) == wmDeleteMessage)
+                        {
+                            surfaceManager.destroyWindow(event.xclient.window);
+                            if (surfaceManager.getSurfaceCount() == 0)
+                            {
+                                MY_LOG("wmDeleteMessage received. Exit the event loop...");
+                                shouldExit = true;
+                            }
+                        }
+                        break;
+                    }
+                    case Expose:
+                    {
+                        // There is no rendering, so the first exposure (the window is on the screen) is the first frame
+                        if (wasFirstFrameShown)
+                            break;
+                        wasFirstFrameShown = true;
+                        MY_LOG("Time to first frame: ", (latency::now() - startupStart) / 1000, " us");
+
+                        if (options.shouldDeferInputMethod)
+                        {
+                            // After the end of this batch, so the frame isn't held up
+                            eventLoop.post([&surfaceManager] {
+                                if (!surfaceManager.openInputMethod())
+                                {
+                                    MY_LOG_WARN("No input method is available yet; waiting for its server");
+                                    surfaceManager.openInputMethodWhenAvailable();
+                                }
+                            });
+                        }
+                        break;
+                    }
+                    case FocusIn:
+                    case FocusOut:
+                    {
+                        surfaceManager.handleFocusEvent(event.xfocus);
+                        break;
+                    }
+                    case KeymapNotify:
+                    {
+                        break;
+                    }
+                    case MappingNotify:
+                    {
+                        keymapCache.handleMappingNotify(event.xmapping);
+                        break;
+                    }
+                    // https://tronche.com/gui/x/xlib/events/keyboard-pointer/keyboard-pointer.html
+                    // https://tronche.com/gui/x/xlib/input/keyboard-encoding.html
+                    case KeyPress:
+                    {
+                        InputSurface* const surface = surfaceManager.findSurface(event.xkey.window);
+                        if (surface == nullptr)
+                            break;
+
+                        XIC const inputContext = surfaceManager.obtainInputContext(*surface);
+                        const auto [keySym, composedTextUtf8] = [&] {
+                            if (inputContext == nullptr)
+                                return InputMethodText::obtainWithoutInputMethod(event.xkey, imLookupBuffer);
+                            // The preedit is tracked via the callbacks, so it's known whether anything is being composed
+                            if (!surface->preedit.isActive())
+                            {
+                                if (auto directText = InputMethodText::obtainDirectly(event.xkey, keymapCache, imLookupBuffer))
+                                    return *directText;
+                            }
+                            return InputMethodText::obtainFrom(inputContext, event.xkey, imLookupBuffer);
+                        }();
+                        MY_LOG_TRACE("Keys held: ", pressedKeys.count());
+
+                        stageEnd = latency::now();
+                        latencyStats->record(Stage::Lookup, event.type, stageEnd - stageStart);
+                        if (const auto sinceServerTime = getNanosecondsSinceServerTime(event.xkey.time, stageEnd))
+                            latencyStats->record(Stage::ServerToText, event.type, *sinceServerTime);
+#ifdef X11KW_WITH_XINPUT2
+                        if (xinput2Keyboard.has_value())
+                        {
+                            const std::uint64_t rawPressTime = xinput2Keyboard->takeRawPressTime(static_cast<KeyCode>(event.xkey.keycode));
+                            if ( (rawPressTime != 0) && (rawPressTime <= stageEnd) )
+                                latencyStats->record(Stage::RawToText, event.type, stageEnd - rawPressTime);
+                        }
+#endif
+                        stageStart = stageEnd;
+
+                        if (eventCapture.has_value())
+                            eventCapture->setLookupResult(captureIndex, keySym, composedTextUtf8, isAutorepeat, repeatCount);
+                        if (keystrokePublisher.has_value())
+                            keystrokePublisher->publish(event.xkey, keySym, composedTextUtf8, isAutorepeat, repeatCount);
+
+                        inputBatch.addKey(event.xkey, keySym, composedTextUtf8, isAutorepeat, repeatCount);
+
+                        break;
+                    }
+                    case KeyRelease:
+                    {
+                        // The same as XLookupKeysym(&event.xkey, 0), but without going into Xlib
+                        const KeySym keySym = keymapCache.getKeySym(static_cast<KeyCode>(event.xkey.keycode), 0);
+                        if (eventCapture.has_value())
+                            eventCapture->setLookupResult(captureIndex, keySym, std::nullopt);
+                        inputBatch.addKey(event.xkey, keySym, std::nullopt);
+                        if (keystrokePublisher.has_value())
+                            keystrokePublisher->publish(event.xkey, keySym, std::nullopt);
+                        break;
+                    }
+                    case ButtonPress:
+                    {
+                        InputSurface* const surface = surfaceManager.findSurface(event.xbutton.window);
+                        if ( (surface != nullptr) && surface->spotLocation.has_value() )
+                            surface->spotLocation->request({ static_cast<short>(event.xbutton.x), static_cast<short>(event.xbutton.y) });
+                        inputBatch.addButton(event.xbutton);
+                        break;
+                    }
+                    case ButtonRelease:
+                    {
+                        inputBatch.addButton(event.xbutton);
+                        break;
+                    }
+                }
+
+                stageEnd = latency::now();
+                latencyStats->record(Stage::Dispatch, event.type, stageEnd - stageStart);
+                latencyStats->record(Stage::EventTotal, event.type, stageEnd - eventStart);
+                allocationStats->record(event.type, memory::getThreadAllocations() - eventStartAllocations);
+            }
+
+            // The end of the batch
+            const memory::AllocationCounters batchEndAllocations = memory::getThreadAllocations();
+            if (eventTrace.has_value())
+                eventTrace->flush();
+            if (eventCapture.has_value())
+                eventCapture->flush();
+
+            // The key and button input of the whole batch goes to the sink at once
+            if (const input::InputBatch batch = inputBatch.getBatch(); !batch.empty())
+                sink(batch);
+            inputBatch.clear();
+
+            surfaceManager.forEachSurface([&batchArena](InputSurface& surface) {
+                if (surface.spotLocation.has_value())
+                    surface.spotLocation->flush();
+
+                // The batch is the "frame": this is where a renderer would redraw the changed part of the preedit
+                if (const auto dirtyRange = surface.preedit.takeDirtyRange(); dirtyRange.has_value()
+                        && logging::isEnabled(logging::Level::debug))
+                {
+                    std::pmr::string preeditText{ batchArena.getResource() };
+                    surface.preedit.appendUtf8To(preeditText);
+                    MY_LOG_DEBUG("Preedit of the window ", surface.window, ": \"", preeditText, "\", caret ",
+                                 surface.preedit.getCaret(), ", changed [", dirtyRange->begin, ", ", dirtyRange->end, ')');
+                }
+            });
+            batchArena.reset();
+            allocationStats->record(memory::AllocationStats::noEventType, memory::getThreadAllocations() - batchEndAllocations);
+
+            if (shouldExit)
+                eventLoop.stop();
+
+            MY_LOG_TRACE("Processed a batch of ", batchSize, " events (", coalescedCount, " coalesced, ",
+                         collapsedAutorepeatsCount, " autorepeats collapsed)");
+        };
+
+        eventLoop.watchFd(
+            ConnectionNumber(display),
+            EPOLLIN,
+            processEventBatch,
+            // Flushes the requests and reads whatever has arrived without blocking.
+            // The events Xlib has already read into its queue (e.g. during a round trip) must be handled
+            //   before waiting, because the socket won't signal them again.
+            [&] { return MY_LOG_X11_CALL(XEventsQueued(display, QueuedAfterFlush)) > 0; }
+        );
+
+        // The sampled event logging reports what it has left out every few seconds, so the gaps are visible in the log
+        constexpr std::chrono::milliseconds logSamplingReportPeriod{ 5000 };
+        EventLoop::Task reportSuppressedLogRecords = [&eventLoop, &reportSuppressedLogRecords, logSamplingReportPeriod] {
+            logging::reportSuppressedX11EventLogRecords();
+            eventLoop.addTimer(logSamplingReportPeriod, reportSuppressedLogRecords);
+        };
+        if (logging::isX11EventLogSamplingEnabled)
+            eventLoop.addTimer(logSamplingReportPeriod, reportSuppressedLogRecords);
+
+        eventLoop.watchSignal(SIGUSR1, [latencyStats = latencyStats.get(), allocationStats = allocationStats.get()] {
+            latencyStats->report();
+            allocationStats->report();
+        });
+
+        eventLoop.run();
+
+        if (keystrokePublisher.has_value())
+            MY_LOG("Published ", keystrokePublisher->getPublishedCount(), " keystrokes");
+
+        latencyStats->report();
+        allocationStats->report();
+        logging::reportSuppressedX11EventLogRecords();
+    }
+}
+
+
+static XRAIIWrapper<XIMStyles*, XFreeDeleter> obtainSupportedInputStyles(XIM inputMethod) noexcept(false)
+{
+    XIMStyles* styles = nullptr;
+    if (const char* failedArg = MY_LOG_X11_CALL(XGetIMValues(inputMethod, XNQueryInputStyle, &styles, nullptr));
+            failedArg != nullptr)
+    {
+        throw std::runtime_error(std::string("XGetIMValues failed: \"") + failedArg + "\"");
+    }
+    if (styles == nullptr)
+        throw std::runtime_error("XGetIMValues didn't return values for XNQueryInputStyle");
+
+    if (!x11kw::logging::isEnabled(x11kw::logging::Level::debug))
+        return { std::move(styles) };
+
+    x11kw::logging::myLogImpl("Supported input styles (XNQueryInputStyle):", '\n');
+    for (int i = 0; i < styles->count_styles; ++i)
+        x11kw::logging::myLogImpl("    ", XIMStyleToString(styles->supported_styles[i]), " (", styles->supported_styles[i], ')', '\n');
+
+    return { std::move(styles) };
+}
+
+
+
+static bool isSupersededByNextEvent(Display* const display, const XEvent& event)
+{
+    if ( (event.type != KeymapNotify) && (event.type != MotionNotify) )
+        return false;
+
+    // Looks only at what's already queued, so never blocks
+    if (XEventsQueued(display, QueuedAlready) == 0)
+        return false;
+
+    XEvent nextEvent;
+    XPeekEvent(display, &nextEvent);
+
+    if (nextEvent.type != event.type)
+        return false;
+
+    switch (event.type)
+    {
+        case KeymapNotify:
+            // KeymapNotify carries the full keyboard state
+            return true;
+        case MotionNotify:
+            return (nextEvent.xmotion.window == event.xmotion.window)
+                   && (nextEvent.xmotion.state == event.xmotion.state);
+        default:
+            return false;
+    }
+}
+
+
+static bool isAutorepeatRelease(Display* const display, const XEvent& event)
+{
+    if ( (event.type != KeyRelease) || (XEventsQueued(display, QueuedAlready) == 0) )
+        return false;
+
+    XEvent nextEvent;
+    XPeekEvent(display, &nextEvent);
+
+    return (nextEvent.type == KeyPress)
+           && (nextEvent.xkey.keycode == event.xkey.keycode)
+           && (nextEvent.xkey.time == event.xkey.time)
+           && (nextEvent.xkey.window == event.xkey.window);
+}
+
+static int consumeQueuedAutorepeats(Display* const display, const XKeyEvent& press, const int maxCount,
+                                    x11kw::tracing::EventCaptureWriter* const capture)
+{
+    const auto isRepeatOfPress = [&press](const XEvent& event) {
+        return (event.type == KeyPress)
+               && (event.xkey.keycode == press.keycode)
+               && (event.xkey.state == press.state)
+               && (event.xkey.window == press.window);
+    };
+
+    int count = 0;
+    while ( (count < maxCount) && (XEventsQueued(display, QueuedAlready) > 0) )
+    {
+        XEvent nextEvent;
+        XPeekEvent(display, &nextEvent);
+
+        if (nextEvent.type == KeyRelease)
+        {
+            // The KeyRelease can be dropped only together with its KeyPress half
+            XEvent release;
+            XNextEvent(display, &release);
+
+            bool isPairOfRepeat = (release.xkey.keycode == press.keycode) && isAutorepeatRelease(display, release);
+            if (isPairOfRepeat)
+            {
+                XPeekEvent(display, &nextEvent);
+                isPairOfRepeat = isRepeatOfPress(nextEvent);
+            }
+
+            if (!isPairOfRepeat)
+            {
+                // It was at the head of the queue, so it's returned exactly where it was
+                XPutBackEvent(display, &release);
+                break;
+            }
+
+            if (capture != nullptr)
+                capture->markSkipped(capture->append(release));
+        }
+        else if (!isRepeatOfPress(nextEvent))
+        {
+            break;
+        }
+
+        XNextEvent(display, &nextEvent);
+        if (capture != nullptr)
+            capture->markSkipped(capture->append(nextEvent));
+        ++count;
+    }
+
+    return count;
+}
+
+static void updatePressedKeys(KeyBitmap& pressedKeys, const XEvent& event)
+{
+    switch (event.type)
+    {
+        case KeyPress:
+            // The input methods commit the text via the key events with keycode 0
+            if (event.xkey.keycode != 0)
+                pressedKeys.set(static_cast<KeyCode>(event.xkey.keycode));
+            break;
+        case KeyRelease:
+            pressedKeys.reset(static_cast<KeyCode>(event.xkey.keycode));
+            break;
+        case KeymapNotify:
+            pressedKeys = KeyBitmap::fromKeyVector(event.xkeymap.key_vector);
+            break;
+        default:
+            break;
+    }
+}
+
+static std::optional<std::uint64_t> getNanosecondsSinceServerTime(const Time serverTime, const std::uint64_t moment)
+{
+    // Time is 32 bits on the wire, so it wraps around every ~49.7 days
+    const auto momentMs = static_cast<std::uint32_t>(moment / 1'000'000);
+    const auto elapsedMs = static_cast<std::uint32_t>(momentMs - static_cast<std::uint32_t>(serverTime));
+
+    // Anything above a minute means the clocks aren't comparable (e.g. the server is remote)
+    if (elapsedMs > 60'000)
+        return std::nullopt;
+
+    return std::uint64_t{ elapsedMs } * 1'000'000 + moment % 1'000'000;
+}
+
@@ -0,0 +1,63 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "input_sink.h"
+#include <optional>     // std::optional
+#include <string>       // std::string
+
+
+// The keyboard window as a library: the X connection, the windows sharing it and the input method,
+//   and the event loop delivering the key and button input of every event batch to a sink (see input_sink.h).
+namespace x11kw
+{
+    struct KeyboardWindowOptions
+    {
+        // The windows share the X connection and the input method. The loop ends once all of them are closed
+        int windowCount = 1;
+        // The autorepeats of a held key queued together are handled as one KeyPress carrying the repeat count.
+        // Only while the input method isn't involved: the window has no input context or its preedit is inactive,
+        //   and the input method doesn't filter the key press.
+        bool shouldCollapseAutorepeat = false;
+        // The fast startup mode: the windows are shown first, and the input method (XOpenIM may take hundreds
+        //   of milliseconds connecting to the server) is opened after the first frame. The keys typed before
+        //   that are handled without the input method.
+        bool shouldDeferInputMethod = false;
+        // The XI2 id of the keyboard device whose XInput2 key events replace the core ones; 1 (XIAllMasterDevices)
+        //   means all the keyboards, 0 keeps the core events. Only with X11KW_WITH_XINPUT2
+        int xinput2DeviceId = 0;
+        // The compact binary trace of all the received events. See tools/trace_decoder.cpp for decoding it
+        std::optional<std::string> eventTracePath;
+        // The lossless capture for the offline replays. See tools/event_replay.cpp for replaying it
+        std::optional<std::string> eventCapturePath;
+        // The shared memory object to publish the keystrokes into. See keystroke_ring.h for reading them
+        std::optional<std::string> keystrokeShmName;
+
+        // The X11KW_* environment variables (see README.md)
+        static KeyboardWindowOptions fromEnvironment() noexcept(false);
+    };
+
+
+    // SIGUSR1 dumps the statistics of the event processing. The event loop receives it via a signalfd,
+    //   so it must be blocked before any thread (even the log writer) is started: the threads inherit the signal mask.
+    void blockKeyboardWindowSignals();
+
+
+    // Opens the display, shows the windows and runs the event loop until they are closed.
+    // The sink (any callable taking the const input::InputBatch&, e.g. input::LoggingInputSink) is called with
+    //   the input of every event batch having any; it's called on this thread, between the batches,
+    //   so it must not block. The loop sees it through the type-erased reference: one indirect call per batch.
+    void runKeyboardWindow(const KeyboardWindowOptions& options, input::BatchSinkRef sink) noexcept(false);
+}
@@ -0,0 +1,171 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "keymap_cache.h"
+#include "logging.h"
+#include "x_raii_wrapper.h"
+#include <X11/keysym.h>     // XK_Num_Lock, XK_Caps_Lock, XK_Shift_Lock
+#include <X11/Xutil.h>      // IsKeypadKey
+#include <algorithm>        // std::copy, std::fill
+#include <iterator>         // std::begin, std::end
+#include <stdexcept>        // std::runtime_error
+
+
+KeymapCache::KeymapCache(Display* const display) noexcept(false)
+    : display_(display)
+{
+    MY_LOG_X11_CALL_VALUELESS(XDisplayKeycodes(display_, &minKeycode_, &maxKeycode_));
+
+    reloadKeyboardMapping(minKeycode_, maxKeycode_ - minKeycode_ + 1);
+    reloadModifierMapping();
+}
+
+
+void KeymapCache::handleMappingNotify(XMappingEvent& event) noexcept(false)
+{
+    MY_LOG_X11_CALL(XRefreshKeyboardMapping(&event));
+
+    switch (event.request)
+    {
+        case MappingKeyboard:
+            MY_LOG_DEBUG("Keyboard mapping changed: keycodes ", event.first_keycode, "...",
+                         event.first_keycode + event.count - 1);
+            reloadKeyboardMapping(event.first_keycode, event.count);
+            updateModifierMeanings();
+            break;
+        case MappingModifier:
+            MY_LOG_DEBUG("Modifier mapping changed");
+            reloadModifierMapping();
+            break;
+        default:
+            // MappingPointer doesn't concern the keyboard
+            break;
+    }
+}
+
+
+KeySym KeymapCache::lookupKeySym(const KeyCode keycode, const unsigned int state) const
+{
+    // https://www.x.org/releases/X11R7.6/doc/xproto/x11protocol.html#keysym_encoding
+    KeySym lower = getKeySym(keycode, 0);
+    KeySym upper = getKeySym(keycode, 1);
+    if (upper == NoSymbol)
+        XConvertCase(lower, &lower, &upper);
+
+    const bool isShifted = (state & ShiftMask) != 0;
+    const bool isLocked = (state & LockMask) != 0;
+
+    if ( (numLockMask_ != 0) && ((state & numLockMask_) != 0) && IsKeypadKey(upper) )
+    {
+        const bool isShiftLocked = isLocked && (lockMeaning_ == LockMeaning::ShiftLock);
+        return (isShifted || isShiftLocked) ? lower : upper;
+    }
+
+    if ( !isShifted && (!isLocked || (lockMeaning_ == LockMeaning::NoLock)) )
+        return lower;
+
+    if (isLocked && (lockMeaning_ == LockMeaning::CapsLock))
+    {
+        KeySym lowerOfChosen = NoSymbol;
+        KeySym upperOfChosen = NoSymbol;
+        XConvertCase(isShifted ? upper : lower, &lowerOfChosen, &upperOfChosen);
+        return upperOfChosen;
+    }
+
+    return upper;
+}
+
+
+void KeymapCache::reloadKeyboardMapping(const int firstKeycode, const int count) noexcept(false)
+{
+    if (count <= 0)
+        return;
+
+    int keySymsPerKeycode = 0;
+    const XRAIIWrapper<KeySym*, XFreeDeleter> keySyms{
+        MY_LOG_X11_CALL(XGetKeyboardMapping(display_, static_cast<KeyCode>(firstKeycode), count, &keySymsPerKeycode))
+    };
+    if (keySyms == nullptr)
+        throw std::runtime_error("XGetKeyboardMapping failed");
+
+    // The width of the table is the same for the whole mapping, so if it changes the whole table has to be fetched
+    const bool isFullReload = (firstKeycode == minKeycode_) && (count == maxKeycode_ - minKeycode_ + 1);
+    if ( (keySymsPerKeycode != keySymsPerKeycode_) && !isFullReload )
+    {
+        reloadKeyboardMapping(minKeycode_, maxKeycode_ - minKeycode_ + 1);
+        return;
+    }
+
+    if (isFullReload)
+    {
+        keySymsPerKeycode_ = keySymsPerKeycode;
+        keySyms_.assign(static_cast<std::size_t>(count) * keySymsPerKeycode_, NoSymbol);
+    }
+
+    const KeySym* const source = keySyms.getResource();
+    std::copy(source, source + static_cast<std::size_t>(count) * keySymsPerKeycode_,
+              keySyms_.begin() + static_cast<std::ptrdiff_t>(firstKeycode - minKeycode_) * keySymsPerKeycode_);
+}
+
+void KeymapCache::reloadModifierMapping() noexcept(false)
+{
+    const XRAIIWrapper modifierMapping{
+        MY_LOG_X11_CALL(XGetModifierMapping(display_)),
+        [](auto& mapping) { if (mapping != nullptr) MY_LOG_X11_CALL(XFreeModifiermap(mapping)); }
+    };
+    if (modifierMapping == nullptr)
+        throw std::runtime_error("XGetModifierMapping failed");
+
+    const XModifierKeymap& mapping = *modifierMapping.getResource();
+    modifierKeycodesPerModifier_ = mapping.max_keypermod;
+    modifierKeycodes_.assign(mapping.modifiermap, mapping.modifiermap + 8 * mapping.max_keypermod);
+
+    updateModifierMeanings();
+}
+
+void KeymapCache::updateModifierMeanings()
+{
+    std::fill(std::begin(modifierMasks_), std::end(modifierMasks_), std::uint8_t{ 0 });
+    numLockMask_ = 0;
+    lockMeaning_ = LockMeaning::NoLock;
+
+    // The modifiers are Shift, Lock, Control, Mod1...Mod5
+    for (int modifierIndex = 0; modifierIndex < 8; ++modifierIndex)
+    {
+        const unsigned int mask = 1u << modifierIndex;
+
+        for (int i = 0; i < modifierKeycodesPerModifier_; ++i)
+        {
+            const KeyCode keycode = modifierKeycodes_[modifierIndex * modifierKeycodesPerModifier_ + i];
+            if (keycode == 0)
+                continue;
+
+            modifierMasks_[keycode] |= static_cast<std::uint8_t>(mask);
+
+            for (int level = 0; level < keySymsPerKeycode_; ++level)
+            {
+                const KeySym keySym = getKeySym(keycode, level);
+                if (keySym == XK_Num_Lock)
+                    numLockMask_ |= mask;
+                if (mask == LockMask)
+                {
+                    if (keySym == XK_Caps_Lock)
+                        lockMeaning_ = LockMeaning::CapsLock;
+                    else if ( (keySym == XK_Shift_Lock) && (lockMeaning_ == LockMeaning::NoLock) )
+                        lockMeaning_ = LockMeaning::ShiftLock;
+                }
+            }
+        }
+    }
+}
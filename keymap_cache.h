@@ -0,0 +1,84 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>
+#include <vector>       // std::vector
+#include <cstdint>      // std::uint8_t
+
+
+// Client-side copy of the keyboard mapping (XGetKeyboardMapping) and the modifier mapping (XGetModifierMapping)
+//   of one display, so resolving a keysym is an array lookup instead of a call into Xlib.
+// It's kept up to date by feeding it the MappingNotify events; only the changed keycode range is fetched again.
+// Not thread-safe.
+class KeymapCache
+{
+public:
+    explicit KeymapCache(Display* display) noexcept(false);
+
+    KeymapCache(const KeymapCache&) = delete;
+    KeymapCache& operator=(const KeymapCache&) = delete;
+
+public:
+    // Also lets Xlib update its own tables (XRefreshKeyboardMapping).
+    void handleMappingNotify(XMappingEvent& event) noexcept(false);
+
+public:
+    // The keysym at the position of the keycode's list (like XKeycodeToKeysym). NoSymbol if there is none.
+    [[nodiscard]] KeySym getKeySym(const KeyCode keycode, const int index) const
+    {
+        if ( (keycode < minKeycode_) || (keycode > maxKeycode_) || (index < 0) || (index >= keySymsPerKeycode_) )
+            return NoSymbol;
+        return keySyms_[static_cast<std::size_t>(keycode - minKeycode_) * keySymsPerKeycode_ + index];
+    }
+
+    // The keysym of the key event's keycode and modifiers state according to the core protocol rules
+    //   (only the first group; Shift, Lock and NumLock are taken into account).
+    // Doesn't involve any input method, so it's the keysym the key would give with no preedit active.
+    [[nodiscard]] KeySym lookupKeySym(KeyCode keycode, unsigned int state) const;
+
+    [[nodiscard]] int getMinKeycode() const { return minKeycode_; }
+    [[nodiscard]] int getMaxKeycode() const { return maxKeycode_; }
+    [[nodiscard]] int getKeySymsPerKeycode() const { return keySymsPerKeycode_; }
+
+    // The mask of the modifier the keycode is bound to (ShiftMask...Mod5Mask), 0 if it's not a modifier key
+    [[nodiscard]] unsigned int getModifierMask(const KeyCode keycode) const { return modifierMasks_[keycode]; }
+    // The mask of the modifier Num_Lock is bound to, 0 if it isn't bound to any
+    [[nodiscard]] unsigned int getNumLockMask() const { return numLockMask_; }
+
+private:
+    void reloadKeyboardMapping(int firstKeycode, int count) noexcept(false);
+    void reloadModifierMapping() noexcept(false);
+    // Recomputes what's derived from both of the mappings
+    void updateModifierMeanings();
+
+private:
+    enum class LockMeaning { NoLock, CapsLock, ShiftLock };
+
+    Display* const display_;
+    int minKeycode_ = 0;
+    int maxKeycode_ = 0;
+    int keySymsPerKeycode_ = 0;
+    // Row-major: keySymsPerKeycode_ entries per keycode starting from minKeycode_
+    std::vector<KeySym> keySyms_;
+
+    // The keycodes of each of the 8 modifiers, modifierKeycodesPerModifier_ per modifier (0 for the unused slots)
+    std::vector<KeyCode> modifierKeycodes_;
+    int modifierKeycodesPerModifier_ = 0;
+
+    std::uint8_t modifierMasks_[256] = {};
+    unsigned int numLockMask_ = 0;
+    LockMeaning lockMeaning_ = LockMeaning::NoLock;
+};
@@ -0,0 +1,167 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "keystroke_publisher.h"
+#include <sys/mman.h>   // shm_open, shm_unlink, mmap, munmap
+#include <fcntl.h>      // O_CREAT, O_EXCL, O_RDWR
+#include <unistd.h>     // ftruncate, close, getpid
+#include <time.h>       // clock_gettime, CLOCK_MONOTONIC
+#include <cerrno>       // errno
+#include <cstring>      // std::memcpy, std::strerror
+#include <algorithm>    // std::min
+#include <stdexcept>    // std::runtime_error
+
+
+namespace
+{
+    [[noreturn]] void throwErrno(const std::string& what)
+    {
+        throw std::runtime_error(what + " failed: " + std::strerror(errno));
+    }
+
+    bool isPowerOf2(const std::size_t value) { return (value != 0) && ((value & (value - 1)) == 0); }
+
+    std::uint64_t getMonotonicNanoseconds()
+    {
+        timespec now{};
+        ::clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<std::uint64_t>(now.tv_sec) * 1'000'000'000ull + static_cast<std::uint64_t>(now.tv_nsec);
+    }
+}
+
+
+KeystrokePublisher::KeystrokePublisher(const std::string& sharedMemoryName,
+                                       const std::size_t slotCount,
+                                       const std::size_t arenaSize) noexcept(false)
+    : name_(sharedMemoryName)
+    , slotMask_(slotCount - 1)
+    , arenaSize_(arenaSize)
+{
+    using namespace x11kw::keystrokes;
+
+    if ( !isPowerOf2(slotCount) || !isPowerOf2(arenaSize) )
+        throw std::runtime_error("The keystroke ring sizes must be powers of 2");
+
+    // The readers of the previous run keep their mapping, the new readers get the new ring
+    ::shm_unlink(name_.c_str());
+    const int fd = ::shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0)
+        throwErrno("shm_open(\"" + name_ + "\")");
+
+    mappedSize_ = getRingSize(slotCount, arenaSize);
+    if (::ftruncate(fd, static_cast<off_t>(mappedSize_)) != 0)
+    {
+        const int savedErrno = errno;
+        ::close(fd);
+        ::shm_unlink(name_.c_str());
+        errno = savedErrno;
+        throwErrno("ftruncate");
+    }
+
+    mapping_ = ::mmap(nullptr, mappedSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping_ == MAP_FAILED)
+    {
+        const int savedErrno = errno;
+        ::shm_unlink(name_.c_str());
+        errno = savedErrno;
+        throwErrno("mmap");
+    }
+
+    // The new object is zero-filled, which is the initial state of the atomics and the slot versions
+    header_ = static_cast<RingHeader*>(mapping_);
+    slots_ = reinterpret_cast<Slot*>(static_cast<char*>(mapping_) + getSlotsOffset());
+    arena_ = static_cast<char*>(mapping_) + getArenaOffset(slotCount);
+
+    header_->version = ringVersion;
+    header_->slotCount = static_cast<std::uint32_t>(slotCount);
+    header_->arenaSize = static_cast<std::uint32_t>(arenaSize);
+    header_->producerPid = static_cast<std::uint32_t>(::getpid());
+    // The readers check the magic first, so it goes last
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header_->magic, ringMagic, sizeof(ringMagic));
+}
+
+KeystrokePublisher::~KeystrokePublisher()
+{
+    header_->isClosed.store(1, std::memory_order_release);
+    ::munmap(mapping_, mappedSize_);
+    ::shm_unlink(name_.c_str());
+}
+
+
+void KeystrokePublisher::publish(const XKeyEvent& event,
+                                 const std::optional<KeySym> keySym,
+                                 const std::optional<std::string_view> textUtf8,
+                                 const bool isRepeat,
+                                 const int repeatCount)
+{
+    using x11kw::keystrokes::KeystrokeRecord;
+
+    const std::uint64_t sequence = nextSequence_++;
+    x11kw::keystrokes::Slot& slot = slots_[sequence & slotMask_];
+
+    // The seqlock's "being written" mark must be visible before any of the record's bytes change
+    slot.version.store(2 * sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    KeystrokeRecord& record = slot.record;
+    record.sequence = sequence;
+    record.timestamp = getMonotonicNanoseconds();
+    record.keySym = keySym.value_or(NoSymbol);
+    record.window = event.window;
+    record.serverTime = static_cast<std::uint32_t>(event.time);
+    record.state = event.state;
+    record.keycode = event.keycode;
+    record.flags = (event.type == KeyPress) ? KeystrokeRecord::Press : 0;
+    record.repeatCount = static_cast<std::uint16_t>( (repeatCount > 0xFFFF) ? 0xFFFF : repeatCount );
+    record.textLength = 0;
+
+    if (isRepeat)
+        record.flags |= KeystrokeRecord::Repeat;
+    if (keySym.has_value())
+        record.flags |= KeystrokeRecord::HasKeySym;
+
+    if (textUtf8.has_value())
+    {
+        record.flags |= KeystrokeRecord::HasText;
+
+        // Longer than the arena is pointless to keep: it would overwrite itself
+        const std::size_t length = std::min(textUtf8->size(), arenaSize_);
+        record.textLength = static_cast<std::uint32_t>(length);
+
+        if (length <= KeystrokeRecord::maxInlineTextBytes)
+        {
+            std::memcpy(record.inlineText, textUtf8->data(), length);
+        }
+        else
+        {
+            record.flags |= KeystrokeRecord::TextInArena;
+            record.textArenaOffset = arenaEnd_;
+
+            // The reservation goes first, so the readers of the overwritten texts can tell
+            arenaEnd_ += length;
+            header_->arenaReservedEnd.store(arenaEnd_, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            const std::size_t begin = static_cast<std::size_t>(record.textArenaOffset & (arenaSize_ - 1));
+            const std::size_t firstPart = std::min(length, arenaSize_ - begin);
+            std::memcpy(arena_ + begin, textUtf8->data(), firstPart);
+            std::memcpy(arena_, textUtf8->data() + firstPart, length - firstPart);
+        }
+    }
+
+    slot.version.store(2 * sequence + 2, std::memory_order_release);
+    header_->writeSequence.store(sequence + 1, std::memory_order_release);
+}
@@ -0,0 +1,62 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "keystroke_ring.h"
+#include <X11/Xlib.h>
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint64_t
+#include <optional>     // std::optional
+#include <string>       // std::string
+#include <string_view>  // std::string_view
+
+
+// The writer side of the keystroke ring (see keystroke_ring.h). Must be used from one thread only.
+class KeystrokePublisher
+{
+public:
+    // Creates the shared memory object (e.g. "/x11kw-keystrokes"), replacing the stale one of the same name.
+    // slotCount and arenaSize must be powers of 2.
+    explicit KeystrokePublisher(const std::string& sharedMemoryName,
+                                std::size_t slotCount = 4096,
+                                std::size_t arenaSize = 1 << 20) noexcept(false);
+
+    KeystrokePublisher(const KeystrokePublisher&) = delete;
+    KeystrokePublisher& operator=(const KeystrokePublisher&) = delete;
+
+    // Marks the ring closed and removes the name; the readers which have it open can still drain it
+    ~KeystrokePublisher();
+
+public:
+    // Never blocks
+    void publish(const XKeyEvent& event, std::optional<KeySym> keySym, std::optional<std::string_view> textUtf8,
+                 bool isRepeat = false, int repeatCount = 1);
+
+    [[nodiscard]] std::uint64_t getPublishedCount() const { return nextSequence_; }
+
+private:
+    const std::string name_;
+    void* mapping_ = nullptr;
+    std::size_t mappedSize_ = 0;
+
+    x11kw::keystrokes::RingHeader* header_ = nullptr;
+    x11kw::keystrokes::Slot* slots_ = nullptr;
+    char* arena_ = nullptr;
+    std::size_t slotMask_ = 0;
+    std::size_t arenaSize_ = 0;
+
+    std::uint64_t nextSequence_ = 0;
+    std::uint64_t arenaEnd_ = 0;
+};
@@ -0,0 +1,161 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <atomic>       // std::atomic
+#include <cstdint>      // std::uint64_t, std::uint32_t, ...
+#include <cstddef>      // std::size_t
+#include <string>       // std::string
+#include <string_view>  // std::string_view
+
+
+// The shared memory ring the window publishes the decoded keystrokes into (X11KW_KEYSTROKE_SHM),
+//   and the reader of it for the other processes. It doesn't depend on Xlib.
+//
+// There is one writer and any number of readers, each with its own cursor. The writer never waits for the readers:
+//   it overwrites the oldest slots, and a reader which fell behind by more than the ring size notices it and skips
+//   the lost keystrokes. Each slot is a seqlock, so a reader never sees a half-written keystroke.
+// The texts longer than the inline part of the slot go into the text arena (a byte ring of its own).
+namespace x11kw::keystrokes
+{
+    inline constexpr char ringMagic[8] = { 'X', '1', '1', 'K', 'W', 'K', 'S', 'R' };
+    inline constexpr std::uint32_t ringVersion = 1;
+
+    struct KeystrokeRecord
+    {
+        static constexpr std::size_t maxInlineTextBytes = 64;
+
+        enum Flags : std::uint16_t
+        {
+            Press        = 1 << 0,
+            HasKeySym    = 1 << 1,
+            HasText      = 1 << 2,
+            Repeat       = 1 << 3,
+            // The text is in the arena at textArenaOffset (it's longer than maxInlineTextBytes)
+            TextInArena  = 1 << 4
+        };
+
+        std::uint64_t sequence;         // the number of the keystroke, from 0
+        std::uint64_t timestamp;        // CLOCK_MONOTONIC ns of the publishing
+        std::uint64_t keySym;
+        std::uint64_t window;
+        std::uint32_t serverTime;       // XKeyEvent::time, ms
+        std::uint32_t state;            // the modifiers and buttons mask
+        std::uint32_t keycode;
+        std::uint32_t textLength;       // UTF-8 bytes
+        std::uint16_t flags;
+        std::uint16_t repeatCount;
+        std::uint8_t reserved[4];
+        union
+        {
+            char inlineText[maxInlineTextBytes];
+            std::uint64_t textArenaOffset;
+        };
+    };
+    static_assert( sizeof(KeystrokeRecord) == 120 );
+
+    struct alignas(64) Slot
+    {
+        // 2 * sequence + 1 while the record is being written, 2 * sequence + 2 once it's complete
+        std::atomic<std::uint64_t> version;
+        KeystrokeRecord record;
+    };
+    static_assert( sizeof(Slot) == 128 );
+
+    struct RingHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t slotCount;        // a power of 2
+        std::uint32_t arenaSize;        // a power of 2
+        std::uint32_t producerPid;
+        std::uint8_t reserved[40];
+
+        // The sequence of the next keystroke to be published
+        alignas(64) std::atomic<std::uint64_t> writeSequence;
+        // The end of the arena bytes which are (being) written; the bytes older than arenaSize before it are gone
+        std::atomic<std::uint64_t> arenaReservedEnd;
+        // Set when the publisher is gone
+        std::atomic<std::uint32_t> isClosed;
+    };
+    static_assert( std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<std::uint32_t>::is_always_lock_free,
+                   "The atomics in the shared memory must be address-free" );
+
+    // The layout of the shared memory object: RingHeader, the slots, the text arena
+    constexpr std::size_t getSlotsOffset() { return (sizeof(RingHeader) + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot); }
+    constexpr std::size_t getArenaOffset(const std::size_t slotCount) { return getSlotsOffset() + slotCount * sizeof(Slot); }
+    constexpr std::size_t getRingSize(const std::size_t slotCount, const std::size_t arenaSize)
+    {
+        return getArenaOffset(slotCount) + arenaSize;
+    }
+
+
+    // A keystroke copied out of the ring
+    struct Keystroke
+    {
+        KeystrokeRecord record;
+        // The text; points into the reader's buffer, valid until the next read
+        std::string_view text;
+    };
+
+
+    class KeystrokeRingReader
+    {
+    public:
+        enum class ReadStatus
+        {
+            Ok,         // The keystroke has been read
+            Empty,      // Nothing new has been published
+            Lagged      // The reader fell behind and some keystrokes were overwritten; they've been skipped
+        };
+
+    public:
+        // Opens the shared memory object (e.g. "/x11kw-keystrokes") published by the window.
+        // The reader starts at the oldest keystroke still in the ring, or at the newest one if fromNewest is set.
+        explicit KeystrokeRingReader(const std::string& sharedMemoryName, bool fromNewest = false) noexcept(false);
+
+        KeystrokeRingReader(const KeystrokeRingReader&) = delete;
+        KeystrokeRingReader& operator=(const KeystrokeRingReader&) = delete;
+
+        ~KeystrokeRingReader();
+
+    public:
+        // Never blocks and makes no system calls
+        ReadStatus read(Keystroke& keystroke);
+
+        // The number of the keystrokes skipped because of lagging behind
+        [[nodiscard]] std::uint64_t getLostCount() const { return lostCount_; }
+
+        // The publisher has exited; the remaining keystrokes can still be read
+        [[nodiscard]] bool isPublisherClosed() const { return header_->isClosed.load(std::memory_order_acquire) != 0; }
+
+    private:
+        // Copies the arena text of the record. Returns false if it has been overwritten meanwhile
+        bool copyArenaText(const KeystrokeRecord& record);
+
+    private:
+        void* mapping_ = nullptr;
+        std::size_t mappedSize_ = 0;
+        const RingHeader* header_ = nullptr;
+        const Slot* slots_ = nullptr;
+        const char* arena_ = nullptr;
+        std::uint64_t slotMask_ = 0;
+        std::uint64_t arenaMask_ = 0;
+
+        std::uint64_t nextSequence_ = 0;
+        std::uint64_t lostCount_ = 0;
+        std::string textBuffer_;
+    };
+}
@@ -0,0 +1,136 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "keystroke_ring.h"
+#include <sys/mman.h>   // shm_open, mmap, munmap
+#include <sys/stat.h>   // fstat
+#include <fcntl.h>      // O_RDONLY
+#include <unistd.h>     // close
+#include <cerrno>       // errno
+#include <cstring>      // std::memcpy, std::memcmp, std::strerror
+#include <stdexcept>    // std::runtime_error
+#include <algorithm>    // std::min, std::max
+
+
+namespace x11kw::keystrokes
+{
+    KeystrokeRingReader::KeystrokeRingReader(const std::string& sharedMemoryName, const bool fromNewest) noexcept(false)
+    {
+        const int fd = ::shm_open(sharedMemoryName.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            throw std::runtime_error("shm_open(\"" + sharedMemoryName + "\") failed: " + std::strerror(errno));
+
+        struct stat fileStat{};
+        const bool isStatOk = (::fstat(fd, &fileStat) == 0);
+        const auto size = static_cast<std::size_t>(fileStat.st_size);
+        if ( !isStatOk || (size < sizeof(RingHeader)) )
+        {
+            ::close(fd);
+            throw std::runtime_error("\"" + sharedMemoryName + "\" is not a keystroke ring");
+        }
+
+        mapping_ = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping_ == MAP_FAILED)
+            throw std::runtime_error(std::string("mmap failed: ") + std::strerror(errno));
+        mappedSize_ = size;
+
+        header_ = static_cast<const RingHeader*>(mapping_);
+        if ( (std::memcmp(header_->magic, ringMagic, sizeof(ringMagic)) != 0)
+             || (header_->version != ringVersion)
+             || (size < getRingSize(header_->slotCount, header_->arenaSize)) )
+        {
+            ::munmap(mapping_, mappedSize_);
+            throw std::runtime_error("\"" + sharedMemoryName + "\" is not a compatible keystroke ring");
+        }
+
+        slots_ = reinterpret_cast<const Slot*>(static_cast<const char*>(mapping_) + getSlotsOffset());
+        arena_ = static_cast<const char*>(mapping_) + getArenaOffset(header_->slotCount);
+        slotMask_ = header_->slotCount - 1;
+        arenaMask_ = header_->arenaSize - 1;
+
+        const std::uint64_t writeSequence = header_->writeSequence.load(std::memory_order_acquire);
+        if (fromNewest)
+            nextSequence_ = writeSequence;
+        else
+            nextSequence_ = (writeSequence > header_->slotCount) ? (writeSequence - header_->slotCount) : 0;
+
+        textBuffer_.reserve(KeystrokeRecord::maxInlineTextBytes);
+    }
+
+    KeystrokeRingReader::~KeystrokeRingReader()
+    {
+        ::munmap(mapping_, mappedSize_);
+    }
+
+
+    KeystrokeRingReader::ReadStatus KeystrokeRingReader::read(Keystroke& keystroke)
+    {
+        const Slot& slot = slots_[nextSequence_ & slotMask_];
+        const std::uint64_t expectedVersion = 2 * nextSequence_ + 2;
+
+        // The slot versions only grow, so an older one means the keystroke hasn't been published (completely) yet
+        const std::uint64_t versionBefore = slot.version.load(std::memory_order_acquire);
+        if (versionBefore < expectedVersion)
+            return ReadStatus::Empty;
+
+        if (versionBefore == expectedVersion)
+        {
+            std::memcpy(&keystroke.record, &slot.record, sizeof(keystroke.record));
+
+            const bool isArenaText = (keystroke.record.flags & KeystrokeRecord::TextInArena) != 0;
+            const bool isTextOk = !isArenaText || copyArenaText(keystroke.record);
+
+            // If the writer has started overwriting the slot during the copying, the version has changed
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ( isTextOk && (slot.version.load(std::memory_order_relaxed) == expectedVersion) )
+            {
+                keystroke.text = isArenaText ? std::string_view{ textBuffer_ }
+                                             : std::string_view{ keystroke.record.inlineText, keystroke.record.textLength };
+                ++nextSequence_;
+                return ReadStatus::Ok;
+            }
+        }
+
+        // Overwritten: go on from the oldest keystroke still there, leaving a slot of margin
+        //   since the oldest one is the next to be overwritten
+        const std::uint64_t writeSequence = header_->writeSequence.load(std::memory_order_acquire);
+        const std::uint64_t slotCount = header_->slotCount;
+        const std::uint64_t oldestSafeSequence = (writeSequence > slotCount) ? (writeSequence - slotCount + 1) : 0;
+        const std::uint64_t resumeSequence = std::max(nextSequence_ + 1, oldestSafeSequence);
+
+        lostCount_ += resumeSequence - nextSequence_;
+        nextSequence_ = resumeSequence;
+        return ReadStatus::Lagged;
+    }
+
+    bool KeystrokeRingReader::copyArenaText(const KeystrokeRecord& record)
+    {
+        const std::uint64_t offset = record.textArenaOffset;
+        const std::size_t length = record.textLength;
+        if (length > header_->arenaSize)
+            return false;
+
+        textBuffer_.resize(length);
+        const std::size_t begin = static_cast<std::size_t>(offset & arenaMask_);
+        const std::size_t firstPart = std::min<std::size_t>(length, header_->arenaSize - begin);
+        std::memcpy(textBuffer_.data(), arena_ + begin, firstPart);
+        std::memcpy(textBuffer_.data() + firstPart, arena_, length - firstPart);
+
+        // The writer reserves the bytes before writing them, so if the reservation hasn't passed
+        //   the end of the text by a whole arena, the text is intact
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return header_->arenaReservedEnd.load(std::memory_order_relaxed) <= offset + header_->arenaSize;
+    }
+}
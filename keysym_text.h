@@ -0,0 +1,40 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>   // KeySym
+#include <cstddef>      // std::size_t
+
+
+// Translation of the keysyms to the characters they type, without Xlib's locale converters.
+namespace x11kw::keysyms
+{
+    // The character the keysym types, 0 if it types none (or isn't known here).
+    // Covers Latin-1, the Unicode keysyms (0x1000000 + the code point), the legacy keysym sets
+    //   having an exact Unicode equivalent, and the control and keypad keys which type ASCII.
+    char32_t toCodepoint(KeySym keySym);
+
+    // The keys an input method (or Xlib's compose handling) may act on instead of just typing a character:
+    //   the dead keys, Multi_key, the ISO keyboard control keys and the CJK input mode keys
+    constexpr bool isInputMethodKey(const KeySym keySym)
+    {
+        return ( (keySym >= 0xfe00) && (keySym <= 0xfeff) )     // ISO_Lock ... the dead keys ... AccessX
+               || ( (keySym >= 0xff20) && (keySym <= 0xff3f) ); // Multi_key, Kanji ... Hangul ... PreviousCandidate
+    }
+
+    // Writes the UTF-8 encoding of the code point to out (which must have room for 4 bytes).
+    // Returns the number of the written bytes
+    std::size_t encodeUtf8(char32_t codepoint, char* out);
+}
@@ -0,0 +1,134 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "latency_stats.h"
+#include "logging.h"
+#include "x11_flags_strings.h"
+#include <cstdio>       // std::snprintf
+#include <string>       // std::string
+
+
+namespace x11kw::latency
+{
+    namespace
+    {
+        // "850ns", "12.3us", "4.56ms", "1.20s"
+        std::string formatDuration(const std::uint64_t nanoseconds)
+        {
+            char buffer[32];
+            if (nanoseconds < 1'000)
+                std::snprintf(buffer, sizeof(buffer), "%lluns", static_cast<unsigned long long>(nanoseconds));
+            else if (nanoseconds < 1'000'000)
+                std::snprintf(buffer, sizeof(buffer), "%.1fus", static_cast<double>(nanoseconds) / 1e3);
+            else if (nanoseconds < 1'000'000'000)
+                std::snprintf(buffer, sizeof(buffer), "%.2fms", static_cast<double>(nanoseconds) / 1e6);
+            else
+                std::snprintf(buffer, sizeof(buffer), "%.2fs", static_cast<double>(nanoseconds) / 1e9);
+
+            return buffer;
+        }
+    }
+
+
+    std::string_view getStageName(const Stage stage)
+    {
+        switch (stage)
+        {
+            case Stage::SocketRead:   return "socket read";
+            case Stage::NextEvent:    return "XNextEvent";
+            case Stage::FilterEvent:  return "XFilterEvent";
+            case Stage::Lookup:       return "Xutf8LookupString";
+            case Stage::Dispatch:     return "dispatch";
+            case Stage::EventTotal:   return "event total";
+            case Stage::ServerToText: return "server time to text";
+            case Stage::RawToText:    return "raw key to text";
+            case Stage::Count:        break;
+        }
+        return "<unknown>";
+    }
+
+
+    Histogram::Summary Histogram::summarize() const
+    {
+        std::uint64_t counts[bucketCount];
+        Summary summary{};
+
+        for (std::size_t i = 0; i < bucketCount; ++i)
+        {
+            counts[i] = counts_[i].load(std::memory_order_relaxed);
+            summary.count += counts[i];
+        }
+        if (summary.count == 0)
+            return summary;
+
+        // The 1-based ranks of the percentiles (rounded up)
+        const auto rankOf = [total = summary.count](const std::uint64_t perMille) {
+            return (total * perMille + 999) / 1000;
+        };
+        const std::uint64_t p50Rank = rankOf(500);
+        const std::uint64_t p90Rank = rankOf(900);
+        const std::uint64_t p99Rank = rankOf(990);
+        const std::uint64_t p999Rank = rankOf(999);
+
+        std::uint64_t accumulated = 0;
+        for (std::size_t i = 0; i < bucketCount; ++i)
+        {
+            if (counts[i] == 0)
+                continue;
+
+            const std::uint64_t previous = accumulated;
+            accumulated += counts[i];
+            const std::uint64_t upperBound = getBucketUpperBound(i);
+
+            if ( (previous < p50Rank) && (accumulated >= p50Rank) )
+                summary.p50 = upperBound;
+            if ( (previous < p90Rank) && (accumulated >= p90Rank) )
+                summary.p90 = upperBound;
+            if ( (previous < p99Rank) && (accumulated >= p99Rank) )
+                summary.p99 = upperBound;
+            if ( (previous < p999Rank) && (accumulated >= p999Rank) )
+                summary.p999 = upperBound;
+            summary.max = upperBound;
+        }
+
+        return summary;
+    }
+
+
+    void LatencyStats::report() const
+    {
+        if (!logging::isEnabled(logging::Level::info))
+            return;
+
+        logging::myLogImpl("Latency statistics (stage, event type: count, p50, p90, p99, p99.9, max):", '\n');
+
+        for (std::size_t stage = 0; stage < static_cast<std::size_t>(Stage::Count); ++stage)
+        {
+            for (int eventType = 0; eventType < LASTEvent; ++eventType)
+            {
+                const Histogram::Summary summary = histograms_[stage][eventType].summarize();
+                if (summary.count == 0)
+                    continue;
+
+                logging::myLogImpl(
+                    "    ", getStageName(static_cast<Stage>(stage)), ", ",
+                    (eventType == noEventType) ? std::string_view{ "(batch)" } : XEventTypeToString(eventType), ": ",
+                    summary.count, ", ", formatDuration(summary.p50), ", ", formatDuration(summary.p90), ", ",
+                    formatDuration(summary.p99), ", ", formatDuration(summary.p999), ", ", formatDuration(summary.max),
+                    '\n'
+                );
+            }
+        }
+    }
+}
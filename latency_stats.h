@@ -0,0 +1,142 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>   // LASTEvent
+#include <atomic>       // std::atomic
+#include <chrono>       // std::chrono::steady_clock
+#include <cstdint>      // std::uint64_t
+#include <cstddef>      // std::size_t
+#include <string_view>  // std::string_view
+
+
+// Always-on latency instrumentation of the event processing stages.
+// Recording a value is a couple of relaxed atomic increments, so it doesn't depend on (and costs much less than)
+//   the text logging of the events.
+namespace x11kw::latency
+{
+    enum class Stage : std::size_t
+    {
+        SocketRead,     // reading the socket's data into the Xlib queue (per batch)
+        NextEvent,      // XNextEvent
+        FilterEvent,    // XFilterEvent
+        Lookup,         // Xutf8LookupString (InputMethodText::obtainFrom)
+        Dispatch,       // handling of the event after the lookup
+        EventTotal,     // XNextEvent call .. the end of the handling
+        ServerToText,   // XKeyEvent::time .. the composed text is obtained (meaningful for local servers only)
+        RawToText,      // receipt of the XInput2 raw key event .. the composed text is obtained (X11KW_XINPUT2)
+
+        Count
+    };
+
+    std::string_view getStageName(Stage stage);
+
+    // Monotonic time in nanoseconds
+    inline std::uint64_t now()
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()
+            ).count()
+        );
+    }
+
+
+    // Log-linear histogram in the spirit of HdrHistogram: every power of 2 range is split into
+    //   2^subBucketBits linear sub-buckets, so any value is kept with a relative error below 1/2^subBucketBits (~3%).
+    // Recording is wait-free and may be done from any number of threads.
+    class Histogram
+    {
+    public:
+        static constexpr unsigned subBucketBits = 5;
+        // The larger values (over ~68 seconds for nanoseconds) are clamped
+        static constexpr unsigned valueBits = 36;
+        static constexpr std::size_t bucketCount = std::size_t{ valueBits - subBucketBits + 1 } << subBucketBits;
+
+        struct Summary
+        {
+            std::uint64_t count;
+            // The upper bounds of the buckets the percentiles fall into
+            std::uint64_t p50;
+            std::uint64_t p90;
+            std::uint64_t p99;
+            std::uint64_t p999;
+            std::uint64_t max;
+        };
+
+    public:
+        void record(const std::uint64_t value)
+        {
+            counts_[getBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // The counters are read one by one, so a summary taken while values are being recorded
+        //   may miss some of them, but it's never inconsistent in any other way.
+        [[nodiscard]] Summary summarize() const;
+
+    public:
+        static constexpr std::size_t getBucketIndex(std::uint64_t value)
+        {
+            constexpr std::uint64_t maxValue = (std::uint64_t{ 1 } << valueBits) - 1;
+            if (value > maxValue)
+                value = maxValue;
+
+            constexpr std::uint64_t subBucketCount = std::uint64_t{ 1 } << subBucketBits;
+            if (value < subBucketCount)
+                return static_cast<std::size_t>(value);
+
+            const unsigned magnitude = 63u - static_cast<unsigned>(__builtin_clzll(value));
+            const unsigned shift = magnitude - subBucketBits;
+            return static_cast<std::size_t>( (std::uint64_t{ shift } << subBucketBits) + (value >> shift) );
+        }
+
+        // The largest value falling into the bucket
+        static constexpr std::uint64_t getBucketUpperBound(const std::size_t index)
+        {
+            constexpr std::size_t subBucketCount = std::size_t{ 1 } << subBucketBits;
+            if (index < 2 * subBucketCount)
+                return index;
+
+            const auto shift = static_cast<unsigned>(index / subBucketCount - 1);
+            const std::uint64_t subBucket = index % subBucketCount + subBucketCount;
+            return ( (subBucket + 1) << shift ) - 1;
+        }
+
+    private:
+        std::atomic<std::uint64_t> counts_[bucketCount] = {};
+    };
+
+
+    // Histograms per stage and per event type.
+    class LatencyStats
+    {
+    public:
+        // The per batch stages (Stage::SocketRead) are recorded with this event type
+        static constexpr int noEventType = 0;
+
+    public:
+        void record(const Stage stage, const int eventType, const std::uint64_t nanoseconds)
+        {
+            const std::size_t typeIndex = ( (eventType >= 0) && (eventType < LASTEvent) ) ? eventType : noEventType;
+            histograms_[static_cast<std::size_t>(stage)][typeIndex].record(nanoseconds);
+        }
+
+        // Prints the summaries of all the non-empty histograms to the log (at the info level)
+        void report() const;
+
+    private:
+        Histogram histograms_[static_cast<std::size_t>(Stage::Count)][LASTEvent];
+    };
+}
@@ -0,0 +1,310 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "logging.h"
+#include <sys/uio.h>            // writev, iovec
+#include <unistd.h>             // STDERR_FILENO
+#include <climits>              // IOV_MAX
+#include <cerrno>               // errno, EINTR
+#include <cstring>              // std::memcpy
+#include <cstdint>              // std::intptr_t
+#include <atomic>               // std::atomic
+#include <mutex>                // std::mutex, std::unique_lock
+#include <condition_variable>   // std::condition_variable
+#include <chrono>               // std::chrono::milliseconds
+#include <thread>               // std::thread
+#include <memory>               // std::unique_ptr
+#include <cstdlib>              // std::getenv
+#include <string_view>          // std::string_view
+
+
+namespace x11kw::logging::detail
+{
+    namespace
+    {
+        // Writes the whole iovec array to fd, retrying on partial writes and EINTR.
+        void writeAll(const int fd, iovec* iov, int iovCount)
+        {
+            while (iovCount > 0)
+            {
+                ssize_t written = ::writev(fd, iov, iovCount);
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return;
+                }
+
+                while ( (iovCount > 0) && (static_cast<std::size_t>(written) >= iov->iov_len) )
+                {
+                    written -= static_cast<ssize_t>(iov->iov_len);
+                    ++iov;
+                    --iovCount;
+                }
+                if (iovCount > 0)
+                {
+                    iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+                    iov->iov_len -= static_cast<std::size_t>(written);
+                }
+            }
+        }
+
+
+        // Bounded lock-free multi-producer single-consumer queue of log records
+        //   (the algorithm is Dmitry Vyukov's bounded MPMC queue with a simplified consumer side)
+        //   and the background thread draining it into stderr.
+        class AsyncLogBackend
+        {
+        public:
+            AsyncLogBackend()
+            {
+                for (std::size_t i = 0; i < capacity; ++i)
+                    cells_[i].sequence.store(i, std::memory_order_relaxed);
+
+                writerThread_ = std::thread{ [this] { writerLoop(); } };
+            }
+
+            AsyncLogBackend(const AsyncLogBackend&) = delete;
+            AsyncLogBackend& operator=(const AsyncLogBackend&) = delete;
+
+            ~AsyncLogBackend()
+            {
+                stopRequested_.store(true, std::memory_order_release);
+                wakeWriter();
+                writerThread_.join();
+            }
+
+        public:
+            void push(const char* data, std::size_t size)
+            {
+                std::size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+                Cell* cell;
+                for (;;)
+                {
+                    cell = &cells_[pos & mask];
+                    const std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+                    const auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+                    if (diff == 0)
+                    {
+                        if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    else if (diff < 0)
+                    {
+                        // The queue is full: wait for the writer instead of losing the record.
+                        wakeWriter();
+                        std::this_thread::yield();
+                        pos = enqueuePos_.load(std::memory_order_relaxed);
+                    }
+                    else
+                    {
+                        pos = enqueuePos_.load(std::memory_order_relaxed);
+                    }
+                }
+
+                std::memcpy(cell->data, data, size);
+                cell->size = size;
+                cell->sequence.store(pos + 1, std::memory_order_release);
+
+                // Pairs with the fence in writerLoop: either the writer sees the record or we see it sleeping
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (writerIsSleeping_.load(std::memory_order_acquire))
+                    wakeWriter();
+            }
+
+            void setOutputFileDescriptor(const int fd)
+            {
+                flush();
+                outputFd_.store(fd, std::memory_order_relaxed);
+            }
+
+            void flush()
+            {
+                const std::size_t target = enqueuePos_.load(std::memory_order_acquire);
+                while (dequeuedPos_.load(std::memory_order_acquire) < target)
+                {
+                    wakeWriter();
+                    std::this_thread::yield();
+                }
+            }
+
+        private:
+            static constexpr std::size_t capacity = 1024;
+            static constexpr std::size_t mask = capacity - 1;
+            static_assert( (capacity & mask) == 0, "capacity must be a power of 2" );
+
+            static constexpr int maxBatchSize = (IOV_MAX < 256) ? IOV_MAX : 256;
+
+            struct Cell
+            {
+                std::atomic<std::size_t> sequence;
+                std::size_t size;
+                char data[logRecordCapacity];
+            };
+
+        private:
+            void wakeWriter()
+            {
+                // The lock orders this notification with the writer's "sleeping" check, so the wakeup can't be lost
+                std::lock_guard lock{ writerMutex_ };
+                writerCV_.notify_one();
+            }
+
+            // Writes out all the records ready at the moment. Returns false if there were none.
+            bool drainBatch()
+            {
+                iovec iov[maxBatchSize];
+                int count = 0;
+                std::size_t pos = dequeuedPos_.load(std::memory_order_relaxed);
+
+                while (count < maxBatchSize)
+                {
+                    Cell& cell = cells_[(pos + count) & mask];
+                    if (cell.sequence.load(std::memory_order_acquire) != pos + count + 1)
+                        break;
+
+                    iov[count].iov_base = cell.data;
+                    iov[count].iov_len = cell.size;
+                    ++count;
+                }
+
+                if (count == 0)
+                    return false;
+
+                writeAll(outputFd_.load(std::memory_order_relaxed), iov, count);
+
+                for (int i = 0; i < count; ++i)
+                    cells_[(pos + i) & mask].sequence.store(pos + i + capacity, std::memory_order_release);
+                dequeuedPos_.store(pos + count, std::memory_order_release);
+
+                return true;
+            }
+
+            void writerLoop()
+            {
+                for (;;)
+                {
+                    while (drainBatch()) {}
+
+                    if (stopRequested_.load(std::memory_order_acquire))
+                    {
+                        // Drain the records submitted right before the stop request
+                        while (drainBatch()) {}
+                        return;
+                    }
+
+                    std::unique_lock lock{ writerMutex_ };
+                    writerIsSleeping_.store(true, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    // The timeout is a safety net only; regular wakeups come from push/flush/the destructor
+                    writerCV_.wait_for(lock, std::chrono::milliseconds{50}, [this] {
+                        const std::size_t pos = dequeuedPos_.load(std::memory_order_relaxed);
+                        return stopRequested_.load(std::memory_order_acquire)
+                            || (cells_[pos & mask].sequence.load(std::memory_order_acquire) == pos + 1);
+                    });
+                    writerIsSleeping_.store(false, std::memory_order_relaxed);
+                }
+            }
+
+        private:
+            alignas(64) std::atomic<std::size_t> enqueuePos_{ 0 };
+            alignas(64) std::atomic<std::size_t> dequeuedPos_{ 0 };
+            alignas(64) std::atomic<bool> writerIsSleeping_{ false };
+            std::atomic<bool> stopRequested_{ false };
+            std::atomic<int> outputFd_{ STDERR_FILENO };
+
+            std::mutex writerMutex_;
+            std::condition_variable writerCV_;
+            std::thread writerThread_;
+
+            std::unique_ptr<Cell[]> cellsStorage_{ new Cell[capacity] };
+            Cell* const cells_ = cellsStorage_.get();
+        };
+
+
+        AsyncLogBackend& getBackend()
+        {
+            static AsyncLogBackend instance;
+            return instance;
+        }
+    }
+
+
+    void submitRecord(const char* data, std::size_t size)
+    {
+        getBackend().push(data, size);
+    }
+
+    bool isLogSiteSelected(const std::string_view callText)
+    {
+        static const char* const selectedSites = std::getenv("X11KW_LOG_SITES");
+        if (selectedSites == nullptr)
+            return false;
+
+        std::string_view functionName = callText.substr(0, callText.find('('));
+        while ( !functionName.empty() && (functionName.back() == ' ') )
+            functionName.remove_suffix(1);
+
+        std::string_view sites = selectedSites;
+        while (!sites.empty())
+        {
+            const std::size_t separator = sites.find(',');
+            if (sites.substr(0, separator) == functionName)
+                return true;
+            if (separator == std::string_view::npos)
+                break;
+            sites.remove_prefix(separator + 1);
+        }
+
+        return false;
+    }
+}
+
+
+namespace x11kw::logging
+{
+    namespace
+    {
+        Level readRuntimeMinLevel()
+        {
+            const char* const envValue = std::getenv("X11KW_LOG_LEVEL");
+            if (envValue == nullptr)
+                return Level::trace;
+
+            const std::string_view value = envValue;
+            if (value == "trace") return Level::trace;
+            if (value == "debug") return Level::debug;
+            if (value == "info")  return Level::info;
+            if (value == "warn")  return Level::warn;
+            if (value == "error") return Level::error;
+            if (value == "off")   return Level::off;
+
+            return Level::trace;
+        }
+    }
+
+    Level runtimeMinLevel = readRuntimeMinLevel();
+
+
+    void flush()
+    {
+        detail::getBackend().flush();
+    }
+
+    void setOutputFileDescriptor(const int fd)
+    {
+        detail::getBackend().setOutputFileDescriptor(fd);
+    }
+}
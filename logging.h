@@ -0,0 +1,246 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <ostream>      // std::ostream
+#include <streambuf>    // std::streambuf
+#include <cstddef>      // std::size_t
+#include <utility>      // std::forward
+#include <type_traits>  // std::is_pointer_v, std::remove_cv_t, std::remove_reference_t, std::decay_t
+#include <thread>       // std::this_thread
+#include <string_view>  // std::string_view
+
+
+// Log severity levels. The compile-time minimum level is set with MY_LOG_COMPILED_LEVEL
+//   (see the X11KW_LOG_LEVEL CMake option); the records of the levels below it are compiled out completely.
+// The level can additionally be raised at runtime via the X11KW_LOG_LEVEL environment variable
+//   (one of "trace", "debug", "info", "warn", "error", "off").
+// The X11 call sites (MY_LOG_X11_CALL) named in the X11KW_LOG_SITES environment variable (comma-separated function
+//   names, e.g. "XFilterEvent,Xutf8LookupString") are logged whatever the runtime level is, as long as the trace level
+//   is compiled in.
+#define MY_LOG_LEVEL_TRACE 0
+#define MY_LOG_LEVEL_DEBUG 1
+#define MY_LOG_LEVEL_INFO  2
+#define MY_LOG_LEVEL_WARN  3
+#define MY_LOG_LEVEL_ERROR 4
+#define MY_LOG_LEVEL_OFF   5
+
+#ifndef MY_LOG_COMPILED_LEVEL
+    #define MY_LOG_COMPILED_LEVEL MY_LOG_LEVEL_TRACE
+#endif
+
+
+namespace x11kw::logging
+{
+    enum class Level : int
+    {
+        trace = MY_LOG_LEVEL_TRACE,
+        debug = MY_LOG_LEVEL_DEBUG,
+        info  = MY_LOG_LEVEL_INFO,
+        warn  = MY_LOG_LEVEL_WARN,
+        error = MY_LOG_LEVEL_ERROR,
+        off   = MY_LOG_LEVEL_OFF
+    };
+
+    // The minimum level obtained from the environment at startup.
+    extern Level runtimeMinLevel;
+
+    constexpr bool isCompiledIn(const Level level) { return static_cast<int>(level) >= MY_LOG_COMPILED_LEVEL; }
+
+    inline bool isEnabled(const Level level)
+    {
+        return isCompiledIn(level) && (static_cast<int>(level) >= static_cast<int>(runtimeMinLevel));
+    }
+
+
+    template<typename... Ts>
+    void myLogImpl(Ts&&... args);
+
+    // Logs regardless of the levels
+    #define MY_LOG_UNCONDITIONALLY_IMPL(...)                                                                            \
+        x11kw::logging::myLogImpl("[tid:", std::this_thread::get_id(), "] ", __FILE__ ":", __LINE__, ": ", __VA_ARGS__, '\n')
+
+    #define MY_LOG_AT_IMPL(LEVEL, ...)                                                                                  \
+        ( x11kw::logging::isEnabled(LEVEL) ? MY_LOG_UNCONDITIONALLY_IMPL(__VA_ARGS__) : void() )
+
+    // The arguments of the disabled levels are still type-checked but never evaluated
+    #define MY_LOG_DISABLED_IMPL(...) ( false ? x11kw::logging::myLogImpl(__VA_ARGS__) : void() )
+
+    #if MY_LOG_COMPILED_LEVEL <= MY_LOG_LEVEL_TRACE
+        #define MY_LOG_TRACE(...) MY_LOG_AT_IMPL(x11kw::logging::Level::trace, __VA_ARGS__)
+    #else
+        #define MY_LOG_TRACE(...) MY_LOG_DISABLED_IMPL(__VA_ARGS__)
+    #endif
+
+    #if MY_LOG_COMPILED_LEVEL <= MY_LOG_LEVEL_DEBUG
+        #define MY_LOG_DEBUG(...) MY_LOG_AT_IMPL(x11kw::logging::Level::debug, __VA_ARGS__)
+    #else
+        #define MY_LOG_DEBUG(...) MY_LOG_DISABLED_IMPL(__VA_ARGS__)
+    #endif
+
+    #if MY_LOG_COMPILED_LEVEL <= MY_LOG_LEVEL_INFO
+        #define MY_LOG_INFO(...) MY_LOG_AT_IMPL(x11kw::logging::Level::info, __VA_ARGS__)
+    #else
+        #define MY_LOG_INFO(...) MY_LOG_DISABLED_IMPL(__VA_ARGS__)
+    #endif
+
+    #if MY_LOG_COMPILED_LEVEL <= MY_LOG_LEVEL_WARN
+        #define MY_LOG_WARN(...) MY_LOG_AT_IMPL(x11kw::logging::Level::warn, __VA_ARGS__)
+    #else
+        #define MY_LOG_WARN(...) MY_LOG_DISABLED_IMPL(__VA_ARGS__)
+    #endif
+
+    #if MY_LOG_COMPILED_LEVEL <= MY_LOG_LEVEL_ERROR
+        #define MY_LOG_ERROR(...) MY_LOG_AT_IMPL(x11kw::logging::Level::error, __VA_ARGS__)
+    #else
+        #define MY_LOG_ERROR(...) MY_LOG_DISABLED_IMPL(__VA_ARGS__)
+    #endif
+
+    #define MY_LOG(...) MY_LOG_INFO(__VA_ARGS__)
+
+    // Logs the call and its result at the trace level (or always, if the site is named in X11KW_LOG_SITES).
+    // Whether the site is logged is resolved once, on its first call, into a flag of its own, so the calls
+    //   branch on it alone. Hence changes of runtimeMinLevel after that don't affect the site.
+    // If the trace level is compiled out, it's just the bare call.
+    #if MY_LOG_COMPILED_LEVEL <= MY_LOG_LEVEL_TRACE
+        #define MY_LOG_X11_CALL(FUNC_CALL)                                          \
+        [&] {                                                                       \
+            static const bool isLogged_local =                                      \
+                x11kw::logging::isEnabled(x11kw::logging::Level::trace)             \
+                || x11kw::logging::detail::isLogSiteSelected(#FUNC_CALL);           \
+            if (!isLogged_local)                                                    \
+                return FUNC_CALL;                                                   \
+            MY_LOG_UNCONDITIONALLY_IMPL(#FUNC_CALL, "...");                         \
+            auto result_local = FUNC_CALL;                                          \
+            MY_LOG_UNCONDITIONALLY_IMPL("    ...returned ", result_local);          \
+            return result_local;                                                    \
+        }()
+
+        #define MY_LOG_X11_CALL_VALUELESS(FUNC_CALL)                                \
+        [&] {                                                                       \
+            static const bool isLogged_local =                                      \
+                x11kw::logging::isEnabled(x11kw::logging::Level::trace)             \
+                || x11kw::logging::detail::isLogSiteSelected(#FUNC_CALL);           \
+            if (!isLogged_local)                                                    \
+                return (void)(FUNC_CALL);                                           \
+            MY_LOG_UNCONDITIONALLY_IMPL(#FUNC_CALL, "...");                         \
+            FUNC_CALL;                                                              \
+            MY_LOG_UNCONDITIONALLY_IMPL("    ...finished.");                        \
+        }()
+    #else
+        // decayCopy keeps the result a prvalue of the same type the logging version returns
+        #define MY_LOG_X11_CALL(FUNC_CALL) x11kw::logging::detail::decayCopy(FUNC_CALL)
+        #define MY_LOG_X11_CALL_VALUELESS(FUNC_CALL) ((void)(FUNC_CALL))
+    #endif
+
+    // Blocks until every record submitted so far by any thread has been written out.
+    void flush();
+
+    // Redirects the output of the log (stderr by default) to the file descriptor.
+    void setOutputFileDescriptor(int fd);
+}
+
+
+namespace x11kw::logging::detail
+{
+    template<typename T>
+    constexpr std::decay_t<T> decayCopy(T&& value) { return std::forward<T>(value); }
+
+    // Whether the function of the call (its text up to the '(', e.g. "XFilterEvent") is named in X11KW_LOG_SITES
+    bool isLogSiteSelected(std::string_view callText);
+
+    // The maximum size of a single record in the log queue.
+    // Longer messages are split into several records as they are formatted, so the records of the other threads
+    //   may get in between the pieces (each record itself is written out whole).
+    inline constexpr std::size_t logRecordCapacity = 1024;
+
+    // Pushes the bytes onto the log queue of the background writer.
+    void submitRecord(const char* data, std::size_t size);
+
+    // std::streambuf over a fixed-size buffer which hands its contents over to submitRecord
+    //   once it is full or committed. That way formatting a message doesn't allocate anything.
+    class RecordStreamBuffer : public std::streambuf
+    {
+    public:
+        RecordStreamBuffer() { setp(buffer_, buffer_ + sizeof(buffer_)); }
+
+    public:
+        void commit()
+        {
+            if (pptr() != pbase())
+                submitRecord(pbase(), static_cast<std::size_t>(pptr() - pbase()));
+            setp(buffer_, buffer_ + sizeof(buffer_));
+        }
+
+    protected:
+        int_type overflow(int_type ch) override
+        {
+            commit();
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+                sputc(traits_type::to_char_type(ch));
+            return traits_type::not_eof(ch);
+        }
+
+    private:
+        char buffer_[logRecordCapacity];
+    };
+
+    // A per-thread preallocated formatter: there is exactly one stream (with its buffer) per thread.
+    struct ThreadLogFormatter
+    {
+        RecordStreamBuffer buffer;
+        std::ostream stream{ &buffer };
+        const std::ios_base::fmtflags initialFlags = stream.flags();
+
+        static ThreadLogFormatter& get()
+        {
+            thread_local ThreadLogFormatter instance;
+            return instance;
+        }
+    };
+}
+
+
+namespace x11kw::logging
+{
+    template<typename... Ts>
+    void myLogImpl(Ts&&... args)
+    {
+        auto& formatter = detail::ThreadLogFormatter::get();
+        std::ostream& strStream = formatter.stream;
+
+        const auto writer = [&strStream](auto&& value) -> int {
+            using WithoutCVRefs = std::remove_cv_t<std::remove_reference_t<decltype(value)>>;
+            if constexpr (std::is_pointer_v<WithoutCVRefs>)
+            {
+                if (std::forward<decltype(value)>(value) == nullptr)
+                {
+                    strStream << "<nullptr>";
+                    return 0;
+                }
+            }
+
+            strStream << std::forward<decltype(value)>(value);
+
+            return 0;
+        };
+
+        [[maybe_unused]] const int dummy[sizeof...(Ts)] = { writer(std::forward<Ts>(args))... };
+
+        formatter.buffer.commit();
+        strStream.clear();
+        strStream.flags(formatter.initialFlags);
+    }
+}
@@ -0,0 +1,221 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "preedit_buffer.h"
+#include <cwchar>       // std::mbrtowc, std::mbstate_t
+#include <cstring>      // std::strlen
+#include <algorithm>    // std::min, std::max
+
+
+PreeditBuffer::PreeditBuffer(const int maxLength)
+    : maxLength_(maxLength)
+{
+    cells_.reserve(static_cast<std::size_t>(maxLength_));
+    decodedCells_.reserve(static_cast<std::size_t>(maxLength_));
+}
+
+
+int PreeditBuffer::start()
+{
+    isActive_ = true;
+    if (!cells_.empty())
+        markDirty(0, cells_.size());
+    cells_.clear();
+    caret_ = 0;
+
+    return maxLength_;
+}
+
+void PreeditBuffer::done()
+{
+    isActive_ = false;
+    if (!cells_.empty())
+        markDirty(0, cells_.size());
+    cells_.clear();
+    caret_ = 0;
+}
+
+
+void PreeditBuffer::draw(const XIMPreeditDrawCallbackStruct& drawData)
+{
+    const std::size_t oldSize = cells_.size();
+    const std::size_t changeFirst = std::min<std::size_t>(static_cast<std::size_t>(std::max(drawData.chg_first, 0)), oldSize);
+    const std::size_t changeLength = std::min<std::size_t>(static_cast<std::size_t>(std::max(drawData.chg_length, 0)),
+                                                           oldSize - changeFirst);
+
+    if (drawData.text == nullptr)
+    {
+        // Deletion only
+        cells_.replace(changeFirst, changeLength, nullptr, 0);
+    }
+    else if (decode(*drawData.text))
+    {
+        cells_.replace(changeFirst, changeLength, decodedCells_.data(), decodedCells_.size());
+    }
+    else
+    {
+        // No string: only the feedback of the characters starting at chg_first changes
+        const std::size_t count = std::min<std::size_t>(drawData.text->length, oldSize - changeFirst);
+        for (std::size_t i = 0; i < count; ++i)
+            cells_[changeFirst + i].feedback = (drawData.text->feedback != nullptr) ? drawData.text->feedback[i] : 0;
+        markDirty(changeFirst, changeFirst + count);
+    }
+
+    const std::size_t newSize = cells_.size();
+    if (newSize != oldSize)
+    {
+        // Everything after the change moved
+        markDirty(changeFirst, std::max(oldSize, newSize));
+    }
+    else if (drawData.text != nullptr)
+    {
+        markDirty(changeFirst, changeFirst + std::max(changeLength, static_cast<std::size_t>(drawData.text->length)));
+    }
+
+    caret_ = std::min<std::size_t>(static_cast<std::size_t>(std::max(drawData.caret, 0)), newSize);
+}
+
+void PreeditBuffer::moveCaret(XIMPreeditCaretCallbackStruct& caretData)
+{
+    const std::size_t size = cells_.size();
+
+    switch (caretData.direction)
+    {
+        case XIMAbsolutePosition:
+            caret_ = std::min<std::size_t>(static_cast<std::size_t>(std::max(caretData.position, 0)), size);
+            break;
+        case XIMForwardChar:
+            caret_ = std::min(caret_ + 1, size);
+            break;
+        case XIMBackwardChar:
+            caret_ = (caret_ > 0) ? caret_ - 1 : 0;
+            break;
+        case XIMLineStart:
+            caret_ = 0;
+            break;
+        case XIMLineEnd:
+            caret_ = size;
+            break;
+        default:
+            // The word and the multiline movements: the preedit is a single line without the notion of words here
+            break;
+    }
+
+    caretData.position = static_cast<int>(caret_);
+}
+
+
+std::optional<PreeditBuffer::DirtyRange> PreeditBuffer::takeDirtyRange()
+{
+    std::optional<DirtyRange> result;
+    result.swap(dirtyRange_);
+    return result;
+}
+
+void PreeditBuffer::appendUtf8To(std::pmr::string& result) const
+{
+    for (std::size_t i = 0; i < cells_.size(); ++i)
+    {
+        const char32_t ch = cells_[i].character;
+        if (ch < 0x80)
+        {
+            result += static_cast<char>(ch);
+        }
+        else if (ch < 0x800)
+        {
+            result += static_cast<char>(0xC0 | (ch >> 6));
+            result += static_cast<char>(0x80 | (ch & 0x3F));
+        }
+        else if (ch < 0x10000)
+        {
+            result += static_cast<char>(0xE0 | (ch >> 12));
+            result += static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (ch & 0x3F));
+        }
+        else
+        {
+            result += static_cast<char>(0xF0 | (ch >> 18));
+            result += static_cast<char>(0x80 | ((ch >> 12) & 0x3F));
+            result += static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (ch & 0x3F));
+        }
+    }
+}
+
+
+void PreeditBuffer::markDirty(const std::size_t begin, const std::size_t end)
+{
+    if (begin >= end)
+        return;
+
+    if (dirtyRange_.has_value())
+    {
+        dirtyRange_->begin = std::min(dirtyRange_->begin, begin);
+        dirtyRange_->end = std::max(dirtyRange_->end, end);
+    }
+    else
+    {
+        dirtyRange_ = DirtyRange{ begin, end };
+    }
+}
+
+bool PreeditBuffer::decode(const XIMText& text)
+{
+    decodedCells_.clear();
+
+    const auto feedbackOf = [&text](const std::size_t index) -> XIMFeedback {
+        return (text.feedback != nullptr) ? text.feedback[index] : 0;
+    };
+
+    if (text.encoding_is_wchar)
+    {
+        if (text.string.wide_char == nullptr)
+            return false;
+
+        for (std::size_t i = 0; i < text.length; ++i)
+            decodedCells_.push_back({ static_cast<char32_t>(text.string.wide_char[i]), feedbackOf(i) });
+        return true;
+    }
+
+    if (text.string.multi_byte == nullptr)
+        return false;
+
+    // The multibyte string is in the encoding of the current locale
+    const char* bytes = text.string.multi_byte;
+    std::size_t bytesLeft = std::strlen(bytes);
+    std::mbstate_t state{};
+
+    while ( (decodedCells_.size() < text.length) && (bytesLeft > 0) )
+    {
+        wchar_t ch = 0;
+        const std::size_t consumed = std::mbrtowc(&ch, bytes, bytesLeft, &state);
+        if ( (consumed == static_cast<std::size_t>(-1)) || (consumed == static_cast<std::size_t>(-2)) )
+        {
+            // Invalid or incomplete sequence: keep the character count right with U+FFFD
+            decodedCells_.push_back({ U'\uFFFD', feedbackOf(decodedCells_.size()) });
+            bytes += 1;
+            bytesLeft -= 1;
+            state = std::mbstate_t{};
+            continue;
+        }
+        if (consumed == 0)
+            break;
+
+        decodedCells_.push_back({ static_cast<char32_t>(ch), feedbackOf(decodedCells_.size()) });
+        bytes += consumed;
+        bytesLeft -= consumed;
+    }
+
+    return true;
+}
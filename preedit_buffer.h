@@ -0,0 +1,87 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "gap_buffer.h"
+#include <X11/Xlib.h>
+#include <cstddef>      // std::size_t
+#include <optional>     // std::optional
+#include <string>       // std::pmr::string
+#include <memory_resource> // std::pmr::polymorphic_allocator
+#include <vector>       // std::vector
+
+
+// The model of the preedit (the text being composed in the input method) of one XIC
+//   for the XIMPreeditCallbacks input style: the preedit callbacks forward their call data to it.
+// Every draw is applied as a splice of the changed part only, and the changed range is accumulated until
+//   the renderer takes it, so it redraws only what changed.
+class PreeditBuffer
+{
+public:
+    struct Cell
+    {
+        char32_t character;
+        XIMFeedback feedback;   // XIMReverse, XIMUnderline, XIMHighlight, ...
+    };
+
+    // [begin, end) in characters. end may be beyond size() if the text got shorter: the tail has to be cleared.
+    struct DirtyRange
+    {
+        std::size_t begin;
+        std::size_t end;
+    };
+
+public:
+    explicit PreeditBuffer(int maxLength);
+
+public:
+    // XNPreeditStartCallback. Returns the maximum length of the preedit (for the input method).
+    int start();
+    // XNPreeditDoneCallback
+    void done();
+    // XNPreeditDrawCallback
+    void draw(const XIMPreeditDrawCallbackStruct& drawData);
+    // XNPreeditCaretCallback. Updates caretData.position to the new caret position, as the input method expects.
+    void moveCaret(XIMPreeditCaretCallbackStruct& caretData);
+
+public:
+    [[nodiscard]] bool isActive() const { return isActive_; }
+    [[nodiscard]] std::size_t size() const { return cells_.size(); }
+    [[nodiscard]] const Cell& operator[](const std::size_t index) const { return cells_[index]; }
+    [[nodiscard]] std::size_t getCaret() const { return caret_; }
+
+    // The range changed since the previous call (nullopt if nothing did)
+    std::optional<DirtyRange> takeDirtyRange();
+
+    // Appends the text (without the feedback) as UTF-8.
+    // The result is a pmr string so that the temporary copies can be made in an arena (see memory::EventArena)
+    void appendUtf8To(std::pmr::string& result) const;
+
+private:
+    void markDirty(std::size_t begin, std::size_t end);
+
+    // Decodes the XIMText into decodedCells_. Returns false if it has no string (only the feedback changes)
+    bool decode(const XIMText& text);
+
+private:
+    const int maxLength_;
+    bool isActive_ = false;
+    GapBuffer<Cell> cells_;
+    std::size_t caret_ = 0;
+    std::optional<DirtyRange> dirtyRange_;
+
+    // Reused between the draws
+    std::vector<Cell> decodedCells_;
+};
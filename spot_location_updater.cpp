@@ -0,0 +1,54 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "spot_location_updater.h"
+#include "logging.h"
+#include <stdexcept>    // std::runtime_error
+
+
+SpotLocationUpdater::SpotLocationUpdater(XIC const imContext) noexcept(false)
+    : imContext_(imContext)
+    , attributes_{ MY_LOG_X11_CALL(XVaCreateNestedList(0, XNSpotLocation, &location_, nullptr)) }
+{
+    if (attributes_ == nullptr)
+        throw std::runtime_error("XVaCreateNestedList failed");
+}
+
+
+bool SpotLocationUpdater::flush()
+{
+    if (!requestedLocation_.has_value())
+        return false;
+
+    const XPoint requested = *requestedLocation_;
+    requestedLocation_.reset();
+
+    if ( sentLocation_.has_value() && (sentLocation_->x == requested.x) && (sentLocation_->y == requested.y) )
+        return false;
+
+    location_ = requested;
+    if (const char* const failedArg = MY_LOG_X11_CALL(XSetICValues(
+            imContext_,
+            XNPreeditAttributes,
+            static_cast<XVaNestedList>(attributes_.getResource()),
+            nullptr
+        )); failedArg != nullptr)
+    {
+        MY_LOG_WARN("XSetICValues failed on \"", failedArg, '"');
+        return false;
+    }
+
+    sentLocation_ = requested;
+    return true;
+}
@@ -0,0 +1,49 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "x_raii_wrapper.h"
+#include <X11/Xlib.h>
+#include <optional>     // std::optional
+
+
+// Moves the input method's candidates window (XNSpotLocation) lazily: any number of requests between two flushes
+//   result in at most one XSetICValues, and only if the location really changed.
+// The nested list of the attributes is created once and reused: it points to the member the location is kept in.
+class SpotLocationUpdater
+{
+public:
+    explicit SpotLocationUpdater(XIC imContext) noexcept(false);
+
+    // The nested list points into the object, so it stays where it was created
+    SpotLocationUpdater(const SpotLocationUpdater&) = delete;
+    SpotLocationUpdater& operator=(const SpotLocationUpdater&) = delete;
+
+public:
+    // Only remembers the location; nothing is sent until flush()
+    void request(XPoint location) { requestedLocation_ = location; }
+
+    // Sends the last requested location if it differs from the last sent one (e.g. once per event batch or frame).
+    // Returns true if it has been sent.
+    bool flush();
+
+private:
+    XIC const imContext_;
+    std::optional<XPoint> requestedLocation_;
+    std::optional<XPoint> sentLocation_;
+    // What the nested list points to
+    XPoint location_{};
+    XRAIIWrapper<XVaNestedList, XFreeDeleter> attributes_;
+};
@@ -0,0 +1,174 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "startup_batch.h"
+#include "logging.h"
+#include <X11/Xutil.h>  // XWMHints, XSetWMHints
+#include <algorithm>    // std::find
+#include <iterator>     // std::distance
+#include <stdexcept>    // std::runtime_error
+#include <utility>      // std::move
+
+
+StartupBatch::StartupBatch(Display* const display, AtomCache& atomCache)
+    : display_(display)
+    , atomCache_(atomCache)
+#ifdef X11KW_WITH_XCB
+    , xcb_(display)
+#endif
+{}
+
+
+void StartupBatch::setAtomListProperty(
+    const Window window,
+    const std::string& property,
+    const std::vector<std::string>& atomNames
+)
+{
+    PropertySet propertySet{ window, addAtomName(property), addAtomName("ATOM"), 32, {}, {}, {} };
+    for (const std::string& name : atomNames)
+        propertySet.atoms.push_back(addAtomName(name));
+
+    propertySets_.push_back(std::move(propertySet));
+}
+
+void StartupBatch::setUtf8Property(const Window window, const std::string& property, std::string value)
+{
+    propertySets_.push_back({ window, addAtomName(property), addAtomName("UTF8_STRING"), 8, std::move(value), {}, {} });
+}
+
+void StartupBatch::setCardinalProperty(const Window window, const std::string& property, const std::uint32_t value)
+{
+    propertySets_.push_back({ window, addAtomName(property), addAtomName("CARDINAL"), 32, {}, {}, { value } });
+}
+
+void StartupBatch::setInputHint(const Window window, const bool input)
+{
+    inputHints_.emplace_back(window, input);
+}
+
+
+void StartupBatch::selectInput(const Window window, const long eventMask)
+{
+    eventMasks_.emplace_back(window, eventMask);
+}
+
+void StartupBatch::mapWindow(const Window window)
+{
+    mappedWindows_.push_back(window);
+}
+
+
+std::size_t StartupBatch::commit() noexcept(false)
+{
+    const std::size_t roundTripsBefore = atomCache_.getRoundTripCount();
+
+    const std::vector<Atom> atoms = atomCache_.internAll(atomNames_);
+    for (std::size_t i = 0; i < atoms.size(); ++i)
+    {
+        if (atoms[i] == None)
+            throw std::runtime_error("Failed to intern the atom " + atomNames_[i]);
+    }
+
+    for (const PropertySet& propertySet : propertySets_)
+        sendPropertySet(propertySet, atoms);
+
+    for (const auto& [window, input] : inputHints_)
+    {
+        XWMHints hints{};
+        hints.flags = InputHint;
+        hints.input = input ? True : False;
+        MY_LOG_X11_CALL(XSetWMHints(display_, window, &hints));
+    }
+
+    for (const auto& [window, eventMask] : eventMasks_)
+    {
+#ifdef X11KW_WITH_XCB
+        xcb_.selectInput(window, static_cast<std::uint32_t>(eventMask));
+#else
+        MY_LOG_X11_CALL(XSelectInput(display_, window, eventMask));
+#endif
+    }
+
+    for (const Window window : mappedWindows_)
+    {
+#ifdef X11KW_WITH_XCB
+        xcb_.mapWindow(window);
+#else
+        MY_LOG_X11_CALL(XMapWindow(display_, window));
+#endif
+    }
+
+#ifdef X11KW_WITH_XCB
+    xcb_.flush();
+#else
+    MY_LOG_X11_CALL(XFlush(display_));
+#endif
+
+    MY_LOG_DEBUG("Sent the startup batch: ", atomNames_.size(), " atoms, ", propertySets_.size(), " properties, ",
+                 mappedWindows_.size(), " windows");
+
+    atomNames_.clear();
+    propertySets_.clear();
+    inputHints_.clear();
+    eventMasks_.clear();
+    mappedWindows_.clear();
+
+    return atomCache_.getRoundTripCount() - roundTripsBefore;
+}
+
+
+std::size_t StartupBatch::addAtomName(const std::string& name)
+{
+    const auto iter = std::find(atomNames_.begin(), atomNames_.end(), name);
+    if (iter != atomNames_.end())
+        return static_cast<std::size_t>(std::distance(atomNames_.begin(), iter));
+
+    atomNames_.push_back(name);
+    return atomNames_.size() - 1;
+}
+
+void StartupBatch::sendPropertySet(const PropertySet& propertySet, const std::vector<Atom>& atoms)
+{
+    const Atom property = atoms[propertySet.property];
+    const Atom type = atoms[propertySet.type];
+
+    std::vector<std::uint32_t> values = propertySet.values;
+    for (const std::size_t atomIndex : propertySet.atoms)
+        values.push_back(static_cast<std::uint32_t>(atoms[atomIndex]));
+
+#ifdef X11KW_WITH_XCB
+    if (propertySet.format == 8)
+        xcb_.changeProperty(propertySet.window, property, type, 8, static_cast<std::uint32_t>(propertySet.bytes.size()), propertySet.bytes.data());
+    else
+        xcb_.changeProperty(propertySet.window, property, type, 32, static_cast<std::uint32_t>(values.size()), values.data());
+#else
+    if (propertySet.format == 8)
+    {
+        MY_LOG_X11_CALL(XChangeProperty(
+            display_, propertySet.window, property, type, 8, PropModeReplace,
+            reinterpret_cast<const unsigned char*>(propertySet.bytes.data()), static_cast<int>(propertySet.bytes.size())
+        ));
+    }
+    else
+    {
+        // Xlib takes the 32-bit properties as the arrays of longs
+        const std::vector<long> longValues(values.begin(), values.end());
+        MY_LOG_X11_CALL(XChangeProperty(
+            display_, propertySet.window, property, type, 32, PropModeReplace,
+            reinterpret_cast<const unsigned char*>(longValues.data()), static_cast<int>(longValues.size())
+        ));
+    }
+#endif
+}
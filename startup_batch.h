@@ -0,0 +1,88 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "atom_cache.h"
+#ifdef X11KW_WITH_XCB
+    #include "xcb_transport.h"
+#endif
+#include <X11/Xlib.h>
+#include <cstdint>      // std::uint8_t, std::uint32_t
+#include <cstddef>      // std::size_t
+#include <string>       // std::string
+#include <utility>      // std::pair
+#include <vector>       // std::vector
+
+
+// Collects the window setup requests of the startup and sends them as one batch.
+// The requests refer to the atoms by their names; all the atoms are resolved at commit() with one batched
+//   request (only the ones not in the AtomCache yet), so adding a property costs no extra round trip.
+// Not thread-safe.
+class StartupBatch
+{
+public:
+    StartupBatch(Display* display, AtomCache& atomCache);
+
+    StartupBatch(const StartupBatch&) = delete;
+    StartupBatch& operator=(const StartupBatch&) = delete;
+
+public:
+    // The property of the ATOM type (e.g. WM_PROTOCOLS) holding the atoms of the names
+    void setAtomListProperty(Window window, const std::string& property, const std::vector<std::string>& atomNames);
+    // The UTF8_STRING property (e.g. _NET_WM_NAME)
+    void setUtf8Property(Window window, const std::string& property, std::string value);
+    // The CARDINAL property (e.g. _NET_WM_PID)
+    void setCardinalProperty(Window window, const std::string& property, std::uint32_t value);
+    // WM_HINTS with (only) the InputHint: whether the window manager should give the keyboard focus to the window
+    void setInputHint(Window window, bool input);
+
+    void selectInput(Window window, long eventMask);
+    void mapWindow(Window window);
+
+    // Resolves the atoms, sends all the collected requests and flushes them. The maps go last,
+    //   so the window manager sees the windows completely set up.
+    // Returns the number of the round trips it took (0 if all the atoms were cached already, 1 otherwise).
+    [[nodiscard]] std::size_t commit() noexcept(false);
+
+private:
+    struct PropertySet
+    {
+        Window window;
+        // The indices in atomNames_
+        std::size_t property;
+        std::size_t type;
+        std::uint8_t format;            // 8 or 32
+        std::string bytes;              // if format is 8
+        std::vector<std::size_t> atoms; // the indices in atomNames_ if the type is ATOM
+        std::vector<std::uint32_t> values;
+    };
+
+private:
+    std::size_t addAtomName(const std::string& name);
+    void sendPropertySet(const PropertySet& propertySet, const std::vector<Atom>& atoms);
+
+private:
+    Display* const display_;
+    AtomCache& atomCache_;
+#ifdef X11KW_WITH_XCB
+    XcbTransport xcb_;
+#endif
+    // Unique, in the order of appearance
+    std::vector<std::string> atomNames_;
+    std::vector<PropertySet> propertySets_;
+    std::vector<std::pair<Window, bool>> inputHints_;
+    std::vector<std::pair<Window, long>> eventMasks_;
+    std::vector<Window> mappedWindows_;
+};
@@ -0,0 +1,275 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Checks that the per-event paths of the event loop don't allocate in the steady state: after a warm-up,
+//   synthetic key, button and client message events go through the input sinks, the key event queue,
+//   the event logging, the trace and the capture, and the allocation counters of the thread must not move.
+// Also checks that the replaced operator new follows the new handler protocol.
+//
+// Usage: X11KeyboardWindowAllocationTest <scratch-directory>
+
+#include "allocation_stats.h"
+#include "event_capture.h"
+#include "event_logging.h"
+#include "event_trace.h"
+#include "input_sink.h"
+#include "key_event_queue.h"
+#include "latency_stats.h"
+#include "logging.h"
+#include <X11/Xlib.h>
+#include <fcntl.h>      // open
+#include <unistd.h>     // close, STDERR_FILENO
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint64_t
+#include <cstdio>       // std::remove, std::fprintf
+#include <cstring>      // std::memset
+#include <exception>    // std::exception
+#include <memory>       // std::make_unique
+#include <new>          // std::bad_alloc, std::set_new_handler
+#include <string>       // std::string
+#include <string_view>  // std::string_view
+
+
+namespace
+{
+    constexpr int warmUpIterations = 1000;
+    constexpr int measuredIterations = 10000;
+
+    XEvent makeKeyEvent(const int type, const unsigned int keycode, const Time time)
+    {
+        XEvent event;
+        std::memset(&event, 0, sizeof(event));
+        event.xkey.type = type;
+        event.xkey.window = 0x200001;
+        event.xkey.time = time;
+        event.xkey.keycode = keycode;
+        event.xkey.same_screen = True;
+        return event;
+    }
+
+    XEvent makeButtonEvent(const int type, const Time time)
+    {
+        XEvent event;
+        std::memset(&event, 0, sizeof(event));
+        event.xbutton.type = type;
+        event.xbutton.window = 0x200001;
+        event.xbutton.time = time;
+        event.xbutton.button = Button1;
+        event.xbutton.x = 10;
+        event.xbutton.y = 20;
+        event.xbutton.same_screen = True;
+        return event;
+    }
+
+    XEvent makeClientMessage()
+    {
+        XEvent event;
+        std::memset(&event, 0, sizeof(event));
+        event.xclient.type = ClientMessage;
+        event.xclient.window = 0x200001;
+        event.xclient.message_type = 300;
+        event.xclient.format = 32;
+        event.xclient.data.l[0] = 301;
+        return event;
+    }
+
+
+    // What the event loop does with the events of a batch once they are received, minus the X server
+    class EventPaths
+    {
+    public:
+        explicit EventPaths(const std::string& scratchDirectory)
+            : tracePath_{ scratchDirectory + "/allocation_test_trace.x11kwtrc" }
+            , capturePath_{ scratchDirectory + "/allocation_test_capture.x11kwcap" }
+            , trace_{ withoutExistingFile(tracePath_) }
+            , capture_{ withoutExistingCapture(capturePath_) }
+        {}
+
+        ~EventPaths()
+        {
+            std::remove(tracePath_.c_str());
+            std::remove(capturePath_.c_str());
+            std::remove(x11kw::tracing::getCaptureTextFilePath(capturePath_).c_str());
+        }
+
+    public:
+        void runBatch(const int iteration)
+        {
+            const auto time = static_cast<Time>(iteration) * 10;
+            const XEvent events[] = {
+                makeKeyEvent(KeyPress, 38, time),
+                makeKeyEvent(KeyRelease, 38, time + 1),
+                makeButtonEvent(ButtonPress, time + 2),
+                makeButtonEvent(ButtonRelease, time + 3),
+                makeClientMessage()
+            };
+
+            for (const XEvent& event : events)
+            {
+                const std::uint64_t eventStart = x11kw::latency::now();
+                const x11kw::memory::AllocationCounters eventStartAllocations = x11kw::memory::getThreadAllocations();
+
+                const std::uint64_t captureIndex = capture_.append(event);
+                trace_.append(event, false);
+                if (x11kw::logging::isX11EventLogged(event.type, false))
+                    x11kw::logging::logX11Event(event, false);
+
+                switch (event.type)
+                {
+                    case KeyPress:
+                        capture_.setLookupResult(captureIndex, KeySym{ 'a' }, std::string_view{ "a" });
+                        inputBatch_.addKey(event.xkey, KeySym{ 'a' }, std::string_view{ "a" });
+                        break;
+                    case KeyRelease:
+                        inputBatch_.addKey(event.xkey, KeySym{ 'a' }, std::nullopt);
+                        break;
+                    case ButtonPress:
+                    case ButtonRelease:
+                        inputBatch_.addButton(event.xbutton);
+                        break;
+                    default:
+                        break;
+                }
+
+                latencyStats_.record(x11kw::latency::Stage::EventTotal, event.type, x11kw::latency::now() - eventStart);
+                allocationStats_.record(event.type, x11kw::memory::getThreadAllocations() - eventStartAllocations);
+            }
+
+            const x11kw::input::InputBatch batch = inputBatch_.getBatch();
+            loggingSink_(batch);
+            queueSink_(batch);
+
+            // Keeps the queue from filling up, so the pushes aren't just dropped
+            DecodedKeyEvent decoded;
+            for (std::size_t i = 0; i < batch.keys.size(); ++i)
+                keyEventQueue_.pop(decoded);
+
+            inputBatch_.clear();
+
+            trace_.flush();
+            capture_.flush();
+        }
+
+    private:
+        // The writers append to the existing files
+        static const std::string& withoutExistingFile(const std::string& path)
+        {
+            std::remove(path.c_str());
+            return path;
+        }
+
+        static const std::string& withoutExistingCapture(const std::string& path)
+        {
+            std::remove(x11kw::tracing::getCaptureTextFilePath(path).c_str());
+            return withoutExistingFile(path);
+        }
+
+    private:
+        const std::string tracePath_;
+        const std::string capturePath_;
+        x11kw::tracing::EventTraceWriter trace_;
+        x11kw::tracing::EventCaptureWriter capture_;
+        x11kw::input::InputBatchBuilder inputBatch_{ 256 };
+        x11kw::input::LoggingInputSink loggingSink_;
+        KeyEventQueue keyEventQueue_;
+        KeyEventQueueSink queueSink_{ keyEventQueue_ };
+        x11kw::latency::LatencyStats latencyStats_;
+        x11kw::memory::AllocationStats allocationStats_;
+    };
+
+
+    int newHandlerCallCount = 0;
+
+    void uninstallingNewHandler()
+    {
+        ++newHandlerCallCount;
+        std::set_new_handler(nullptr);
+    }
+
+    // An allocation which can't succeed calls the handler, retries and throws once there is no handler
+    bool isNewHandlerCalled()
+    {
+        // volatile, so that the compiler neither warns about the size nor elides the allocation
+        volatile std::size_t impossibleSize = static_cast<std::size_t>(-1) / 2;
+
+        std::set_new_handler(&uninstallingNewHandler);
+        try
+        {
+            void* const ptr = ::operator new(impossibleSize);
+            ::operator delete(ptr);
+            return false;
+        }
+        catch (const std::bad_alloc&)
+        {
+            return newHandlerCallCount == 1;
+        }
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        std::fprintf(stderr, "Usage: %s <scratch-directory>\n", argv[0]);
+        return 2;
+    }
+
+    int failureCount = 0;
+
+    try
+    {
+        // The formatting and the writing of the log are exercised, but the output isn't needed
+        const int nullFd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+        x11kw::logging::setOutputFileDescriptor(nullFd);
+        x11kw::logging::runtimeMinLevel = x11kw::logging::Level::trace;
+
+        // ~2 MB of the latency counters
+        const auto paths = std::make_unique<EventPaths>(argv[1]);
+
+        for (int i = 0; i < warmUpIterations; ++i)
+            paths->runBatch(i);
+
+        const x11kw::memory::AllocationCounters start = x11kw::memory::getThreadAllocations();
+        for (int i = warmUpIterations; i < warmUpIterations + measuredIterations; ++i)
+            paths->runBatch(i);
+        const x11kw::memory::AllocationCounters allocations = x11kw::memory::getThreadAllocations() - start;
+
+        x11kw::logging::flush();
+        x11kw::logging::setOutputFileDescriptor(STDERR_FILENO);
+        ::close(nullFd);
+
+        if (allocations.count != 0)
+        {
+            std::fprintf(stderr, "FAILED: %llu allocations (%llu bytes) in %d steady state batches\n",
+                         static_cast<unsigned long long>(allocations.count),
+                         static_cast<unsigned long long>(allocations.bytes), measuredIterations);
+            ++failureCount;
+        }
+    }
+    catch (const std::exception& err)
+    {
+        x11kw::logging::setOutputFileDescriptor(STDERR_FILENO);
+        std::fprintf(stderr, "Caught exception: %s\n", err.what());
+        return 1;
+    }
+
+    if (!isNewHandlerCalled())
+    {
+        std::fprintf(stderr, "FAILED: operator new doesn't call the new handler\n");
+        ++failureCount;
+    }
+
+    return (failureCount == 0) ? 0 : 1;
+}
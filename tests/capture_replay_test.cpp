@@ -0,0 +1,153 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Writes the event captures which X11KeyboardWindowEventReplay is then run over (see CMakeLists.txt):
+//   <capture-file> is written by EventCaptureWriter the way the event loop does it,
+//   <raw-capture-file> bypasses it and keeps the display pointer of the "recording process" in the events.
+// Both end with the ClientMessage of closing the window, whose logging asks for the atom name.
+//
+// Usage: X11KeyboardWindowCaptureReplayTest <capture-file> <raw-capture-file>
+
+#include "event_capture.h"
+#include <X11/Xlib.h>
+#include <cstdint>      // std::uint64_t
+#include <cstdio>       // std::remove, std::fprintf
+#include <cstring>      // std::memset
+#include <exception>    // std::exception
+#include <string>       // std::string
+#include <string_view>  // std::string_view
+
+
+namespace
+{
+    // Doesn't point at any connection; dereferencing it crashes
+    Display* const danglingDisplay = reinterpret_cast<Display*>(0x10);
+
+    int failureCount = 0;
+
+    void check(const bool condition, const char* const what)
+    {
+        if (!condition)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what);
+            ++failureCount;
+        }
+    }
+
+    XEvent makeKeyEvent(const int type, const unsigned int keycode, const Time time)
+    {
+        XEvent event;
+        std::memset(&event, 0, sizeof(event));
+        event.xkey.type = type;
+        event.xkey.display = danglingDisplay;
+        event.xkey.window = 0x200001;
+        event.xkey.time = time;
+        event.xkey.keycode = keycode;
+        event.xkey.same_screen = True;
+        return event;
+    }
+
+    XEvent makeCloseMessage()
+    {
+        XEvent event;
+        std::memset(&event, 0, sizeof(event));
+        event.xclient.type = ClientMessage;
+        event.xclient.display = danglingDisplay;
+        event.xclient.window = 0x200001;
+        event.xclient.message_type = 300;   // WM_PROTOCOLS of some server
+        event.xclient.format = 32;
+        event.xclient.data.l[0] = 301;      // WM_DELETE_WINDOW
+        return event;
+    }
+
+    // The commits of an input method: 17 CJK characters (51 bytes) and a longer one, spanning several text chunks
+    const std::string cjkCommit = "日本語の文章を入力しています。あり";
+    const std::string longCommit = std::string(150, 'x') + "终";
+
+    void writeCapture(const char* const path)
+    {
+        std::remove(path);
+        std::remove(x11kw::tracing::getCaptureTextFilePath(path).c_str());
+        x11kw::tracing::EventCaptureWriter writer{ path };
+
+        const std::uint64_t press = writer.append(makeKeyEvent(KeyPress, 38, 1000));
+        writer.setLookupResult(press, KeySym{ 'a' }, std::string_view{ "a" }, true, 2);
+        writer.markSkipped(writer.append(makeKeyEvent(KeyPress, 38, 1030)));
+        writer.markFilteredOut(writer.append(makeKeyEvent(KeyPress, 39, 1060)));
+        writer.setLookupResult(writer.append(makeKeyEvent(KeyRelease, 38, 1100)), KeySym{ 'a' }, std::nullopt);
+        writer.setLookupResult(writer.append(makeKeyEvent(KeyPress, 0, 1200)), std::nullopt, cjkCommit);
+        writer.setLookupResult(writer.append(makeKeyEvent(KeyPress, 0, 1300)), std::nullopt, longCommit);
+        writer.append(makeCloseMessage());
+        writer.flush();
+    }
+
+    void verifyCapture(const char* const path)
+    {
+        const x11kw::tracing::EventCaptureReader capture{ path };
+        check(capture.size() == 7, "all the received events are captured");
+
+        for (const x11kw::tracing::CaptureRecord& record : capture)
+            check(record.event.xany.display == nullptr, "the display isn't captured");
+
+        check((capture[0].flags & x11kw::tracing::CaptureRecord::LookedUp) && (capture.getText(capture[0]) == std::string_view{ "a" })
+              && (capture[0].flags & x11kw::tracing::CaptureRecord::Repeat) && (capture[0].repeatCount == 2),
+              "the lookup result is added to the key press");
+        check(capture[1].flags & x11kw::tracing::CaptureRecord::Skipped, "the skipped event is marked");
+        check(capture[2].flags & x11kw::tracing::CaptureRecord::FilteredOut, "the filtered out event is marked");
+        check(capture.getText(capture[4]) == std::string_view{ cjkCommit }, "the long text is captured whole");
+        check(capture.getText(capture[5]) == std::string_view{ longCommit }, "the text of several chunks is captured whole");
+        check(capture[6].event.type == ClientMessage, "the events are in the order of receipt");
+    }
+
+    // What the captures made before the display was zeroed look like
+    void writeRawCapture(const char* const path)
+    {
+        std::remove(path);
+        x11kw::tracing::RecordFileWriter writer{ path, { { 'X', '1', '1', 'K', 'W', 'C', 'A', 'P' }, 3, sizeof(x11kw::tracing::CaptureRecord) } };
+
+        for (const XEvent& event : { makeKeyEvent(KeyPress, 38, 1000), makeKeyEvent(KeyRelease, 38, 1100), makeCloseMessage() })
+        {
+            x11kw::tracing::CaptureRecord record;
+            std::memset(&record, 0, sizeof(record));
+            record.event = event;
+            record.repeatCount = 1;
+            writer.append(&record);
+        }
+        writer.flush();
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        std::fprintf(stderr, "Usage: %s <capture-file> <raw-capture-file>\n", argv[0]);
+        return 2;
+    }
+
+    try
+    {
+        writeCapture(argv[1]);
+        verifyCapture(argv[1]);
+        writeRawCapture(argv[2]);
+    }
+    catch (const std::exception& err)
+    {
+        std::fprintf(stderr, "Caught exception: %s\n", err.what());
+        return 1;
+    }
+
+    return (failureCount == 0) ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Replays an event capture (see X11KW_EVENT_CAPTURE) as fast as possible, without an X server or an input method:
+//   the lookup results come from the capture. The events go through what the event loop does with them after
+//   XFilterEvent: the event logging, the input batches of the library and the sink of X11KeyboardWindow
+//   (the logging one, or the key event queue of the threaded mode).
+// Reports the throughput and the per-event latencies, so the runs over the same capture are comparable.
+//
+// Usage: X11KeyboardWindowEventReplay <capture-file> [--iterations N] [--consumer-threads N] [--output FILE]
+//   The output of the replayed events (at the X11KW_LOG_LEVEL level) goes to FILE, /dev/null by default.
+
+#include "event_capture.h"
+#include "event_logging.h"
+#include "input_sink.h"
+#include "key_event_queue.h"
+#include "latency_stats.h"
+#include "logging.h"
+#include <fcntl.h>      // open
+#include <unistd.h>     // close, STDERR_FILENO
+#include <cstdint>      // std::uint64_t
+#include <cstddef>      // std::size_t
+#include <cstdlib>      // std::atoi
+#include <cstring>      // std::strcmp
+#include <exception>    // std::exception
+#include <memory>       // std::make_unique
+#include <optional>     // std::optional
+#include <stdexcept>    // std::runtime_error
+#include <string>       // std::string
+
+
+namespace
+{
+    struct Options
+    {
+        const char* capturePath = nullptr;
+        int iterations = 1;
+        int consumerThreads = 0;
+        const char* outputPath = "/dev/null";
+    };
+
+    Options parseOptions(const int argc, char* argv[]) noexcept(false)
+    {
+        Options options;
+        for (int i = 1; i < argc; ++i)
+        {
+            const auto takeValue = [&]() -> const char* {
+                if (i + 1 >= argc)
+                    throw std::runtime_error(std::string("No value for ") + argv[i]);
+                return argv[++i];
+            };
+
+            if (std::strcmp(argv[i], "--iterations") == 0)
+                options.iterations = std::atoi(takeValue());
+            else if (std::strcmp(argv[i], "--consumer-threads") == 0)
+                options.consumerThreads = std::atoi(takeValue());
+            else if (std::strcmp(argv[i], "--output") == 0)
+                options.outputPath = takeValue();
+            else if (options.capturePath == nullptr)
+                options.capturePath = argv[i];
+            else
+                throw std::runtime_error(std::string("Unexpected argument ") + argv[i]);
+        }
+
+        if (options.capturePath == nullptr)
+            throw std::runtime_error("No capture file");
+        if (options.iterations < 1)
+            throw std::runtime_error("--iterations must be positive");
+
+        return options;
+    }
+
+    // The batches of the event loop are of the events received one after another, up to its maxEventBatchSize
+    constexpr std::size_t replayBatchSize = 256;
+}
+
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        const Options options = parseOptions(argc, argv);
+        const x11kw::tracing::EventCaptureReader capture{ options.capturePath };
+
+        const int outputFd = ::open(options.outputPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (outputFd < 0)
+            throw std::runtime_error(std::string("Failed to open ") + options.outputPath);
+
+        // ~2 MB of counters
+        const auto latencyStats = std::make_unique<x11kw::latency::LatencyStats>();
+        using x11kw::latency::Stage;
+
+        std::optional<KeyEventQueue> keyEventQueue;
+        std::optional<KeyEventConsumerThreads> keyEventConsumers;
+        std::optional<KeyEventQueueSink> keyEventQueueSink;
+        if (options.consumerThreads > 0)
+        {
+            keyEventQueue.emplace();
+            keyEventConsumers.emplace(*keyEventQueue, options.consumerThreads, &logDecodedKeyEvent);
+            keyEventQueueSink.emplace(KeyEventQueueSink{ *keyEventQueue });
+        }
+
+        // The sinks X11KeyboardWindow runs the event loop with
+        x11kw::input::LoggingInputSink loggingSink;
+        const x11kw::input::BatchSinkRef sink = keyEventQueueSink.has_value() ? x11kw::input::BatchSinkRef{ *keyEventQueueSink }
+                                                                              : x11kw::input::BatchSinkRef{ loggingSink };
+        x11kw::input::InputBatchBuilder inputBatch{ replayBatchSize };
+
+        std::size_t batchSize = 0;
+        const auto finishBatch = [&] {
+            if (const x11kw::input::InputBatch batch = inputBatch.getBatch(); !batch.empty())
+                sink(batch);
+            inputBatch.clear();
+            batchSize = 0;
+        };
+
+        x11kw::logging::setOutputFileDescriptor(outputFd);
+
+        const std::uint64_t replayStart = x11kw::latency::now();
+        std::uint64_t replayedCount = 0;
+        std::uint64_t skippedCount = 0;
+        for (int iteration = 0; iteration < options.iterations; ++iteration)
+        {
+            for (const x11kw::tracing::CaptureRecord& record : capture)
+            {
+                // Like XNextEvent in the event loop, also the skipped events count towards the batch size
+                if (batchSize == replayBatchSize)
+                    finishBatch();
+                ++batchSize;
+
+                // The event loop dropped it right after XNextEvent
+                if (record.flags & x11kw::tracing::CaptureRecord::Skipped)
+                {
+                    ++skippedCount;
+                    continue;
+                }
+
+                // The display of the recording process would be dangling here (e.g. for XGetAtomName)
+                XEvent event = record.event;
+                event.xany.display = nullptr;
+                const bool eventWasFiltered = (record.flags & x11kw::tracing::CaptureRecord::FilteredOut) != 0;
+                const bool isAutorepeat = (record.flags & x11kw::tracing::CaptureRecord::Repeat) != 0;
+                const std::uint64_t eventStart = x11kw::latency::now();
+
+                if (x11kw::logging::isX11EventLogged(event.type, eventWasFiltered, isAutorepeat))
+                    x11kw::logging::logX11Event(event, eventWasFiltered);
+
+                if (!eventWasFiltered)
+                {
+                    const std::uint64_t dispatchStart = x11kw::latency::now();
+
+                    switch (event.type)
+                    {
+                        case KeyPress:
+                            // The event loop hands over the key presses of its windows only, all of them looked up
+                            if (record.flags & x11kw::tracing::CaptureRecord::LookedUp)
+                                inputBatch.addKey(event.xkey, record.getKeySym(), capture.getText(record), isAutorepeat, record.repeatCount);
+                            break;
+                        case KeyRelease:
+                            // The older captures have no keysyms of the releases
+                            inputBatch.addKey(event.xkey, record.getKeySym(), std::nullopt);
+                            break;
+                        case ButtonPress:
+                        case ButtonRelease:
+                            inputBatch.addButton(event.xbutton);
+                            break;
+                        default:
+                            break;
+                    }
+
+                    latencyStats->record(Stage::Dispatch, event.type, x11kw::latency::now() - dispatchStart);
+                }
+
+                latencyStats->record(Stage::EventTotal, event.type, x11kw::latency::now() - eventStart);
+                ++replayedCount;
+            }
+
+            finishBatch();
+        }
+
+        keyEventConsumers.reset();
+        x11kw::logging::setOutputFileDescriptor(STDERR_FILENO);
+        ::close(outputFd);
+
+        const std::uint64_t elapsedNs = x11kw::latency::now() - replayStart;
+        MY_LOG("Replayed ", replayedCount, " events (", capture.size(), " x ", options.iterations, ", ",
+               skippedCount, " skipped by the event loop) in ", elapsedNs / 1000, " us: ",
+               (elapsedNs == 0) ? 0 : replayedCount * 1'000'000'000ull / elapsedNs, " events/s");
+        if (keyEventQueue.has_value())
+        {
+            const auto stats = keyEventQueue->getStatistics();
+            MY_LOG("Key event queue statistics: pushed ", stats.pushedCount, ", dropped ", stats.droppedCount,
+                   ", text truncated ", stats.truncatedCount, ", consumed ", stats.poppedCount,
+                   ", max depth ", stats.maxDepth, '/', stats.capacity);
+        }
+
+        latencyStats->report();
+        x11kw::logging::reportSuppressedX11EventLogRecords();
+        x11kw::logging::flush();
+    }
+    catch (const std::exception& err)
+    {
+        x11kw::logging::setOutputFileDescriptor(STDERR_FILENO);
+        MY_LOG_ERROR("Caught exception: ", err.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Prints the keystrokes published by the window (see X11KW_KEYSTROKE_SHM) as they come.
+// An example of the keystroke ring reader.
+//
+// Usage: X11KeyboardWindowKeystrokeTail <shared-memory-name> [--from-newest]
+
+#include "keystroke_ring.h"
+#include <chrono>       // std::chrono::milliseconds
+#include <cstdio>       // std::printf, std::fprintf, std::fflush
+#include <cstring>      // std::strcmp
+#include <exception>    // std::exception
+#include <thread>       // std::this_thread
+
+
+int main(int argc, char* argv[])
+{
+    if ( (argc < 2) || (argc > 3) || ((argc == 3) && (std::strcmp(argv[2], "--from-newest") != 0)) )
+    {
+        std::fprintf(stderr, "Usage: %s <shared-memory-name> [--from-newest]\n", argv[0]);
+        return 2;
+    }
+
+    try
+    {
+        x11kw::keystrokes::KeystrokeRingReader reader{ argv[1], argc == 3 };
+        x11kw::keystrokes::Keystroke keystroke;
+
+        for (;;)
+        {
+            switch (reader.read(keystroke))
+            {
+                case x11kw::keystrokes::KeystrokeRingReader::ReadStatus::Ok:
+                {
+                    const auto& record = keystroke.record;
+                    std::printf("#%llu %s keycode %u state 0x%x keySym 0x%llx",
+                                static_cast<unsigned long long>(record.sequence),
+                                (record.flags & x11kw::keystrokes::KeystrokeRecord::Press) ? "press  " : "release",
+                                record.keycode, record.state, static_cast<unsigned long long>(record.keySym));
+                    if (record.flags & x11kw::keystrokes::KeystrokeRecord::HasText)
+                        std::printf(" text \"%.*s\"", static_cast<int>(keystroke.text.size()), keystroke.text.data());
+                    if (record.flags & x11kw::keystrokes::KeystrokeRecord::Repeat)
+                        std::printf(" repeat x%u", record.repeatCount);
+                    std::printf("\n");
+                    break;
+                }
+                case x11kw::keystrokes::KeystrokeRingReader::ReadStatus::Lagged:
+                {
+                    std::printf("... lagged behind, %llu keystroke(s) lost in total\n",
+                                static_cast<unsigned long long>(reader.getLostCount()));
+                    break;
+                }
+                case x11kw::keystrokes::KeystrokeRingReader::ReadStatus::Empty:
+                {
+                    if (reader.isPublisherClosed())
+                        return 0;
+
+                    std::fflush(stdout);
+                    // The reading itself never waits; polling is this tool's choice
+                    std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+                    break;
+                }
+            }
+        }
+    }
+    catch (const std::exception& err)
+    {
+        std::fprintf(stderr, "Caught exception: %s\n", err.what());
+        return 1;
+    }
+}
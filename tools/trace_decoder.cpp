@@ -0,0 +1,54 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Decodes a binary event trace (see X11KW_EVENT_TRACE) into the same text the live event logging prints.
+
+#include "event_trace.h"
+#include "event_logging.h"
+#include "logging.h"
+#include <unistd.h>     // STDOUT_FILENO
+#include <exception>    // std::exception
+
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        MY_LOG_ERROR("Usage: ", argv[0], " <trace-file>");
+        return 2;
+    }
+
+    try
+    {
+        const x11kw::tracing::EventTraceReader trace{ argv[1] };
+
+        x11kw::logging::setOutputFileDescriptor(STDOUT_FILENO);
+        for (const x11kw::tracing::TraceRecord& record : trace)
+        {
+            x11kw::logging::logX11Event(
+                x11kw::tracing::restoreEvent(record),
+                (record.flags & x11kw::tracing::TraceRecord::FilteredOut) != 0
+            );
+        }
+        x11kw::logging::flush();
+    }
+    catch (const std::exception& err)
+    {
+        x11kw::logging::setOutputFileDescriptor(STDERR_FILENO);
+        MY_LOG_ERROR("Caught exception: ", err.what());
+        return 1;
+    }
+
+    return 0;
+}
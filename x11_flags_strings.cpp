@@ -0,0 +1,158 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "x11_flags_strings.h"
+#include "event_type_table.h"
+#include <array>        // std::array
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint32_t
+
+
+namespace
+{
+    // Describes how to turn a combination of BitsCount flags into a string
+    template<std::size_t BitsCount>
+    struct FlagsSpec
+    {
+        // The name of the flag of each bit of the combination index
+        std::array<std::string_view, BitsCount> namesByBit;
+        // The bits in the order the names are printed
+        std::array<std::size_t, BitsCount> printOrder;
+        std::string_view prefix;
+        std::string_view separator;
+        std::string_view suffix;
+    };
+
+    template<std::size_t BitsCount>
+    constexpr std::size_t getStringLength(const FlagsSpec<BitsCount>& spec, const std::size_t combination)
+    {
+        std::size_t length = spec.prefix.size() + spec.suffix.size();
+        bool isFirst = true;
+        for (const std::size_t bit : spec.printOrder)
+        {
+            if ( (combination & (std::size_t{1} << bit)) == 0 )
+                continue;
+
+            length += spec.namesByBit[bit].size() + (isFirst ? 0 : spec.separator.size());
+            isFirst = false;
+        }
+        return length;
+    }
+
+    template<std::size_t BitsCount>
+    constexpr std::size_t getAllStringsLength(const FlagsSpec<BitsCount>& spec)
+    {
+        std::size_t length = 0;
+        for (std::size_t combination = 0; combination < (std::size_t{1} << BitsCount); ++combination)
+            length += getStringLength(spec, combination);
+        return length;
+    }
+
+
+    // The strings of all the combinations, stored back to back
+    template<std::size_t BitsCount, std::size_t AllStringsLength>
+    struct FlagsStringTable
+    {
+        char chars[AllStringsLength];
+        std::uint32_t offsets[(std::size_t{1} << BitsCount) + 1];
+
+        [[nodiscard]] constexpr std::string_view operator[](const std::size_t combination) const
+        {
+            return { chars + offsets[combination], offsets[combination + 1] - offsets[combination] };
+        }
+    };
+
+    // Kept as plain as possible: the compilers limit the number of operations of constant evaluations
+    template<std::size_t AllStringsLength, std::size_t BitsCount>
+    constexpr auto makeFlagsStringTable(const FlagsSpec<BitsCount>& spec)
+    {
+        FlagsStringTable<BitsCount, AllStringsLength> table{};
+
+        std::size_t pos = 0;
+        for (std::size_t combination = 0; combination < (std::size_t{1} << BitsCount); ++combination)
+        {
+            table.offsets[combination] = static_cast<std::uint32_t>(pos);
+
+            for (std::size_t i = 0; i < spec.prefix.size(); ++i)
+                table.chars[pos++] = spec.prefix[i];
+
+            bool isFirst = true;
+            for (std::size_t orderIndex = 0; orderIndex < BitsCount; ++orderIndex)
+            {
+                const std::size_t bit = spec.printOrder[orderIndex];
+                if ( (combination & (std::size_t{1} << bit)) == 0 )
+                    continue;
+
+                if (!isFirst)
+                {
+                    for (std::size_t i = 0; i < spec.separator.size(); ++i)
+                        table.chars[pos++] = spec.separator[i];
+                }
+                const std::string_view name = spec.namesByBit[bit];
+                for (std::size_t i = 0; i < name.size(); ++i)
+                    table.chars[pos++] = name[i];
+                isFirst = false;
+            }
+
+            for (std::size_t i = 0; i < spec.suffix.size(); ++i)
+                table.chars[pos++] = spec.suffix[i];
+        }
+        table.offsets[std::size_t{1} << BitsCount] = static_cast<std::uint32_t>(pos);
+
+        return table;
+    }
+
+
+    // The bits are the ones of the X11 state masks: ShiftMask is 1 << 0, ..., Button5Mask is 1 << 12
+    constexpr FlagsSpec<13> modifiersSpec{
+        { "Shift", "Lock", "Control", "Mod1", "Mod2", "Mod3", "Mod4", "Mod5",
+          "Button1", "Button2", "Button3", "Button4", "Button5" },
+        { 8, 9, 10, 11, 12, 0, 1, 2, 3, 4, 5, 6, 7 },
+        "[", ", ", "]"
+    };
+    static_assert( ShiftMask == (1 << 0) && Mod5Mask == (1 << 7) && Button1Mask == (1 << 8) && Button5Mask == (1 << 12) );
+
+    constexpr auto modifiersStrings = makeFlagsStringTable<getAllStringsLength(modifiersSpec)>(modifiersSpec);
+
+
+    // Bits 0-4 are the preedit flags (XIMPreeditArea...XIMPreeditNone),
+    //   bits 5-8 are the status flags (XIMStatusArea...XIMStatusNone) shifted down from 8-11.
+    constexpr FlagsSpec<9> inputStyleSpec{
+        { "XIMPreeditArea", "XIMPreeditCallbacks", "XIMPreeditPosition", "XIMPreeditNothing", "XIMPreeditNone",
+          "XIMStatusArea", "XIMStatusCallbacks", "XIMStatusNothing", "XIMStatusNone" },
+        { 0, 1, 2, 3, 4, 5, 6, 7, 8 },
+        "", " | ", ""
+    };
+    static_assert( XIMPreeditArea == 0x0001 && XIMPreeditNone == 0x0010 );
+    static_assert( XIMStatusArea == 0x0100 && XIMStatusNone == 0x0800 );
+
+    constexpr auto inputStyleStrings = makeFlagsStringTable<getAllStringsLength(inputStyleSpec)>(inputStyleSpec);
+}
+
+
+std::string_view XModifiersStateToString(const decltype(XKeyEvent::state) state)
+{
+    return modifiersStrings[state & 0x1FFF];
+}
+
+std::string_view XIMStyleToString(const XIMStyle style)
+{
+    return inputStyleStrings[(style & 0x1F) | ((style >> 3) & 0x1E0)];
+}
+
+
+std::string_view XEventTypeToString(const int type)
+{
+    return x11kw::dispatch::eventTypeNames[x11kw::dispatch::getEventTypeIndex(type)];
+}
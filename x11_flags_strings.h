@@ -0,0 +1,30 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>
+#include <string_view>  // std::string_view
+
+
+// "[Button1, Shift, Mod2]" etc. Only the 13 defined modifier bits are taken into account.
+// The strings are precomputed at compile time, so it doesn't allocate.
+std::string_view XModifiersStateToString(decltype(XKeyEvent::state) state);
+
+// "XIMPreeditCallbacks | XIMStatusNothing" etc. for the preedit/status flags of the input style.
+// The strings are precomputed at compile time, so it doesn't allocate.
+std::string_view XIMStyleToString(XIMStyle style);
+
+// "KeyPress", "ClientMessage" etc. for the core event types; "<unknown>" for the rest.
+std::string_view XEventTypeToString(int type);
@@ -0,0 +1,153 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include "logging.h"
+#include <X11/Xlib.h>
+#include <utility>      // std::move, std::exchange
+#include <type_traits>  // std::is_trivially_destructible_v, std::is_empty_v, std::is_final_v, std::conditional_t
+
+
+// Deleter policy for the resources which don't need to be released
+struct XNoopDeleter
+{
+    template<typename T>
+    void operator()(T&) const noexcept {}
+};
+
+// Deleter policy for the resources released via XFree
+struct XFreeDeleter
+{
+    template<typename T>
+    void operator()(T* resource) const { if (resource != nullptr) MY_LOG_X11_CALL_VALUELESS(XFree(resource)); }
+};
+
+// Deleter policies of the connection and the input method objects
+struct XCloseDisplayDeleter
+{
+    void operator()(Display* const display) const { MY_LOG_X11_CALL(XCloseDisplay(display)); }
+};
+
+struct XCloseIMDeleter
+{
+    void operator()(XIM const inputMethod) const { MY_LOG_X11_CALL(XCloseIM(inputMethod)); }
+};
+
+struct XDestroyICDeleter
+{
+    void operator()(XIC const inputContext) const { MY_LOG_X11_CALL_VALUELESS(XDestroyIC(inputContext)); }
+};
+
+
+namespace x11kw::detail
+{
+    // Keeps the resource and its deleter; the empty deleters take no space (empty base optimization)
+    template<typename T, typename Deleter, bool = std::is_empty_v<Deleter> && !std::is_final_v<Deleter>>
+    struct XRAIIWrapperStorage : private Deleter
+    {
+        XRAIIWrapperStorage(T&& resourceToOwn, Deleter&& deleterToUse)
+            : Deleter(std::move(deleterToUse))
+            , resource(std::move(resourceToOwn))
+        {}
+
+        Deleter& getDeleter() { return *this; }
+
+        T resource;
+    };
+
+    template<typename T, typename Deleter>
+    struct XRAIIWrapperStorage<T, Deleter, false>
+    {
+        XRAIIWrapperStorage(T&& resourceToOwn, Deleter&& deleterToUse)
+            : deleter(std::move(deleterToUse))
+            , resource(std::move(resourceToOwn))
+        {}
+
+        Deleter& getDeleter() { return deleter; }
+
+        Deleter deleter;
+        T resource;
+    };
+}
+
+
+// Owns an X11 resource and releases it with Deleter.
+// The value-initialized T (nullptr, None) means "no resource": it's what a moved-from wrapper holds,
+//   and the deleter isn't called for it.
+// Deleter is a policy type (or a lambda, via the class template argument deduction);
+//   the stateless deleters cost nothing, so the wrapper is exactly as large as the raw handle.
+template<typename T, typename Deleter = XNoopDeleter>
+class XRAIIWrapper
+{
+    static_assert( std::is_trivially_destructible_v<T> );
+
+public:
+    XRAIIWrapper(T&& resource, Deleter deleter = Deleter{})
+        : storage_{ std::move(resource), std::move(deleter) }
+    {}
+
+    XRAIIWrapper(const XRAIIWrapper&) = delete;
+    XRAIIWrapper(XRAIIWrapper&& other)
+        : storage_{ std::exchange(other.storage_.resource, T{}), std::move(other.storage_.getDeleter()) }
+    {}
+
+    ~XRAIIWrapper()
+    {
+        reset();
+    }
+
+public:
+    XRAIIWrapper& operator=(const XRAIIWrapper&) = delete;
+    XRAIIWrapper& operator=(XRAIIWrapper&& rhs)
+    {
+        if (&rhs != this)
+        {
+            reset();
+            storage_.resource = std::exchange(rhs.storage_.resource, T{});
+            storage_.getDeleter() = std::move(rhs.storage_.getDeleter());
+        }
+
+        return *this;
+    }
+
+public:
+    T& getResource() { return storage_.resource; }
+    [[nodiscard]] const T& getResource() const { return storage_.resource; }
+
+    operator const T&() const { return storage_.resource; }
+
+    template<typename R>
+    explicit operator R() const { return (R)storage_.resource; }
+
+private:
+    void reset()
+    {
+        if (storage_.resource != T{})
+        {
+            storage_.getDeleter()(storage_.resource);
+            storage_.resource = T{};
+        }
+    }
+
+private:
+    x11kw::detail::XRAIIWrapperStorage<T, Deleter> storage_;
+};
+
+
+static_assert( sizeof(XRAIIWrapper<Window>) == sizeof(Window) );
+static_assert( sizeof(XRAIIWrapper<XVaNestedList, XFreeDeleter>) == sizeof(XVaNestedList) );
+static_assert( sizeof(XRAIIWrapper<XIMStyles*, XFreeDeleter>) == sizeof(XIMStyles*) );
+static_assert( sizeof(XRAIIWrapper<Display*, XCloseDisplayDeleter>) == sizeof(Display*) );
+static_assert( sizeof(XRAIIWrapper<XIC, XDestroyICDeleter>) == sizeof(XIC) );
@@ -0,0 +1,126 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "xcb_transport.h"
+#include "logging.h"
+#include <X11/Xlib-xcb.h>   // XGetXCBConnection
+#include <cstdlib>          // std::free
+#include <cstring>          // std::strlen
+#include <stdexcept>        // std::runtime_error
+
+
+XcbTransport::XcbTransport(Display* const display) noexcept(false)
+    : connection_(MY_LOG_X11_CALL(XGetXCBConnection(display)))
+{
+    if (connection_ == nullptr)
+        throw std::runtime_error("XGetXCBConnection failed");
+}
+
+
+XcbTransport::InternAtomsRequest XcbTransport::sendInternAtoms(
+    const char* const* const names,
+    const std::size_t count,
+    const bool onlyIfExists
+)
+{
+    InternAtomsRequest request{ names, std::vector<xcb_intern_atom_cookie_t>(count) };
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        request.cookies[i] = xcb_intern_atom(
+            connection_, onlyIfExists ? 1 : 0, static_cast<std::uint16_t>(std::strlen(names[i])), names[i]
+        );
+    }
+    return request;
+}
+
+std::vector<Atom> XcbTransport::receiveAtoms(const InternAtomsRequest& request)
+{
+    std::vector<Atom> atoms(request.cookies.size(), None);
+    for (std::size_t i = 0; i < atoms.size(); ++i)
+    {
+        xcb_generic_error_t* error = nullptr;
+        if (xcb_intern_atom_reply_t* const reply = xcb_intern_atom_reply(connection_, request.cookies[i], &error); reply != nullptr)
+        {
+            atoms[i] = reply->atom;
+            std::free(reply);
+        }
+        if (error != nullptr)
+        {
+            MY_LOG_WARN("xcb_intern_atom(\"", request.names[i], "\") failed with the error ", static_cast<int>(error->error_code));
+            std::free(error);
+        }
+    }
+
+    MY_LOG_TRACE("Interned ", atoms.size(), " atoms with the pipelined XCB requests");
+    return atoms;
+}
+
+
+XcbTransport::GetAtomNamesRequest XcbTransport::sendGetAtomNames(const Atom* const atoms, const std::size_t count)
+{
+    GetAtomNamesRequest request{ std::vector<xcb_get_atom_name_cookie_t>(count) };
+    for (std::size_t i = 0; i < count; ++i)
+        request.cookies[i] = xcb_get_atom_name(connection_, static_cast<xcb_atom_t>(atoms[i]));
+    return request;
+}
+
+std::vector<std::string> XcbTransport::receiveAtomNames(const GetAtomNamesRequest& request)
+{
+    std::vector<std::string> names(request.cookies.size());
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+        xcb_generic_error_t* error = nullptr;
+        if (xcb_get_atom_name_reply_t* const reply = xcb_get_atom_name_reply(connection_, request.cookies[i], &error); reply != nullptr)
+        {
+            names[i].assign(xcb_get_atom_name_name(reply), static_cast<std::size_t>(xcb_get_atom_name_name_length(reply)));
+            std::free(reply);
+        }
+        if (error != nullptr)
+            std::free(error);
+    }
+
+    MY_LOG_TRACE("Got ", names.size(), " atom names with the pipelined XCB requests");
+    return names;
+}
+
+
+void XcbTransport::changeProperty(
+    const Window window,
+    const Atom property,
+    const Atom type,
+    const std::uint8_t format,
+    const std::uint32_t count,
+    const void* const data
+)
+{
+    xcb_change_property(
+        connection_, XCB_PROP_MODE_REPLACE, static_cast<xcb_window_t>(window), static_cast<xcb_atom_t>(property),
+        static_cast<xcb_atom_t>(type), format, count, data
+    );
+}
+
+void XcbTransport::selectInput(const Window window, const std::uint32_t eventMask)
+{
+    xcb_change_window_attributes(connection_, static_cast<xcb_window_t>(window), XCB_CW_EVENT_MASK, &eventMask);
+}
+
+void XcbTransport::mapWindow(const Window window)
+{
+    xcb_map_window(connection_, static_cast<xcb_window_t>(window));
+}
+
+void XcbTransport::flush()
+{
+    xcb_flush(connection_);
+}
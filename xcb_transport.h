@@ -0,0 +1,78 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>
+#include <xcb/xcb.h>
+#include <cstdint>      // std::uint32_t
+#include <cstddef>      // std::size_t
+#include <string>       // std::string
+#include <vector>       // std::vector
+
+
+// Direct XCB requests over the connection of the Display (the X11KW_WITH_XCB build option).
+// They bypass the Xlib's display lock and are pipelined: all the requests of a call go out before
+//   the first reply is waited for, so a whole group of atoms costs one round trip.
+// The events stay with Xlib (the input method only works with the Xlib's event queue and XFilterEvent),
+//   so only the requests are sent this way.
+class XcbTransport
+{
+public:
+    explicit XcbTransport(Display* display) noexcept(false);
+
+public:
+    [[nodiscard]] xcb_connection_t* getConnection() const { return connection_; }
+
+    // The replies of the requests sent so far, still to be received
+    struct InternAtomsRequest
+    {
+        const char* const* names;
+        std::vector<xcb_intern_atom_cookie_t> cookies;
+    };
+    struct GetAtomNamesRequest
+    {
+        std::vector<xcb_get_atom_name_cookie_t> cookies;
+    };
+
+    // xcb_intern_atom for all the names at once. The names must outlive the request.
+    // The atoms which don't exist are None if onlyIfExists is set
+    InternAtomsRequest sendInternAtoms(const char* const* names, std::size_t count, bool onlyIfExists);
+    std::vector<Atom> receiveAtoms(const InternAtomsRequest& request);
+
+    // xcb_get_atom_name for all the atoms at once. The failed ones get the empty names
+    GetAtomNamesRequest sendGetAtomNames(const Atom* atoms, std::size_t count);
+    std::vector<std::string> receiveAtomNames(const GetAtomNamesRequest& request);
+
+    std::vector<Atom> internAtoms(const char* const* names, std::size_t count, bool onlyIfExists)
+    {
+        return receiveAtoms(sendInternAtoms(names, count, onlyIfExists));
+    }
+    std::vector<std::string> getAtomNames(const Atom* atoms, std::size_t count)
+    {
+        return receiveAtomNames(sendGetAtomNames(atoms, count));
+    }
+
+    // The window setup requests. They don't wait for anything (the errors are reported as the events);
+    //   they're sent with the next flush() or an Xlib call which flushes.
+    // format is 8, 16 or 32 (the size of an element of the data in bits), like for xcb_change_property
+    void changeProperty(Window window, Atom property, Atom type, std::uint8_t format, std::uint32_t count, const void* data);
+    void selectInput(Window window, std::uint32_t eventMask);
+    void mapWindow(Window window);
+
+    void flush();
+
+private:
+    xcb_connection_t* const connection_;
+};
@@ -0,0 +1,141 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include "xinput2_keyboard.h"
+#include "logging.h"
+#include <X11/extensions/XInput2.h>
+#include <cstring>      // std::memset
+#include <stdexcept>    // std::runtime_error
+#include <string>       // std::to_string
+
+
+XInput2Keyboard::XInput2Keyboard(Display* const display, const int deviceId) noexcept(false)
+    : display_(display)
+    , deviceId_(deviceId)
+{
+    int firstEvent = 0;
+    int firstError = 0;
+    if (!MY_LOG_X11_CALL(XQueryExtension(display_, "XInputExtension", &extensionOpcode_, &firstEvent, &firstError)))
+        throw std::runtime_error("The X server has no XInput extension");
+
+    int majorVersion = 2;
+    int minorVersion = 0;
+    if (MY_LOG_X11_CALL(XIQueryVersion(display_, &majorVersion, &minorVersion)) != Success)
+    {
+        throw std::runtime_error("The X server supports XInput " + std::to_string(majorVersion) + '.'
+                                 + std::to_string(minorVersion) + " only, 2.0 is required");
+    }
+
+    // The raw events are delivered to the root window only
+    unsigned char rawMaskBits[XIMaskLen(XI_LASTEVENT)] = {};
+    XISetMask(rawMaskBits, XI_RawKeyPress);
+    XISetMask(rawMaskBits, XI_RawKeyRelease);
+
+    // The raw events of the master devices come with the slave's id as the sourceid
+    XIEventMask rawMask{ (deviceId_ == XIAllMasterDevices) ? XIAllDevices : deviceId_, sizeof(rawMaskBits), rawMaskBits };
+    if (MY_LOG_X11_CALL(XISelectEvents(display_, DefaultRootWindow(display_), &rawMask, 1)) != Success)
+        throw std::runtime_error("XISelectEvents failed for the raw key events");
+
+    MY_LOG("Using XInput ", majorVersion, '.', minorVersion, " for the keyboard (device ", deviceId_, ')');
+}
+
+
+void XInput2Keyboard::selectEvents(const Window window) noexcept(false)
+{
+    unsigned char maskBits[XIMaskLen(XI_LASTEVENT)] = {};
+    XISetMask(maskBits, XI_KeyPress);
+    XISetMask(maskBits, XI_KeyRelease);
+
+    XIEventMask mask{ deviceId_, sizeof(maskBits), maskBits };
+    if (MY_LOG_X11_CALL(XISelectEvents(display_, window, &mask, 1)) != Success)
+        throw std::runtime_error("XISelectEvents failed for the key events");
+}
+
+
+XInput2Keyboard::EventKind XInput2Keyboard::handleEvent(XEvent& event, const std::uint64_t receiptTime)
+{
+    XGenericEventCookie& cookie = event.xcookie;
+    if ( (cookie.type != GenericEvent) || (cookie.extension != extensionOpcode_) )
+        return EventKind::NotXInput2;
+
+    if (!XGetEventData(display_, &cookie))
+    {
+        MY_LOG_WARN("XGetEventData failed for the XInput2 event ", cookie.evtype);
+        return EventKind::Raw;
+    }
+
+    switch (cookie.evtype)
+    {
+        case XI_RawKeyPress:
+        {
+            const auto& rawEvent = *static_cast<const XIRawEvent*>(cookie.data);
+            if ( (rawEvent.detail > 0) && (rawEvent.detail < 256) )
+                rawPressTimes_[rawEvent.detail] = receiptTime;
+            break;
+        }
+        case XI_RawKeyRelease:
+        {
+            break;
+        }
+        case XI_KeyPress:
+        case XI_KeyRelease:
+        {
+            const auto& deviceEvent = *static_cast<const XIDeviceEvent*>(cookie.data);
+
+            XEvent coreEvent;
+            std::memset(&coreEvent, 0, sizeof(coreEvent));
+
+            XKeyEvent& keyEvent = coreEvent.xkey;
+            keyEvent.type = (cookie.evtype == XI_KeyPress) ? KeyPress : KeyRelease;
+            keyEvent.serial = deviceEvent.serial;
+            keyEvent.send_event = deviceEvent.send_event;
+            keyEvent.display = deviceEvent.display;
+            keyEvent.window = deviceEvent.event;
+            keyEvent.root = deviceEvent.root;
+            keyEvent.subwindow = deviceEvent.child;
+            keyEvent.time = deviceEvent.time;
+            keyEvent.x = static_cast<int>(deviceEvent.event_x);
+            keyEvent.y = static_cast<int>(deviceEvent.event_y);
+            keyEvent.x_root = static_cast<int>(deviceEvent.root_x);
+            keyEvent.y_root = static_cast<int>(deviceEvent.root_y);
+            // The core state: the modifiers, the group in bits 13-14 (as XKB puts it) and the buttons held
+            keyEvent.state = static_cast<unsigned>(deviceEvent.mods.effective)
+                             | (static_cast<unsigned>(deviceEvent.group.effective & 0x3) << 13);
+            for (int button = 1; (button <= 5) && (button < deviceEvent.buttons.mask_len * 8); ++button)
+            {
+                if (XIMaskIsSet(deviceEvent.buttons.mask, button))
+                    keyEvent.state |= Button1Mask << (button - 1);
+            }
+            keyEvent.keycode = static_cast<unsigned>(deviceEvent.detail);
+            keyEvent.same_screen = True;
+
+            if (keyEvent.type == KeyPress)
+                wasLastPressRepeated_ = (deviceEvent.flags & XIKeyRepeat) != 0;
+            lastSourceDevice_ = deviceEvent.sourceid;
+
+            MY_LOG_TRACE("XInput2 key event of the device ", deviceEvent.deviceid, " (source ", deviceEvent.sourceid, ')');
+
+            XFreeEventData(display_, &cookie);
+            event = coreEvent;
+            return EventKind::Translated;
+        }
+        default:
+        {
+            break;
+        }
+    }
+
+    XFreeEventData(display_, &cookie);
+    return EventKind::Raw;
+}
@@ -0,0 +1,76 @@
+// Copyright 2022-2024 Nikita Provotorov
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#pragma once
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XI2.h>  // XIAllMasterDevices
+#include <cstdint>      // std::uint64_t
+
+
+// The XInput2 keyboard input path (the X11KW_WITH_XINPUT2 build option, then the X11KW_XINPUT2 environment variable).
+// The XI2 key events of the windows are translated into the core XKeyEvents, so they go through the same
+//   XFilterEvent / Xutf8LookupString pipeline; the server delivers only the XI2 events of the selected kinds,
+//   not the core ones. The raw key events of the root window are selected too: they come straight from
+//   the devices (before any grab or focus processing), so their receipt time is the earliest point
+//   the latency can be measured from.
+class XInput2Keyboard
+{
+public:
+    enum class EventKind
+    {
+        NotXInput2,     // Not an XInput2 event of this extension, handled as usual
+        Raw,            // A raw key event; it has been accounted and should be skipped
+        Translated      // A key event; it's been replaced with the equivalent core KeyPress/KeyRelease
+    };
+
+public:
+    // Throws if the server doesn't support XInput 2.0.
+    // If deviceId is a slave keyboard, only its events are delivered; XIAllMasterDevices selects all the keyboards.
+    XInput2Keyboard(Display* display, int deviceId = XIAllMasterDevices) noexcept(false);
+
+    XInput2Keyboard(const XInput2Keyboard&) = delete;
+    XInput2Keyboard& operator=(const XInput2Keyboard&) = delete;
+
+public:
+    // Selects the XI2 key events of the window (instead of the core ones)
+    void selectEvents(Window window) noexcept(false);
+
+    // Fetches the data of the XI2 event and handles it (see EventKind).
+    // receiptTime is the latency::now() of the moment the event has been taken from the queue.
+    EventKind handleEvent(XEvent& event, std::uint64_t receiptTime);
+
+    // The receipt time of the raw press of the key received since the previous call (0 if none)
+    std::uint64_t takeRawPressTime(const KeyCode keycode)
+    {
+        const std::uint64_t result = rawPressTimes_[keycode];
+        rawPressTimes_[keycode] = 0;
+        return result;
+    }
+
+    // Whether the last translated KeyPress is an autorepeat (XIKeyRepeat)
+    [[nodiscard]] bool wasLastPressRepeated() const { return wasLastPressRepeated_; }
+
+    // The source (slave) device of the last translated key event
+    [[nodiscard]] int getLastSourceDevice() const { return lastSourceDevice_; }
+
+private:
+    Display* const display_;
+    const int deviceId_;
+    int extensionOpcode_ = 0;
+
+    std::uint64_t rawPressTimes_[256] = {};
+    bool wasLastPressRepeated_ = false;
+    int lastSourceDevice_ = 0;
+};